@@ -28,10 +28,19 @@
 #include "cb_circle.h"
 #include "cb_view.h"
 #include "cb_plyread.h"
+#include "cb_ray_bvh.h"
+#include "cb_ray_grid.h"
 #include "cb_ray_object.h"
 #include "cb_module.h"
 #include "cb_ray_module.h"
 #include "cb_ray.h"
+#include "cb_ray_packet.h"
+#include "cb_ray_wave.h"
+#include "cb_ray_camera.h"
+#include "cb_ray_render.h"
+#include "cb_ray_checkpoint.h"
+#include "cb_ray_compile.h"
+#include "cb_ray_raster.h"
 
 
 #endif
\ No newline at end of file
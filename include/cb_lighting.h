@@ -8,7 +8,8 @@
 #define CB_LIGHTING_H
 
 
-#define MAX_LIGHTS 64
+#define LIGHT_AREA_SAMPLES 8 // default shadow rays per side for an area light
+#define LIGHT_AREA_PROBE 2 // shadow rays per side sent first to an area light
 
 typedef enum {
   LightNone,
@@ -16,6 +17,8 @@ typedef enum {
   LightDirect,
   LightPoint,
   LightSpot,
+  LightArea, // rectangle, centered on position
+  LightSphere,
 } LightType;
 
 
@@ -26,19 +29,27 @@ typedef struct {
   Point position;
   float cutoff;  // stores the cosine of the cutoff angle of a spotlight
   float sharpness;  // coefficient of the falloff function (power for cosine)
+  Vector edge[2];  // sides of an area light
+  float radius;  // radius of a sphere light
+  int samples;  // shadow rays per side where an area or sphere light is partly hidden
 } Light;
 
 // Lighting struct
 typedef struct {
   int nLights;
-  Light light[MAX_LIGHTS];
+  int maxLights;  // room in light before it has to grow
+  Light *light;
 } Lighting;
 
 void Light_init( Light *light);
 void Light_copy( Light *to, Light *from);
 Lighting *Lighting_create( void);
 void Lighting_init( Lighting *l);
+void Lighting_clear( Lighting *l);
+void Lighting_delete( Lighting *l);
 void Lighting_add( Lighting *l, LightType type, Color *c, Vector *dir, Point *pos, float cutoff, float sharpness);
+void Lighting_addArea( Lighting *l, Color *c, Point *center, Vector *side1, Vector *side2, int samples);
+void Lighting_addSphere( Lighting *l, Color *c, Point *center, float radius, int samples);
 void Lighting_shading( Lighting *l, Vector *N, Vector *V, 
                        Point *p, Color *Cb, Color *Cs, float s, int oneSided, Color *c);
 void Light_diffuse( Light *l, Vector *N, Vector *V, 
@@ -14,7 +14,7 @@
 
 // Matrix
 typedef struct {
-  double m[16];
+  Real m[16];
 } Matrix;
 
 
@@ -30,6 +30,7 @@ void Matrix_set(Matrix *m, int r, int c, double v);
 void Matrix_copy(Matrix *dest, Matrix *src);
 void Matrix_transpose(Matrix *m);
 void Matrix_multiply(Matrix *left, Matrix *right, Matrix *m);
+int Matrix_invert(Matrix *m, Matrix *inv);
 void Matrix_xformPoint(Matrix *m, Point *p, Point *q);
 void Matrix_xformVector(Matrix *m, Vector *p, Vector *q);
 void Matrix_xformPolygon(Matrix *m, Polygon *p);
@@ -19,6 +19,8 @@ typedef struct {
 } ply_property;
 
 int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals);
+int readPLYMesh(char filename[], int *nVertex, Point **vlist, Vector **nlist,
+										int *nTriangles, int **ilist);
 
 
 #endif
@@ -12,9 +12,17 @@
  *				STRUCTURES				 * 
  *****************************************/
 
+// Scalar type of points, vectors and matrices, and so of everything
+// the ray tracer stores. Build with -DCB_FLOAT for single precision.
+#ifdef CB_FLOAT
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 // Point
 typedef struct {
-  double val[4];
+  Real val[4];
 } Point;
 
 
@@ -10,8 +10,21 @@
 #define CB_RAY_H
 
 
-extern Lighting *global_light;
-extern RayModule *global_rayModule;
+#define RAY_MISS -1.0 		// distance returned when a ray misses
+#define RAY_OCCLUDERS 64 		// shadow blockers remembered per thread
+#define RAY_FOOT_RES 8 		// footprint voxels along each axis
+#define RAY_FOOT_WORDS (RAY_FOOT_RES * RAY_FOOT_RES * RAY_FOOT_RES / 64)
+#define RAY_MIN_WEIGHT 0.001 	// default weight below which a path stops
+
+// Start of a new ray off a surface, relative to the size of the
+// coordinates there: about 250 units in the last place for doubles.
+// Floats get about 80, the least that stays clear of acne on the bench
+// scenes; every step more moves deep glass paths further off.
+#ifdef CB_FLOAT
+#define RAY_OFFSET 1e-5
+#else
+#define RAY_OFFSET 6e-14
+#endif
 
 
 // Ray structure
@@ -20,9 +33,65 @@ typedef struct {
   Vector v; 		// ray vector
 } Ray;
 
+// Scene structure. Set up once, then only read while rendering, so any
+// number of threads can trace the same scene, or different ones.
+typedef struct {
+  Lighting *light; 		// the lights
+  RayModule *module; 	// the objects, built
+  int lightSamples; 	// lights picked per shading point when there are more, 0 = all
+  double minWeight; 	// a path stops once its share of the pixel is below this, 0 = never
+  int roulette; 		// 1 = a path below minWeight goes on at random, weighted up
+  BVH *lightTree; 		// hierarchy over the lights, for picking them
+  double *lightPower; 	// summed brightness of the lights under each tree node
+} RayScene;
+
+// The voxels of a RAY_FOOT_RES cubed grid that some set of rays
+// crossed, one bit each, numbered x + RES * (y + RES * z)
+typedef struct {
+  unsigned long long bit[RAY_FOOT_WORDS];
+} RayFootprint;
+
+// Kinds of ray the counters tell apart
+typedef enum {
+  RayPrimary, 			// from the camera
+  RayReflected,
+  RayRefracted,
+  RayShadow, 			// toward a light
+  RayKinds,
+} RayKind;
+
+// Stages of a render the counters time
+typedef enum {
+  RayStageCamera, 		// making the primary rays
+  RayStagePrimary, 		// finding what they hit
+  RayStageShade, 		// lighting the hits, with their shadow and secondary rays
+  RayStages,
+} RayStage;
+
+// Counters of the work done while tracing. Each thread counts into its
+// own, so nothing is shared until they are added up.
+typedef struct {
+  long rays[RayKinds]; 	// rays cast of each kind
+  long hits; 			// rays that found a surface, or for shadow rays a blocker
+  long tests[RayObjInstance + 1]; 	// intersection tests by element type, a mesh counting triangles
+  long paths; 			// primary rays that hit something
+  long depthSum; 		// surfaces shaded along those paths, summed
+  int maxDepth; 		// most surfaces shaded along one path
+  double ms[RayStages]; 	// thread milliseconds spent in each stage
+  double wallMs; 		// elapsed milliseconds for the whole render
+} RayStats;
+
+// Per-thread tracing state
+typedef struct {
+  RayElement *occluder[RAY_OCCLUDERS]; 	// last object found blocking light i % RAY_OCCLUDERS
+  BBox *footSpace; 		// space to record ray paths in, NULL to record none
+  RayFootprint foot; 	// voxels crossed by the rays traced since it was cleared
+} RayThread;
+
 typedef struct {
   Point p; 			// intersection point
   Vector nor; 		// normal vector at intersect point
+  double t; 		// distance along the ray
   RayElement *e;
 } Intersection;
 
@@ -34,20 +103,46 @@ typedef struct {
 void Ray_set(Ray *r, Point p, Vector v);
 void Ray_print(Ray *r, FILE *fp);
 void Ray_copy(Ray *dest, Ray *src);
+void RayThread_init(RayThread *th);
+void RayScene_init(RayScene *scene, Lighting *light, RayModule *rmd);
+void RayScene_sampleLights(RayScene *scene, int n);
+void RayScene_clear(RayScene *scene);
 void Ray_reflect(Ray *ray1, Intersection *inter, Ray *ray2);
-void Ray_refract(Ray *ray1, Intersection *inter, Ray *ray2);
+int Ray_refract(Ray *ray1, Intersection *inter, Ray *ray2);
 
-Intersection* Ray_sphereIntersect(Ray *ray, Sphere *sphere);
-Intersection* Ray_planeIntersect(Ray *ray, Plane *plane, int singleSide);
-Intersection* Ray_intersect(Ray *ray, RayElement *e);
+double Ray_sphereIntersect(Ray *ray, Sphere *sphere, Intersection *inter);
+double Ray_meshIntersect(Ray *ray, Mesh *mesh, Intersection *inter);
+double Ray_instanceIntersect(Ray *ray, RayInstance *inst, Intersection *inter);
+double Ray_planeIntersect(Ray *ray, Plane *plane, int singleSide,
+												Intersection *inter);
+long Ray_tests(void);
+RayStats *Ray_stats(void);
+void RayStats_clear(RayStats *s);
+void RayStats_add(RayStats *dest, RayStats *src);
+void RayStats_print(RayStats *s, FILE *fp);
+double Ray_intersect(Ray *ray, RayElement *e, Intersection *inter);
 void Intersection_set(Intersection *inter, Point p, Vector v);
 void Intersection_copy(Intersection *to, Intersection *from);
-Intersection* trace(Ray *ray, int depth, Point eye);
+double Ray_closestHit(Ray *ray, RayModule *rmd, Intersection *hit);
+RayElement *Ray_anyHit(Ray *ray, RayModule *rmd, double maxDist);
+int Ray_occluded(Ray *ray, RayModule *rmd, double maxDist, RayElement **cache);
+
+void RayFootprint_clear(RayFootprint *fp);
+void RayFootprint_ray(RayFootprint *fp, BBox *space, Ray *ray, double t);
+int RayFootprint_box(RayFootprint *fp, BBox *space, BBox *box);
+int RayFootprint_overlap(RayFootprint *a, RayFootprint *b);
 
 Color addColors(Color pointC, Color reflectV, Color coeffReflect,
 									Color refractV,	Color coeffRefract);
-Color Ray_send(Intersection *inter, Point vrp);
-Color Ray_trace(Ray *ray, int depth, Point eye, Point vrp);
+double Ray_shadow(Intersection *inter, Point light_p, Ray *ray);
+Color Ray_diffuse(RayScene *scene, Intersection *inter, Point vrp, int i);
+Color Ray_light(RayScene *scene, RayThread *th, Intersection *inter, Point vrp, int i);
+Color Ray_send(RayScene *scene, RayThread *th, Intersection *inter, Point vrp);
+double Ray_pathWeight(RayScene *scene, Ray *ray, int level, Color *coeff, double weight);
+Color Ray_trace(RayScene *scene, RayThread *th, Ray *ray, int depth,
+													Point eye, Point vrp);
+Color Ray_shade(RayScene *scene, RayThread *th, Ray *ray, Intersection *hit,
+										int depth, Point eye, Point vrp);
 
 
 #endif
\ No newline at end of file
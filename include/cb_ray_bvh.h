@@ -0,0 +1,68 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_bvh.h
+ * Bounding volume hierarchy for the ray tracer
+ */
+
+
+#ifndef CB_RAY_BVH_H
+#define CB_RAY_BVH_H
+
+
+#define BVH_MAX_DEPTH 64 		// traversal stack size
+#define BVH_LEAF_SIZE 4 		// largest leaf the builder makes unless forced
+
+// Far slab distances are stretched by this, so rounding in the slab
+// test never drops a box that a ray only just touches
+#ifdef CB_FLOAT
+#define BBOX_ROUND 1.000001f
+#else
+#define BBOX_ROUND 1.000000000000002
+#endif
+
+
+// Axis aligned bounding box
+typedef struct {
+  Real min[3];
+  Real max[3];
+} BBox;
+
+// Flattened hierarchy node. The first child of an interior node is the
+// next node in the array, the second child is at index right.
+typedef struct {
+  BBox box;
+  int start; 			// leaf: first entry in the index list
+  int count; 			// leaf: number of primitives, 0 for interior nodes
+  int right; 			// interior: index of the second child
+  int axis; 			// interior: split axis
+} BVHNode;
+
+// Bounding volume hierarchy
+typedef struct {
+  BVHNode *node; 		// node array, the root is node 0
+  int nNodes;
+  int *index; 			// primitive numbers in leaf order
+  int nPrims;
+} BVH;
+
+
+// ###########
+// ### Box ###
+// ###########
+
+void BBox_empty(BBox *b);
+void BBox_union(BBox *dest, BBox *a, BBox *b);
+double BBox_area(BBox *b);
+int BBox_hit(BBox *b, Real org[3], Real inv[3], double tmax);
+int BBox_clip(BBox *b, Real org[3], Real inv[3], double *t0, double *t1);
+
+
+// ###########
+// ### BVH ###
+// ###########
+
+BVH *BVH_create(BBox *boxes, int n);
+void BVH_delete(BVH *bvh);
+
+
+#endif
@@ -0,0 +1,43 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_camera.h
+ * Primary ray generation from a 3D view
+ */
+
+
+#ifndef CB_RAY_CAMERA_H
+#define CB_RAY_CAMERA_H
+
+
+// Camera structure. The direction through a pixel center is the sum of
+// a column term and a row term, both worked out once, so a ray costs
+// three additions and a normalize. Pixels are numbered x from the left
+// and y from the bottom of the image.
+typedef struct {
+  View3D view; 			// the view it was made from
+  Point eye; 			// center of projection
+  Point vrp; 			// view reference point
+  Vector vpn; 			// view plane normal
+  Vector u; 			// view right vector
+  Vector v; 			// view up vector
+  int rows, cols;
+  double *colDir; 		// d * vpn + a * u through each column's centers, 3 per column
+  double *rowDir; 		// b * v through each row's centers, 3 per row
+  int x0, y0; 			// crop window, lower left pixel
+  int x1, y1; 			// and one past its upper right pixel
+} RayCamera;
+
+
+// ##############
+// ### Camera ###
+// ##############
+
+void RayCamera_init(RayCamera *cam, View3D *view);
+void RayCamera_clear(RayCamera *cam);
+void RayCamera_crop(RayCamera *cam, int r0, int c0, int r1, int c1);
+void RayCamera_ray(RayCamera *cam, double fx, double fy, Ray *ray);
+void RayCamera_pixelRay(RayCamera *cam, int x, int y, Ray *ray);
+int RayCamera_tile(RayCamera *cam, int x0, int y0, int x1, int y1, Ray *rays);
+
+
+#endif
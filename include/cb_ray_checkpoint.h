@@ -0,0 +1,60 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_checkpoint.h
+ * Saves the finished tiles of a render so it can be resumed
+ */
+
+
+#ifndef CB_RAY_CHECKPOINT_H
+#define CB_RAY_CHECKPOINT_H
+
+
+// Everything a checkpoint has to agree on with a render to be resumed
+// by it. Zeroed before it is filled, so two can be compared bytewise.
+typedef struct {
+  char magic[8];
+  int rows, cols;
+  int x0, y0, x1, y1; 	// the camera's crop window
+  int tileSize;
+  int nTiles;
+  int depth, aa, aaMax;
+  int wavefront, sortSecondary; 	// these change the rounding of the colors
+  double aaThreshold;
+  int precision; 		// sizeof(Real)
+  int lightSamples, roulette;
+  double minWeight;
+  int nLights, nPrims;
+  double box[6]; 		// the scene's bounding box
+  unsigned long long sceneHash; 	// of every light and element, through instances
+  double view[14]; 		// vrp, vpn, vup, d, du, dv, f and b
+} RayCheckpointHeader;
+
+// A render's checkpoint file: the header, one flag per tile and the
+// image's pixels. Tiles are marked as they finish, their pixels copied
+// aside, and the file is rewritten from that copy at most every
+// everyMs milliseconds, to a temporary file that then replaces it, so
+// a render killed at any time leaves a whole checkpoint behind.
+typedef struct {
+  char *path; 			// the checkpoint file
+  double everyMs; 		// least time between saves
+  RayCheckpointHeader head;
+  char *done; 			// 1 for each tile finished, by index in scanline order
+  FPixel *data; 		// the finished tiles' pixels, laid out as the image's
+  int nDone;
+  double lastSave; 		// when the file was last written, in ms
+} RayCheckpoint;
+
+
+// ##################
+// ### Checkpoint ###
+// ##################
+
+void RayCheckpoint_init(RayCheckpoint *ck, RayRender *rr, RayScene *scene,
+										RayCamera *cam, int nTiles);
+void RayCheckpoint_clear(RayCheckpoint *ck);
+int RayCheckpoint_load(RayCheckpoint *ck, Image *src);
+int RayCheckpoint_save(RayCheckpoint *ck);
+void RayCheckpoint_tile(RayCheckpoint *ck, int tile, Image *src);
+
+
+#endif
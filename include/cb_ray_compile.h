@@ -0,0 +1,47 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_compile.h
+ * Turns Module scene graphs into ray modules
+ */
+
+
+#ifndef CB_RAY_COMPILE_H
+#define CB_RAY_COMPILE_H
+
+
+// The colors a Module sets for the polygons after them
+typedef struct {
+  Color body; 			// diffuse color
+  Color surface; 		// specular color, which the ray tracer reflects
+  float coeff; 			// surface coefficient; above 0 the surface is a mirror
+} RayMaterial;
+
+// One Module compiled with the material in effect where it was placed
+typedef struct {
+  Module *source; 		// NULL for the helper modules the compiler makes
+  RayMaterial material;
+  RayModule *module;
+} RayCompiled;
+
+// Everything compiled from one Module hierarchy. A sub-module placed
+// more than once with the same colors is compiled once and shared
+// through instances. The ray modules are owned here.
+typedef struct {
+  RayAccel accel; 		// structure every module is built with
+  RayModule *root; 		// the scene, from the last RayCompile_module
+  RayCompiled *entry;
+  int nEntries;
+  int maxEntries;
+} RayCompile;
+
+
+// ###############
+// ### Compile ###
+// ###############
+
+void RayCompile_init(RayCompile *rc);
+void RayCompile_clear(RayCompile *rc);
+RayModule *RayCompile_module(RayCompile *rc, Module *md, Matrix *GTM, DrawState *ds);
+
+
+#endif
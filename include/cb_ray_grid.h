@@ -0,0 +1,38 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_grid.h
+ * Uniform and two-level grids for the ray tracer
+ */
+
+
+#ifndef CB_RAY_GRID_H
+#define CB_RAY_GRID_H
+
+
+#define GRID_DENSITY 4 		// cells per primitive the builder aims for
+#define GRID_MAX_RES 128 		// most cells along one axis
+#define GRID_CROWDED 16 		// a two-level grid splits cells holding more than this
+
+
+// Uniform grid. The primitives overlapping cell c are
+// item[start[c]] to item[start[c+1]-1]; cells are numbered
+// x + res[0] * (y + res[1] * z).
+typedef struct RayGrid {
+  BBox box;
+  int res[3]; 			// cells along each axis
+  double size[3]; 		// cell size along each axis
+  int *start; 			// first item of each cell, plus one past the last
+  int *item; 			// primitive numbers
+  struct RayGrid **sub; 	// finer grid for each crowded cell, NULL for a single level
+} RayGrid;
+
+
+// ############
+// ### Grid ###
+// ############
+
+RayGrid *RayGrid_create(BBox *boxes, int n, int levels);
+void RayGrid_delete(RayGrid *g);
+
+
+#endif
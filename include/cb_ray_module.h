@@ -13,12 +13,33 @@
 typedef enum {
   RayObjSphere,
   RayObjPlane,
+  RayObjMesh,
+  RayObjInstance,
 } RayObjType;
 
+// Structure built over a module's bounded elements
+typedef enum {
+  RayAccelBVH, 			// bounding volume hierarchy, the default
+  RayAccelGrid, 		// uniform grid, quick to rebuild
+  RayAccelTwoLevelGrid, 	// uniform grid with finer grids in crowded cells
+} RayAccel;
+
+typedef struct RayModule RayModule;
+
+// Instance structure. Places a shared module in the scene through a
+// transform; the module is not copied and may be placed many times.
+typedef struct {
+  RayModule *module; 	// the objects, in object space, not owned
+  Matrix m; 			// object space to world space
+  Matrix inv; 			// world space to object space
+} RayInstance;
+
 // Ray element union
 typedef union {
   Sphere sphere;
   Plane plane;
+  Mesh mesh;
+  RayInstance instance;
 } RayObject;
 
 // Ray element structure
@@ -29,10 +50,20 @@ typedef struct {
 } RayElement;
 
 // Ray module structure
-typedef struct {
+struct RayModule {
   RayElement *head;
   RayElement *tail;
-} RayModule;
+  RayAccel accel; 		// structure RayModule_build makes
+  int built; 			// 1 once built, 0 after any change
+  BVH *bvh; 			// hierarchy over the bounded elements, or NULL
+  RayGrid *grid; 		// grid over the bounded elements, or NULL
+  RayElement **prim; 	// bounded elements, in BVH index order for a hierarchy
+  int nPrims;
+  BBox box; 			// bounds of the bounded elements
+  RayElement **plane; 	// unbounded elements, kept out of the hierarchy
+  int nPlanes;
+  SphereSoA soa; 		// the bounded elements' spheres, for packets
+};
 
 
 // ###############
@@ -48,6 +79,7 @@ Color RayElement_getRefractionColor(RayElement *e);
 double RayElement_getIndexOfRefraction(RayElement *e);
 int RayElement_isRefractive(RayElement *e);
 int RayElement_isReflective(RayElement *e);
+int RayElement_bounds(RayElement *e, BBox *box);
 
 
 // ##############
@@ -60,6 +92,11 @@ void RayModule_delete(RayModule *rmd);
 void RayModule_insert(RayModule *rmd, RayElement *e);
 void RayModule_plane(RayModule *rmd, Plane *p);
 void RayModule_sphere(RayModule *rmd, Sphere *s);
+void RayModule_mesh(RayModule *rmd, Mesh *m);
+int RayModule_instance(RayModule *rmd, RayModule *sub, Matrix *m);
+void RayModule_setAccel(RayModule *rmd, RayAccel accel);
+void RayModule_build(RayModule *rmd);
+void RayModule_unbuild(RayModule *rmd);
 
 
 
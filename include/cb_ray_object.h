@@ -12,7 +12,7 @@
 
 // Plane structure
 typedef struct {
-	double p[4];
+	Real p[4];
 	Color diffuse;
 	Color specular;
 	Color refraction;
@@ -24,7 +24,7 @@ typedef struct {
 // Sphere structure
 typedef struct {
 	Point c; 				// center
-	double r; 				// radius
+	Real r; 				// radius
 	Color diffuse;
 	Color specular;
 	Color refraction;
@@ -33,6 +33,41 @@ typedef struct {
 	double rIndex; 			// index of refraction
 } Sphere;
 
+// One triangle of a mesh, stored the way the intersection test wants it
+typedef struct {
+	Real v0[3]; 			// first vertex
+	Real e1[3]; 			// second vertex minus the first
+	Real e2[3]; 			// third vertex minus the first
+} MeshTri;
+
+// Triangle mesh structure. The triangles share one vertex array and
+// refer to it by index.
+typedef struct {
+	int nVertex;
+	Point *vertex;
+	Vector *normal; 		// vertex normals, NULL for flat shading
+	int nTriangle;
+	int *index; 			// three vertex indices per triangle
+	MeshTri *tri; 			// precomputed triangles, NULL until built
+	BVH *bvh; 				// hierarchy over the triangles, NULL until built
+	Color diffuse;
+	Color specular;
+	Color refraction;
+	int isReflective; 		// 1 = true, 0 = false
+	int isRefractive; 		// 1 = true, 0 = false
+	double rIndex; 			// index of refraction
+} Mesh;
+
+// Sphere centers and radii in structure of arrays form, for the packet
+// tracer. Slot i matches element i of a built ray module.
+typedef struct {
+	float *cx;
+	float *cy;
+	float *cz;
+	float *r2; 				// radius squared, negative if slot i is not a sphere
+	int n;
+} SphereSoA;
+
 
 // #############
 // ### Plane ###
@@ -52,6 +87,21 @@ void Sphere_setColor(Sphere *s, Color diffuse, Color specular,
 													int isReflective);
 void Sphere_setRIndex(Sphere *s, float rIndex);
 
+
+// ############
+// ### Mesh ###
+// ############
+
+void Mesh_set(Mesh *m, int nVertex, Point *vlist, Vector *nlist,
+										int nTriangle, int *ilist);
+int Mesh_readPLY(Mesh *m, char *filename);
+void Mesh_setColor(Mesh *m, Color diffuse, Color specular,
+								Color refraction, int isRefractive,
+													int isReflective);
+void Mesh_setRIndex(Mesh *m, float rIndex);
+void Mesh_build(Mesh *m);
+void Mesh_clear(Mesh *m);
+
 #endif
 
 
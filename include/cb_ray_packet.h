@@ -0,0 +1,48 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_packet.h
+ * Packets of coherent rays traced together with SSE/AVX
+ */
+
+
+#ifndef CB_RAY_PACKET_H
+#define CB_RAY_PACKET_H
+
+
+// eight lanes when compiled with -mavx, four with SSE or plain C
+#if defined(__AVX__)
+#define RAY_PACKET_SIZE 8
+#else
+#define RAY_PACKET_SIZE 4
+#endif
+
+
+// Ray packet structure. The single precision lanes drive the search,
+// the double precision rays are used for the final hit records.
+typedef struct {
+  float ox[RAY_PACKET_SIZE] __attribute__((aligned(32))); 	// origins
+  float oy[RAY_PACKET_SIZE] __attribute__((aligned(32)));
+  float oz[RAY_PACKET_SIZE] __attribute__((aligned(32)));
+  float dx[RAY_PACKET_SIZE] __attribute__((aligned(32))); 	// directions
+  float dy[RAY_PACKET_SIZE] __attribute__((aligned(32)));
+  float dz[RAY_PACKET_SIZE] __attribute__((aligned(32)));
+  float ix[RAY_PACKET_SIZE] __attribute__((aligned(32))); 	// 1 / direction
+  float iy[RAY_PACKET_SIZE] __attribute__((aligned(32)));
+  float iz[RAY_PACKET_SIZE] __attribute__((aligned(32)));
+  float tmax[RAY_PACKET_SIZE] __attribute__((aligned(32))); 	// nearest hit so far
+  RayElement *best[RAY_PACKET_SIZE]; 		// element hit at tmax
+  Ray ray[RAY_PACKET_SIZE];
+  int n; 			// number of lanes in use
+} RayPacket;
+
+
+// ##############
+// ### Packet ###
+// ##############
+
+void RayPacket_set(RayPacket *pk, Ray *rays, int n);
+void RayPacket_closestHit(RayPacket *pk, RayModule *rmd,
+										Intersection *hit, double *t);
+
+
+#endif
@@ -0,0 +1,37 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_raster.h
+ * Primary visibility by scan conversion, for the hybrid renderer
+ */
+
+
+#ifndef CB_RAY_RASTER_H
+#define CB_RAY_RASTER_H
+
+
+// A G-buffer: the top level element seen through each pixel center of
+// a camera, found by scan converting the scene into a depth buffer
+// instead of tracing the primary rays. The hit point and normal are
+// recovered exactly by intersecting the pixel's ray with that one
+// element.
+typedef struct {
+  int rows, cols;
+  RayModule *module; 	// the scene drawn, for the pixels that need a full search
+  RayElement **id; 		// element seen through each pixel, NULL for none, by y * cols + x
+  double *depth; 		// its distance along the view plane normal
+  long triangles; 		// triangles scan converted by the last draw
+  long tested; 			// pixels the last draw found by testing an element's ray
+} RayGBuffer;
+
+
+// ################
+// ### G-buffer ###
+// ################
+
+void RayGBuffer_init(RayGBuffer *gb);
+void RayGBuffer_clear(RayGBuffer *gb);
+void RayGBuffer_draw(RayGBuffer *gb, RayModule *rmd, RayCamera *cam);
+double RayGBuffer_hit(RayGBuffer *gb, int x, int y, Ray *ray, Intersection *hit);
+
+
+#endif
@@ -0,0 +1,79 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_render.h
+ * Prototypes for the tiled ray tracing driver
+ */
+
+
+#ifndef CB_RAY_RENDER_H
+#define CB_RAY_RENDER_H
+
+
+#define RAY_TILE_SIZE 32
+
+// Times a tile is handed to a fresh worker process after the one
+// tracing it dies, before it is given up on
+#define RAY_TILE_RETRIES 2
+
+// Default least time between checkpoint saves, in milliseconds
+#define RAY_CHECKPOINT_MS 30000.0
+
+
+// Order the pixels of a tile are traced in. The curves keep
+// neighbouring rays close in time as well as on screen.
+typedef enum {
+  RayOrderScanline,
+  RayOrderMorton, 		// Z-order curve
+  RayOrderHilbert,
+} RayOrder;
+
+// Render settings structure
+typedef struct {
+  int depth; 			// maximum ray depth
+  int tileSize; 		// width and height of a tile in pixels
+  int nThreads; 		// number of worker threads, 0 = one per core
+  int processes; 		// worker processes to fork instead, 0 = use threads
+  int lostTiles; 		// tiles the last render gave up on after their workers died
+  int packet; 			// 1 = trace primary rays in SIMD packets
+  int raster; 			// 1 = find what primary rays hit by scan conversion, when aa is 1
+  int wavefront; 		// 1 = trace each tile a wave of rays at a time, when aa is 1
+  int coarse; 			// pixel spacing of the first progressive pass
+  double budgetMs; 		// wall clock a progressive render may take, 0 = no limit
+  volatile int *cancel; 	// a progressive render stops once this is set, NULL = never
+  int step; 			// spacing of the last pass the last progressive render finished
+  char *checkpoint; 	// file to save finished tiles to and resume from, NULL = none
+  double checkpointMs; 	// least time between checkpoint saves
+  int resumedTiles; 	// tiles the last render took from its checkpoint
+  RayOrder order; 		// pixel order within a tile
+  int sortSecondary; 	// 1 = shade a tile's hits grouped by reflected direction
+  int aa; 				// samples per pixel side to start with, 1 = pixel centers only
+  int aaMax; 			// samples per pixel side where the first ones disagree
+  double aaThreshold; 	// channel difference between samples that asks for more
+  long samples; 		// primary rays traced by the last render
+  RayStats stats; 		// what the last render did, added up over its threads
+  int track; 			// 1 = record where each tile's rays go, for RayRender_update
+  RayFootprint *footprint; 	// each tile's footprint in the last tracked render
+  char *dirty; 			// 1 for each tile an edit may have changed
+  int nTiles; 			// tiles in the last tracked render, 0 if none
+  int footTileSize; 	// tile size of the last tracked render
+  BBox footSpace; 		// space the footprints divide into voxels
+  View3D footView; 		// view of the last tracked render
+} RayRender;
+
+
+// ##############
+// ### Render ###
+// ##############
+
+void RayRender_init(RayRender *rr);
+void RayRender_clear(RayRender *rr);
+int RayRender_threads(RayRender *rr);
+void RayRender_image(RayRender *rr, RayScene *scene, View3D *view, Image *src);
+void RayRender_camera(RayRender *rr, RayScene *scene, RayCamera *cam, Image *src);
+int RayRender_progressive(RayRender *rr, RayScene *scene, View3D *view, Image *src);
+void RayRender_touch(RayRender *rr, BBox *box);
+void RayRender_touchElement(RayRender *rr, RayElement *e);
+int RayRender_update(RayRender *rr, RayScene *scene, View3D *view, Image *src);
+
+
+#endif
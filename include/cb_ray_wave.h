@@ -0,0 +1,66 @@
+/* Dan Nelson
+ * Graphics Package
+ * cb_ray_wave.h
+ * Wavefront tracing: a batch of paths taken one stage at a time
+ */
+
+
+#ifndef CB_RAY_WAVE_H
+#define CB_RAY_WAVE_H
+
+
+// One ray of a wave and the path it extends
+typedef struct {
+  Ray ray;
+  Color through; 		// what the light it finds is scaled by on the way to the pixel
+  double weight; 		// the path's share of the pixel, for RayScene.minWeight
+  int pixel; 			// the pixel the path adds to
+  int level; 			// surfaces shaded along the path before this ray
+} RayWaveRay;
+
+// A shadow ray toward a point light, waiting to be traced
+typedef struct {
+  Ray ray;
+  double dist; 			// distance to the light
+  int from; 			// the ray of the wave whose hit it lights
+  int light; 			// the light number
+} RayWaveShadow;
+
+// Queues for tracing a batch of paths breadth first. Each stage runs
+// over the whole wave before the next one starts: find the hits, light
+// them, queueing the shadow rays to point lights, trace the shadow
+// rays, then spawn the reflected and refracted rays as the next wave.
+// Nothing recurses, so a deep path costs queue space rather than stack.
+typedef struct {
+  RayWaveRay *ray; 		// the current wave
+  Intersection *hit; 	// where each of its rays hit
+  double *t; 			// distance to each hit, negative on a miss
+  int nRays;
+  int maxRays;
+  RayWaveRay *next; 	// rays spawned off the current wave
+  int nNext;
+  int maxNext;
+  RayWaveShadow *shadow; 	// shadow rays from the current wave
+  int nShadows;
+  int maxShadows;
+  Color *color; 		// light gathered so far, by pixel
+  int *level; 			// deepest surface shaded along each pixel's paths
+  int maxPixels;
+  int sort; 			// 1 = order each new wave by direction octant
+} RayWave;
+
+
+// ############
+// ### Wave ###
+// ############
+
+void RayWave_init(RayWave *wv);
+void RayWave_clear(RayWave *wv);
+void RayWave_start(RayWave *wv, Ray *ray, int *pixel, int n);
+void RayWave_intersect(RayWave *wv, RayScene *scene, RayThread *th);
+void RayWave_shade(RayWave *wv, RayScene *scene, RayThread *th, Point vrp);
+void RayWave_shadow(RayWave *wv, RayScene *scene, RayThread *th, Point vrp);
+int RayWave_spawn(RayWave *wv, RayScene *scene, int depth);
+
+
+#endif
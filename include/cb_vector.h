@@ -14,7 +14,7 @@
 
 // Vector
 typedef struct {
-  double v[4];
+  Real v[4];
 } Vector;
 
 
@@ -23,6 +23,11 @@ void Light_init( Light *light ) {
   
   light->cutoff = 0.0;
   light->sharpness = 32.0;
+  
+  Vector_set(&(light->edge[0]), 0.0, 0.0, 0.0);
+  Vector_set(&(light->edge[1]), 0.0, 0.0, 0.0);
+  light->radius = 0.0;
+  light->samples = LIGHT_AREA_SAMPLES;
 }
 
 
@@ -46,38 +51,68 @@ void Light_copy( Light *to, Light *from ) {
   
   to->cutoff = from->cutoff;
   to->sharpness = from->sharpness;
+  
+  to->edge[0] = from->edge[0];
+  to->edge[1] = from->edge[1];
+  to->radius = from->radius;
+  to->samples = from->samples;
 }
 
 
 // allocate and return a new lighting structure set to default values
 Lighting *Lighting_create(void) {
-  int i;
   Lighting *lighting = malloc(sizeof(Lighting));
-  lighting->nLights = 0;
-  
-  for (i=0;i < MAX_LIGHTS; i++) {
-    Light_init(&(lighting->light[i]));
-  }
+  Lighting_init(lighting);
   return lighting;
 }
 
 
-// initialize the lighting structure to default values
+// initialize the lighting structure to default values, with no lights
+// and no room for any yet
 void Lighting_init( Lighting *l ) {
   l->nLights = 0;
+  l->maxLights = 0;
+  l->light = NULL;
+}
+
+
+// free the lights of a lighting structure, leaving it empty; for a
+// structure the caller owns, after Lighting_init
+void Lighting_clear( Lighting *l ) {
+  free(l->light);
+  Lighting_init(l);
+}
+
+
+// free a lighting structure made by Lighting_create
+void Lighting_delete( Lighting *l ) {
+  if (l != NULL) {
+    Lighting_clear(l);
+    free(l);
+  }
 }
 
 
 /* add a new light to the Lighting structure given the parameters, some 
- * of which may be NULL, depending upon the type. Make sure you don’t
- * add more lights than MAX LIGHTS
+ * of which may be NULL, depending upon the type. The list of lights
+ * doubles in size whenever it fills up.
  */
 void Lighting_add( Lighting *l, LightType type, Color *c, Vector *dir,
 					Point *pos, float cutoff, float sharpness ) {
   
   //Color_set(&l->light[nLights]->color, c->c[0], c->c[1], c->c[2]);
 
-  if (l->nLights < MAX_LIGHTS - 1) {
+  if (l->nLights == l->maxLights) {
+    int size = l->maxLights > 0 ? 2 * l->maxLights : 8;
+    Light *grown = realloc(l->light, sizeof(Light) * size);
+    
+    if (grown != NULL) {
+      l->light = grown;
+      l->maxLights = size;
+    }
+  }
+
+  if (l->nLights < l->maxLights) {
 	Light_init(&l->light[l->nLights]);
 	
 	l->light[l->nLights].type = type;
@@ -106,7 +141,39 @@ void Lighting_add( Lighting *l, LightType type, Color *c, Vector *dir,
 	l->nLights++;
   }
   else {
-    printf("MAX_LIGHTS reached. Can't add more lights");
+    printf("Out of memory. Can't add more lights");
+  }
+}
+
+
+/* add a rectangular area light centered on center with sides side1 and
+ * side2. Where the light is partly hidden its shadow is sampled on a
+ * samples by samples grid over the rectangle.
+ */
+void Lighting_addArea( Lighting *l, Color *c, Point *center, Vector *side1,
+						Vector *side2, int samples ) {
+  int n = l->nLights;
+  
+  Lighting_add(l, LightArea, c, NULL, center, 0, 0);
+  if (l->nLights > n) {
+	l->light[n].edge[0] = *side1;
+	l->light[n].edge[1] = *side2;
+	l->light[n].samples = samples > 0 ? samples : 1;
+  }
+}
+
+
+/* add a spherical light, sampled like an area light over the disc it
+ * shows to the point being lit
+ */
+void Lighting_addSphere( Lighting *l, Color *c, Point *center, float radius,
+						int samples ) {
+  int n = l->nLights;
+  
+  Lighting_add(l, LightSphere, c, NULL, center, 0, 0);
+  if (l->nLights > n) {
+	l->light[n].radius = radius;
+	l->light[n].samples = samples > 0 ? samples : 1;
   }
 }
 
@@ -158,6 +225,9 @@ void Lighting_shading( Lighting *l, Vector *N, Vector *V,
       case LightDirect:
         break;
         
+      // area lights shine from their centers here
+      case LightArea:
+      case LightSphere:
       case LightPoint:   
 
         //lVector = currentL.position minus p
@@ -111,6 +111,63 @@ void Matrix_multiply(Matrix *left, Matrix *right, Matrix *m) {
 }
 
 
+/* Invert m and put the result in inv, which may be m. Gauss-Jordan
+ * elimination with partial pivoting. Returns 0 and leaves inv alone if
+ * m is singular, 1 otherwise.                                   */
+int Matrix_invert(Matrix *m, Matrix *inv) {
+  double a[4][8];
+  double t, f;
+  int r, c, k, pivot;
+
+  // [m | I]
+  for (r=0;r<4;r++) {
+    for (c=0;c<4;c++) {
+      a[r][c] = m->m[r*4+c];
+      a[r][c+4] = r == c ? 1.0 : 0.0;
+    }
+  }
+
+  for (c=0;c<4;c++) {
+    // bring up the row with the largest entry in this column
+    pivot = c;
+    for (r=c+1;r<4;r++) {
+      if (fabs(a[r][c]) > fabs(a[pivot][c])) {
+        pivot = r;
+      }
+    }
+    if (fabs(a[pivot][c]) < 1e-300) {
+      return 0;
+    }
+    for (k=0;k<8;k++) {
+      t = a[c][k];
+      a[c][k] = a[pivot][k];
+      a[pivot][k] = t;
+    }
+
+    // scale the pivot row to 1 and clear the column everywhere else
+    f = 1.0 / a[c][c];
+    for (k=0;k<8;k++) {
+      a[c][k] *= f;
+    }
+    for (r=0;r<4;r++) {
+      if (r != c && a[r][c] != 0.0) {
+        f = a[r][c];
+        for (k=0;k<8;k++) {
+          a[r][k] -= f * a[c][k];
+        }
+      }
+    }
+  }
+
+  for (r=0;r<4;r++) {
+    for (c=0;c<4;c++) {
+      inv->m[r*4+c] = a[r][c+4];
+    }
+  }
+  return 1;
+}
+
+
 /* Transform the point p by the matrix m and put the result in q. 
  * For this function, p and q need to be different variables. */
 void Matrix_xformPoint(Matrix *m, Point *p, Point *q) {
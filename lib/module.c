@@ -52,8 +52,10 @@ Element *Element_init(ObjectType type, void *obj) {
       break;
     case ObjSphere:
       memcpy(&(e->obj.sphere), obj, sizeof(Sphere));
+      break;
     case ObjPlane:
       memcpy(&(e->obj.plane), obj, sizeof(Plane));
+      break;
     case ObjIdentity:
       memcpy(&(e->obj.matrix), obj, sizeof(Matrix));
       break;
@@ -19,13 +19,15 @@
 
 ply_type plyType(char *buffer);
 ply_type plyType(char *buffer) {
-	if(!strcmp(buffer, "float32"))
+	if(!strcmp(buffer, "float32") || !strcmp(buffer, "float")
+									|| !strcmp(buffer, "double"))
 		return(type_float32);
   
-	if(!strcmp(buffer, "uint8"))
+	if(!strcmp(buffer, "uint8") || !strcmp(buffer, "uchar"))
 		return(type_uint8);
 
-	if(!strcmp(buffer, "int32"))
+	if(!strcmp(buffer, "int32") || !strcmp(buffer, "int")
+									|| !strcmp(buffer, "uint"))
 		return(type_int32);
 
 	if(!strcmp(buffer, "list"))
@@ -36,8 +38,148 @@ ply_type plyType(char *buffer) {
 
 #define MaxVertices (10)
 
-int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals) {
+/*
+ * Frees a list of properties
+ */
+static void freeProperties(ply_property *list) {
+	ply_property *q;
+
+	while(list != NULL) {
+		q = (ply_property *)list->next;
+		free(list);
+		list = q;
+	}
+}
+
+
+/*
+ * Reads the header of an ascii PLY file, leaving fp at the first vertex.
+ * Returns -1 if the file is not a PLY file or has a property type we
+ * don't know. On success the caller owns the list of vertex properties,
+ * in the order they appear on each vertex line.
+ */
+static int readHeader(FILE *fp, char filename[], int *numVertex, int *numPoly,
+										ply_property **vertexProps) {
 	char buffer[256];
+	int vertexProp = 0;
+	int faceProp = 0;
+	ply_property *vertexproplist = NULL;
+	ply_property *vertexproptail = NULL;
+	ply_property *faceproplist = NULL;
+	ply_property *faceproptail = NULL;
+	int doneWithHeader = 0;
+
+	*numVertex = 0;
+	*numPoly = 0;
+
+	// check if it's a .ply file
+	fscanf(fp, "%255s", buffer);
+	if(strcmp(buffer, "ply")) {
+		fprintf(stderr, "%s doesn't look like a .ply file\n", filename);
+		return(-1);
+	}
+
+	while(!doneWithHeader) {
+		if(fscanf(fp, "%255s", buffer) != 1) {
+			fprintf(stderr, "%s ends before end_header\n", filename);
+			freeProperties(vertexproplist);
+			freeProperties(faceproplist);
+			return(-1);
+		}
+		switch(buffer[0]) {
+		case 'f':
+			// format statement
+			for(;fgetc(fp) != '\n';);
+			break;
+
+		case 'c':
+			// comment
+			for(;fgetc(fp) != '\n';);
+			break;
+
+		case 'p':
+			// property statement
+		{
+			ply_property *prop = malloc(sizeof(ply_property));
+			prop->listCardType = type_none;
+			prop->listDataType = type_none;
+			prop->next = NULL;
+
+			fscanf(fp, "%s", buffer); // get the data type
+			prop->type = plyType(buffer);
+			if(prop->type == type_list) {
+				fscanf(fp, "%s", buffer); // get the first data type
+				prop->listCardType = plyType(buffer);
+				fscanf(fp, "%s", buffer); // get the first data type
+				prop->listDataType = plyType(buffer);
+			}
+			else if(prop->type == type_none) {
+				fprintf(stderr, "Unrecognized property type %s\n", buffer);
+				free(prop);
+				freeProperties(vertexproplist);
+				freeProperties(faceproplist);
+				return(-1);
+			}
+			fscanf(fp, "%s", prop->name);
+
+			// add the property entry to the list
+			if(vertexProp) {
+				if(vertexproplist == NULL) {
+					vertexproplist = prop;
+					vertexproptail = prop;
+				}
+				else {
+					vertexproptail->next = prop;
+					vertexproptail = prop;
+				}
+			}
+			else if(faceProp) {
+				if(faceproplist == NULL) {
+					faceproplist = prop;
+					faceproptail = prop;
+				}
+				else {
+					faceproptail->next = prop;
+					faceproptail = prop;
+				}
+			}
+		}
+		break;
+
+		case 'e':
+			if(!strcmp(buffer, "end_header")) {
+				doneWithHeader = 1;
+				break;
+			}
+
+			// otherwise it's an element statement
+			fscanf(fp, "%s", buffer);
+			if(!strcmp(buffer, "vertex")) {
+				vertexProp = 1;
+				faceProp = 0;
+				fscanf(fp, "%d", numVertex);
+			}
+			else if(!strcmp(buffer, "face")) {
+				faceProp = 1;
+				vertexProp = 0;
+				fscanf(fp, "%d", numPoly);
+			}
+			break;
+
+		default: // don't know what to do with it
+			for(;fgetc(fp) != '\n';);
+			break;
+		}
+	}
+
+	// only the vertex layout matters once the header is read
+	freeProperties(faceproplist);
+	*vertexProps = vertexproplist;
+	return(0);
+}
+
+
+int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals) {
 	Point *vertex;
 	Vector *normal;
 	//  Point *texture;
@@ -45,15 +187,11 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 	Polygon *p;
 	int numPoly;
 	int numVertex;
-	int vertexProp = 0;
-	int faceProp = 0;
 	ply_property *vertexproplist = NULL;
-	ply_property *vertexproptail = NULL;
-	ply_property *faceproplist = NULL;
-	ply_property *faceproptail = NULL;
 	int nv;
 	int vid[MaxVertices];
 	int i, j;
+	double x;
 	Color tcolor;
 
 	// first line ought to be "ply"
@@ -73,107 +211,13 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 
 	// end_header means the first element type starts
 
-	int doneWithHeader = 0;
 	FILE *fp = fopen(filename, "r");
 	if(fp) {
-		// check if it's a .ply file
-		fscanf(fp, "%s", buffer);
-		if(strcmp(buffer, "ply")) {
-			printf("%s doesn't look like a .ply file\n", filename);
+		if(readHeader(fp, filename, &numVertex, &numPoly, &vertexproplist) < 0) {
 			fclose(fp);
 			return(-1);
 		}
 
-		while(!doneWithHeader) {
-			fscanf(fp, "%s", buffer);
-			switch(buffer[0]) {
-			case 'f':
-				// format statement
-				for(;fgetc(fp) != '\n';);
-				break;
-	
-			case 'c':
-				// comment
-				for(;fgetc(fp) != '\n';);
-				break;
-
-			case 'p':
-				// property statement
-			{
-				ply_property *prop = malloc(sizeof(ply_property));
-				prop->listCardType = type_none;
-				prop->listDataType = type_none;
-				prop->next = NULL;
-
-				fscanf(fp, "%s", buffer); // get the data type
-				prop->type = plyType(buffer);
-				if(prop->type == type_list) {
-					fscanf(fp, "%s", buffer); // get the first data type
-					prop->listCardType = plyType(buffer);
-					fscanf(fp, "%s", buffer); // get the first data type
-					prop->listDataType = plyType(buffer);
-				}
-				else if(prop->type == type_none) {
-					printf("Unrecognized property type %s", buffer);
-					fclose(fp);
-					return(-1);
-				}
-				printf("Read property type %d\n", prop->type);
-
-				fscanf(fp, "%s", prop->name);
-				printf("Read property name %s\n", prop->name);
-
-				// add the property entry to the list
-				if(vertexProp) {
-					if(vertexproplist == NULL) {
-						vertexproplist = prop;
-						vertexproptail = prop;
-					}
-					else {
-						vertexproptail->next = prop;
-						vertexproptail = prop;
-					}
-				}
-				else if(faceProp) {
-					if(faceproplist == NULL) {
-						faceproplist = prop;
-						faceproptail = prop;
-					}
-					else {
-						faceproptail->next = prop;
-						faceproptail = prop;
-					}
-				}
-			}
-			break;
-
-			case 'e':
-				if(!strcmp(buffer, "end_header")) {
-					doneWithHeader = 1;
-					break;
-				}
-
-				// otherwise it's an element statement
-				fscanf(fp, "%s", buffer);
-				if(!strcmp(buffer, "vertex")) {
-					printf("Read element vertex\n");
-					vertexProp = 1;
-					faceProp = 0;
-					fscanf(fp, "%d", &numVertex);
-				}
-				else if(!strcmp(buffer, "face")) {
-					printf("Read element face\n");
-					faceProp = 1;
-					vertexProp = 0;
-					fscanf(fp, "%d", &numPoly);
-				}
-				break;
-
-			default: // don't know what to do with it
-				for(;fgetc(fp) != '\n';);
-				break;
-			}
-		}
 		// finished with the header
 		vertex = malloc(sizeof(Point) * numVertex);
 		normal = malloc(sizeof(Vector) * numVertex);
@@ -182,12 +226,17 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 
 		// read the vertices
 		for(i=0;i<numVertex;i++) {
-			for(j=0;j<3;j++)
-				fscanf(fp, "%lf", &(vertex[i].val[j]));
+			// through a double, Point may be single precision
+			for(j=0;j<3;j++) {
+				fscanf(fp, "%lf", &x);
+				vertex[i].val[j] = x;
+			}
 			vertex[i].val[3] = 1.0;
 
-			for(j=0;j<3;j++)
-				fscanf(fp, "%lf", &(normal[i].v[j]));
+			for(j=0;j<3;j++) {
+				fscanf(fp, "%lf", &x);
+				normal[i].v[j] = x;
+			}
 			normal[i].v[3] = 0.0;
 
 			for(j=0;j<2;j++)
@@ -273,21 +322,7 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 		//    free(texture);
 		free(color);
 
-		{
-			ply_property *q;
-
-			while(vertexproplist != NULL) {
-				q = (ply_property *)vertexproplist->next;
-				free(vertexproplist);
-				vertexproplist = q;
-			}
-
-			while(faceproplist != NULL) {
-				q = (ply_property *)faceproplist->next;
-				free(faceproplist);
-				faceproplist = q;
-			}
-		}
+		freeProperties(vertexproplist);
 
 		fclose(fp);
 	}
@@ -298,3 +333,131 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 
 	return(0);
 }
+
+
+/*
+ * Reads an ascii PLY file as a triangle mesh, keeping the vertices
+ * shared instead of copying them into each polygon. Faces with more
+ * than three vertices are split into fans. The vertex lines may have
+ * their properties in any order; x, y and z are required and nx, ny
+ * and nz are used if all three are present.
+
+  Returns...
+
+  a list of vertices
+  a list of vertex normals, or NULL if the file has none
+  a list of triangles, three vertex indices each
+
+ */
+int readPLYMesh(char filename[], int *nVertex, Point **vlist, Vector **nlist,
+										int *nTriangles, int **ilist) {
+	ply_property *vertexproplist = NULL;
+	ply_property *prop;
+	Point *vertex;
+	Vector *normal = NULL;
+	int *index;
+	int numVertex, numPoly, numTri, maxTri;
+	int col[6] = {-1, -1, -1, -1, -1, -1};
+	char *colName[6] = {"x", "y", "z", "nx", "ny", "nz"};
+	int nProps, nv, first, prev, vid, c;
+	double value;
+	int i, j, k;
+
+	FILE *fp = fopen(filename, "r");
+	if(!fp) {
+		fprintf(stderr, "Unable to open %s\n", filename);
+		return(-1);
+	}
+	if(readHeader(fp, filename, &numVertex, &numPoly, &vertexproplist) < 0) {
+		fclose(fp);
+		return(-1);
+	}
+
+	// find the columns we need on each vertex line
+	nProps = 0;
+	for(prop = vertexproplist; prop != NULL; prop = prop->next) {
+		for(j=0;j<6;j++) {
+			if(!strcmp(prop->name, colName[j]))
+				col[j] = nProps;
+		}
+		nProps++;
+	}
+	freeProperties(vertexproplist);
+	if(col[0] < 0 || col[1] < 0 || col[2] < 0) {
+		fprintf(stderr, "%s has no vertex positions\n", filename);
+		fclose(fp);
+		return(-1);
+	}
+
+	vertex = malloc(sizeof(Point) * (numVertex > 0 ? numVertex : 1));
+	if(col[3] >= 0 && col[4] >= 0 && col[5] >= 0)
+		normal = malloc(sizeof(Vector) * (numVertex > 0 ? numVertex : 1));
+
+	// read the vertices
+	for(i=0;i<numVertex;i++) {
+		vertex[i].val[3] = 1.0;
+		for(k=0;k<nProps;k++) {
+			if(fscanf(fp, "%lf", &value) != 1) {
+				fprintf(stderr, "%s ends in vertex %d\n", filename, i);
+				free(vertex);
+				free(normal);
+				fclose(fp);
+				return(-1);
+			}
+			for(j=0;j<3;j++) {
+				if(k == col[j])
+					vertex[i].val[j] = value;
+				if(normal != NULL && k == col[j+3])
+					normal[i].v[j] = value;
+			}
+		}
+		if(normal != NULL) {
+			normal[i].v[3] = 0.0;
+			Vector_normalize(&(normal[i]));
+		}
+	}
+
+	// read the faces, splitting each into a fan around its first vertex
+	maxTri = numPoly > 0 ? numPoly : 1;
+	index = malloc(sizeof(int) * 3 * maxTri);
+	numTri = 0;
+	for(i=0;i<numPoly;i++) {
+		nv = 0;
+		fscanf(fp, "%d", &nv);
+		first = prev = -1;
+		for(j=0;j<nv;j++) {
+			if(fscanf(fp, "%d", &vid) != 1 || vid < 0 || vid >= numVertex) {
+				fprintf(stderr, "%s has a bad vertex index in face %d\n", filename, i);
+				free(vertex);
+				free(normal);
+				free(index);
+				fclose(fp);
+				return(-1);
+			}
+			if(j == 0)
+				first = vid;
+			else if(j >= 2) {
+				if(numTri == maxTri) {
+					maxTri *= 2;
+					index = realloc(index, sizeof(int) * 3 * maxTri);
+				}
+				index[3*numTri] = first;
+				index[3*numTri+1] = prev;
+				index[3*numTri+2] = vid;
+				numTri++;
+			}
+			prev = vid;
+		}
+		// skip any other face properties
+		for(c = fgetc(fp); c != '\n' && c != EOF; c = fgetc(fp));
+	}
+	fclose(fp);
+
+	*nVertex = numVertex;
+	*vlist = vertex;
+	*nlist = normal;
+	*nTriangles = numTri;
+	*ilist = index;
+
+	return(0);
+}
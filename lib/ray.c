@@ -8,8 +8,12 @@
 #include "cb_graphics.h"
 
 
-Lighting *global_light;
-RayModule *global_rayModule;
+// work done by each thread, how deep the path it is shading goes, and
+// how much the surface being shaded adds to the pixel
+static __thread RayStats rayStats;
+static __thread int rayLevel = 0;
+static __thread int rayDeepest = 0;
+static __thread double rayWeight = 1.0;
 
 
 // #####################
@@ -65,37 +69,207 @@ void Ray_copy(Ray *dest, Ray *src) {
 }
 
 
- /*
+/*
+ * Sets up a scene for rendering. The module's hierarchy is built here
+ * if it has none, so that rendering never changes the scene. Neither
+ * the lights nor the module may be changed while the scene is in use.
+ * @scene: the scene
+ * @light: the lights
+ * @rmd: the objects
+ * @return: void
+ */
+void RayScene_init(RayScene *scene, Lighting *light, RayModule *rmd) {
+	scene->light = light;
+	scene->module = rmd;
+	scene->lightSamples = 0;
+	scene->minWeight = RAY_MIN_WEIGHT;
+	scene->roulette = 0;
+	scene->lightTree = NULL;
+	scene->lightPower = NULL;
+	if (!rmd->built) {
+		RayModule_build(rmd);
+	}
+}
+
+
+/*
+ * Returns the brightness of a light, for weighing lights against
+ * each other
+ * @l: the light
+ * @return: the luminance of its color
+ */
+static double lightLuminance(Light *l) {
+	return 0.2126 * l->color.c[0] + 0.7152 * l->color.c[1] + 0.0722 * l->color.c[2];
+}
+
+
+/*
+ * Has each shading point light itself with only n of the scene's
+ * lights, picked by walking a hierarchy over them, so the cost of a
+ * point no longer grows with the number of lights. The picks are
+ * weighted so the average over many points matches using every light.
+ * The lights may not change afterwards.
+ * @scene: the scene, from RayScene_init
+ * @n: lights per shading point, 0 to use every light
+ * @return: void
+ */
+void RayScene_sampleLights(RayScene *scene, int n) {
+	Lighting *lights = scene->light;
+	BBox *boxes;
+	Light *l;
+	int i, j, node;
+
+	RayScene_clear(scene);
+	scene->lightSamples = n;
+	if (n <= 0 || lights->nLights == 0) {
+		return;
+	}
+
+	// area lights are boxed whole, so the tree bounds every point on them
+	boxes = malloc(sizeof(BBox) * lights->nLights);
+	for (i=0; i<lights->nLights; i++) {
+		l = &(lights->light[i]);
+		for (j=0; j<3; j++) {
+			double extent = 0.0;
+
+			if (l->type == LightArea) {
+				extent = 0.5 * (fabs(l->edge[0].v[j]) + fabs(l->edge[1].v[j]));
+			}
+			else if (l->type == LightSphere) {
+				extent = l->radius;
+			}
+			boxes[i].min[j] = l->position.val[j] - extent;
+			boxes[i].max[j] = l->position.val[j] + extent;
+		}
+	}
+	scene->lightTree = BVH_create(boxes, lights->nLights);
+	free(boxes);
+
+	// children come after their parents, so sum from the back
+	scene->lightPower = malloc(sizeof(double) * scene->lightTree->nNodes);
+	for (node=scene->lightTree->nNodes-1; node>=0; node--) {
+		BVHNode *nd = &(scene->lightTree->node[node]);
+
+		scene->lightPower[node] = 0.0;
+		if (nd->count > 0) {
+			for (i=nd->start; i<nd->start + nd->count; i++) {
+				scene->lightPower[node] +=
+						lightLuminance(&(lights->light[scene->lightTree->index[i]]));
+			}
+		}
+		else {
+			scene->lightPower[node] = scene->lightPower[node+1]
+											+ scene->lightPower[nd->right];
+		}
+	}
+}
+
+
+/*
+ * Frees the light hierarchy of a scene, if it has one
+ * @scene: the scene
+ * @return: void
+ */
+void RayScene_clear(RayScene *scene) {
+	BVH_delete(scene->lightTree);
+	free(scene->lightPower);
+	scene->lightTree = NULL;
+	scene->lightPower = NULL;
+}
+
+
+/*
+ * Resets a thread's tracing state. Each thread that traces rays needs
+ * its own.
+ * @th: the tracing state
+ * @return: void
+ */
+void RayThread_init(RayThread *th) {
+	int i;
+	
+	for (i=0; i<RAY_OCCLUDERS; i++) {
+		th->occluder[i] = NULL;
+	}
+	th->footSpace = NULL;
+	RayFootprint_clear(&(th->foot));
+}
+
+
+/*
+ * Moves a hit point off its surface, to the side a new ray leaves by,
+ * so the ray does not find the same surface again. The step is
+ * RAY_OFFSET relative to the largest coordinate of the point plus the
+ * distance it was found at, which bounds the rounding error in the
+ * point whatever the scene scale or precision.
+ * @inter: the hit
+ * @dir: direction of the new ray
+ * @out: set to the new ray's origin
+ * @return: void
+ */
+static void offsetOrigin(Intersection *inter, Vector *dir, Point *out) {
+	double big = 0.0, step;
+	int i;
+
+	for (i=0; i<3; i++) {
+		big = fabs(inter->p.val[i]) > big ? fabs(inter->p.val[i]) : big;
+	}
+	step = RAY_OFFSET * (big + fabs(inter->t));
+	if (dir->v[0]*inter->nor.v[0] + dir->v[1]*inter->nor.v[1]
+										+ dir->v[2]*inter->nor.v[2] < 0) {
+		step = -step;
+	}
+	for (i=0; i<3; i++) {
+		out->val[i] = inter->p.val[i] + step * inter->nor.v[i];
+	}
+	out->val[3] = 1.0;
+}
+
+
+/*
  * Calculates the refracted ray from a given ray and intersection.
- * The new ray is stored in ray2.
+ * The new ray is stored in ray2. The normal of a refractive surface
+ * points out of the object, so a ray going along it is on its way
+ * out. A ray that meets the surface from inside too steeply to get
+ * out is reflected instead.
  * @ray1: an orignal ray
  * @intersection: the refraction intersections
  * @ray2: the refracted ray
- * @return: void
+ * @return: 1 if the ray was refracted, 0 if it was totally internally
+ * reflected
  */
-void Ray_refract(Ray *ray1, Intersection *inter, Ray *ray2) {
-	Point p, ray_p;
+int Ray_refract(Ray *ray1, Intersection *inter, Ray *ray2) {
+	Point ray_p;
 	Vector nor, v, refract;
 	double n, a, b;
 	
-	p = inter->p;				// intersection point
 	nor = inter->nor;			// intersection normal
 	v = ray1->v;				// ray vector
 	
-	// index of refraction
-	n = 1.0/RayElement_getIndexOfRefraction(inter->e);
+	// index of refraction, inverted on the way out
+	n = RayElement_getIndexOfRefraction(inter->e);
+	n = n > 0 ? 1.0/n : 1.0;
 	a = - (Vector_dot(&nor, &v));
-	b = sqrt( 1 - n*n * (1 - a*a) );
+	if (a < 0) {
+		Vector_set(&nor, -nor.v[0], -nor.v[1], -nor.v[2]);
+		a = -a;
+		n = 1.0/n;
+	}
+	b = 1 - n*n * (1 - a*a);
+	if (b < 0) {
+		Ray_reflect(ray1, inter, ray2);
+		return 0;
+	}
+	b = sqrt(b);
  
 	refract.v[0] = n * v.v[0] + (n * a - b) * nor.v[0];
 	refract.v[1] = n * v.v[1] + (n * a - b) * nor.v[1];
 	refract.v[2] = n * v.v[2] + (n * a - b) * nor.v[2];
 
-	ray_p.val[0] = p.val[0] + nor.v[0] * 10e-6;
-	ray_p.val[1] = p.val[1] + nor.v[1] * 10e-6;
-	ray_p.val[2] = p.val[2] + nor.v[2] * 10e-6;
+	refract.v[3] = 0.0;
+	offsetOrigin(inter, &refract, &ray_p);
 
 	Ray_set(ray2, ray_p, refract);
+	return 1;
 }
 
 
@@ -108,170 +282,722 @@ void Ray_refract(Ray *ray1, Intersection *inter, Ray *ray2) {
  * @return: void
  */
 void Ray_reflect(Ray *ray1, Intersection *inter, Ray *ray2) {
-	Point p, ray_p;
+	Point ray_p;
 	Vector nor, v, temp;
 	
-	p = inter->p;
 	nor = inter->nor;
 	v = ray1->v;
     
 	Vector_scale(&nor, &temp, 2.0* (-(Vector_dot(&nor, &v))));
 	Vector_sum(&temp, &v, &temp);
   
-	ray_p.val[0] = p.val[0] + nor.v[0] * 10e-6;
-	ray_p.val[1] = p.val[1] + nor.v[1] * 10e-6;
-	ray_p.val[2] = p.val[2] + nor.v[2] * 10e-6;
+	offsetOrigin(inter, &temp, &ray_p);
 
 	Ray_set(ray2, ray_p, temp);
 }
 
 
 /*
- * Sends a shadow ray from the current point to a light source. Determines if there
- * is any object blocking the lights path. If no object is found it calculates the
- * diffuse color.
+ * Sets up the shadow ray from an intersection toward a light. The ray
+ * starts just off the surface so it does not hit it again.
  * @inter: an intersection
- * @vrp: the view reference point
- * @return: the diffuse color
+ * @light_p: the light position
+ * @ray: set to the shadow ray
+ * @return: the distance to the light
  */
-Color Ray_send(Intersection *inter, Point vrp) {
-	int i;
-	Intersection *currIntersect = NULL;
+double Ray_shadow(Intersection *inter, Point light_p, Ray *ray) {
 	Vector ray_v;							// ray vector = light position - origin point
-	Ray s_ray; 								// shadow ray
 	Point shadow_p;							// shadow origin
 	
-	RayElement *e;
-	Vector view;
-	Point light_p;
+	ray_v.v[0] = light_p.val[0] - inter->p.val[0];
+	ray_v.v[1] = light_p.val[1] - inter->p.val[1];
+	ray_v.v[2] = light_p.val[2] - inter->p.val[2];
+	ray_v.v[3] = 0.0;
+	offsetOrigin(inter, &ray_v, &shadow_p);
 	
-	Color newColor = {{0.0,0.0,0.0}};
-	Color diffuse = {{0.0,0.0,0.0}};
+	Ray_set(ray, shadow_p, ray_v);
+	return Vector_length(&ray_v);
+}
+
+
+/*
+ * Scrambles a point and a light number into 32 random looking bits, so
+ * an area light is sampled the same way at a point whichever thread
+ * shades it
+ * @p: the point being lit
+ * @light: the light number
+ * @return: the hash
+ */
+static unsigned int lightHash(Point *p, int light) {
+	unsigned char *b = (unsigned char *)p->val;
+	unsigned int h = 2166136261u ^ (unsigned int)light;
+	int i;
 	
-	// send shadow ray to each light
-	for (i = 0; i< global_light->nLights; i++) {
-		light_p = global_light->light[i].position;
-		
-		// calculate shadow ray direction
-		ray_v.v[0] = light_p.val[0] - inter->p.val[0];
-		ray_v.v[1] = light_p.val[1] - inter->p.val[1];
-		ray_v.v[2] = light_p.val[2] - inter->p.val[2];
-		shadow_p.val[0] = inter->p.val[0] + 10e-5 * inter->nor.v[0];
-		shadow_p.val[1] = inter->p.val[1] + 10e-5 * inter->nor.v[1];
-		shadow_p.val[2] = inter->p.val[2] + 10e-5 * inter->nor.v[2];
-		
-		// set the shadow ray
-		Ray_set(&s_ray, shadow_p, ray_v);
+	for (i=0; i<3*(int)sizeof(Real); i++) {
+		h = (h ^ b[i]) * 16777619u;
+	}
+	return h;
+}
+
+
+/*
+ * Mixes a hash with a sample number into a fresh 32 bit value
+ * @h: the hash
+ * @s: the sample number
+ * @return: the mixed value
+ */
+static unsigned int sampleMix(unsigned int h, unsigned int s) {
+	h ^= s * 0x9e3779b9u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+
+/*
+ * Picks a point on an area or sphere light in one cell of an n by n
+ * grid over it. A sphere is sampled over the disc through its center
+ * that faces p, with the cells mapped onto the disc so they keep
+ * equal areas.
+ * @l: the light
+ * @p: the point being lit
+ * @fx, fy: position in [0, 1) across the light
+ * @s: set to the point on the light
+ * @return: void
+ */
+static void lightPoint(Light *l, Point *p, double fx, double fy, Point *s) {
+	Real *c = l->position.val;
+	int i;
+	
+	if (l->type == LightArea) {
+		for (i=0; i<3; i++) {
+			s->val[i] = c[i] + (fx - 0.5) * l->edge[0].v[i] + (fy - 0.5) * l->edge[1].v[i];
+		}
+	}
+	else {
+		Vector w, a, b;
+		double r, phi, dx, dy;
 		
-		// grab the first element
-		e = global_rayModule->head; 
+		// a basis for the disc facing p
+		Vector_set(&w, c[0] - p->val[0], c[1] - p->val[1], c[2] - p->val[2]);
+		Vector_normalize(&w);
+		if (fabs(w.v[0]) > 0.5) {
+			Vector_set(&a, w.v[1], -w.v[0], 0.0);
+		}
+		else {
+			Vector_set(&a, 0.0, w.v[2], -w.v[1]);
+		}
+		Vector_normalize(&a);
+		Vector_cross(&w, &a, &b);
 		
-		// intersect with all objects in the list
-		while (e) {
-			currIntersect = Ray_intersect(&s_ray,e);
-			
-			// once an object is blocking light, get out!
-			if ((currIntersect != NULL)) {
-				break;
+		// concentric map from the square to the disc
+		dx = 2.0 * fx - 1.0;
+		dy = 2.0 * fy - 1.0;
+		if (dx == 0.0 && dy == 0.0) {
+			r = phi = 0.0;
+		}
+		else if (fabs(dx) > fabs(dy)) {
+			r = dx;
+			phi = M_PI / 4.0 * (dy / dx);
+		}
+		else {
+			r = dy;
+			phi = M_PI / 2.0 - M_PI / 4.0 * (dx / dy);
+		}
+		r *= l->radius;
+		for (i=0; i<3; i++) {
+			s->val[i] = c[i] + r * (cos(phi) * a.v[i] + sin(phi) * b.v[i]);
+		}
+	}
+	s->val[3] = 1.0;
+}
+
+
+/*
+ * Sends one jittered shadow ray to cell (i, j) of an n by n grid over
+ * an area light and adds its diffuse light if it is not blocked. The
+ * jitter depends only on the cell, so a cell gives the same sample
+ * whichever pass traces it.
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @inter: the point being lit
+ * @view: unit vector toward the viewer
+ * @index: the light number
+ * @n: cells per side
+ * @i, j: the cell
+ * @seed: hash for the jitter
+ * @sum: the diffuse color, added to
+ * @return: 1 if the cell was not blocked, 0 if it was
+ */
+static int areaSample(RayScene *scene, RayThread *th, Intersection *inter,
+				Vector *view, int index, int n, int i, int j, unsigned int seed,
+													Color *sum) {
+	Light sample = scene->light->light[index];
+	Color diffuse, color = RayElement_getDiffuseColor(inter->e);
+	double lightDist;
+	unsigned int h;
+	Ray s_ray;
+	
+	h = sampleMix(seed, j*n + i);
+	lightPoint(&(scene->light->light[index]), &(inter->p),
+						(i + (h & 0xffff) / 65536.0) / n,
+						(j + (h >> 16) / 65536.0) / n, &(sample.position));
+	lightDist = Ray_shadow(inter, sample.position, &s_ray);
+	if (th->footSpace != NULL) {
+		RayFootprint_ray(&(th->foot), th->footSpace, &s_ray, lightDist);
+	}
+	if (Ray_occluded(&s_ray, scene->module, lightDist,
+						&(th->occluder[index % RAY_OCCLUDERS]))) {
+		return 0;
+	}
+	Light_diffuse(&sample, &(inter->nor), view, &(inter->p), &color,
+											32.0, 1, &diffuse);
+	Color_sum(sum, &diffuse, sum);
+	return 1;
+}
+
+
+/*
+ * Lights a point with an area or sphere light. A few shadow rays go
+ * out first, one to a cell picked at random in each block of the
+ * light's full grid; if they agree, the point is fully lit or fully
+ * hidden and their average is used. Only where they disagree, in the
+ * penumbra, are the rest of the grid's cells sampled, and the probes
+ * count among them.
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @inter: the point being lit
+ * @view: unit vector toward the viewer
+ * @index: the light number
+ * @return: the diffuse color
+ */
+static Color areaLight(RayScene *scene, RayThread *th, Intersection *inter,
+												Vector *view, int index) {
+	Light *l = &(scene->light->light[index]);
+	unsigned int seed = lightHash(&(inter->p), index);
+	int n = l->samples;
+	int p = n < LIGHT_AREA_PROBE ? n : LIGHT_AREA_PROBE;
+	int probe[LIGHT_AREA_PROBE * LIGHT_AREA_PROBE];
+	int lit = 0, count = p*p;
+	int a, b, i, j, k, lo, hi;
+	unsigned int h;
+	Color sum;
+	
+	// the probe in block (a, b) lands on a random cell of it
+	Color_set(&sum, 0.0, 0.0, 0.0);
+	for (b=0; b<p; b++) {
+		for (a=0; a<p; a++) {
+			h = sampleMix(~seed, b*p + a);
+			lo = a*n/p;
+			hi = (a+1)*n/p;
+			i = lo + (h & 0xffff) % (hi - lo);
+			lo = b*n/p;
+			hi = (b+1)*n/p;
+			j = lo + (h >> 16) % (hi - lo);
+			probe[b*p + a] = j*n + i;
+			lit += areaSample(scene, th, inter, view, index, n, i, j, seed, &sum);
+		}
+	}
+	if (lit > 0 && lit < p*p && n > p) {
+		for (j=0; j<n; j++) {
+			for (i=0; i<n; i++) {
+				for (k=0; k<p*p && probe[k] != j*n + i; k++);
+				if (k == p*p) {
+					areaSample(scene, th, inter, view, index, n, i, j, seed, &sum);
+				}
 			}
-			// get the next element
-			e = e->next;
-		}  
+		}
+		count = n*n;
+	}
+	for (k=0; k<3; k++) {
+		sum.c[k] /= count;
+	}
+	return sum;
+}
+
+
+/*
+ * Calculates the diffuse color a point light gives a point, as if
+ * nothing were in the way
+ * @scene: the scene
+ * @inter: an intersection
+ * @vrp: the view reference point
+ * @i: the light number
+ * @return: the diffuse color
+ */
+Color Ray_diffuse(RayScene *scene, Intersection *inter, Point vrp, int i) {
+	Vector view;
+	Color color;
+	Color diffuse = {{0.0,0.0,0.0}};
+	
+	// calculate color at point
+	view.v[0] = -inter->p.val[0] + vrp.val[0]; 
+	view.v[1] = -inter->p.val[1] + vrp.val[1];
+	view.v[2] = -inter->p.val[2] + vrp.val[2];
+	Vector_normalize(&view);
+	
+	// diffuse color
+	color = RayElement_getDiffuseColor(inter->e);
+	
+	// Calculate diffuse lighting here
+	Light_diffuse(&(scene->light->light[i]), &(inter->nor), &view, 
+						&(inter->p), &color, 32.0, 1, &diffuse);
+	return diffuse;
+}
+
+
+/*
+ * Sends a shadow ray from the current point to one light. If no object
+ * blocks it, calculates the diffuse color from that light.
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @inter: an intersection
+ * @vrp: the view reference point
+ * @i: the light number
+ * @return: the diffuse color, black if the light is blocked
+ */
+Color Ray_light(RayScene *scene, RayThread *th, Intersection *inter, Point vrp, int i) {
+	Ray s_ray; 								// shadow ray
+	double lightDist;						// distance from shadow origin to light
+	Color diffuse = {{0.0,0.0,0.0}};
 	
-		// if the light is not being blocked by an object
-		if (currIntersect == NULL) {
-			Color color;
+	if (scene->light->light[i].type == LightArea
+							|| scene->light->light[i].type == LightSphere) {
+		Vector view;
+
+		view.v[0] = -inter->p.val[0] + vrp.val[0]; 
+		view.v[1] = -inter->p.val[1] + vrp.val[1];
+		view.v[2] = -inter->p.val[2] + vrp.val[2];
+		Vector_normalize(&view);
 		
-			// calculate color at point
-			view.v[0] = -inter->p.val[0] + vrp.val[0]; 
-			view.v[1] = -inter->p.val[1] + vrp.val[1];
-			view.v[2] = -inter->p.val[2] + vrp.val[2];
-			Vector_normalize(&view);
-			
-			// diffuse color
-			color = RayElement_getDiffuseColor(inter->e);
-			
-			// Calculate diffuse lighting here
-			Light_diffuse(&(global_light->light[i]), &(inter->nor), &view, 
-								&(inter->p), &color, 32.0, 1, &diffuse);
+		return areaLight(scene, th, inter, &view, i);
+	}
+	
+	lightDist = Ray_shadow(inter, scene->light->light[i].position, &s_ray);
+	if (th->footSpace != NULL) {
+		RayFootprint_ray(&(th->foot), th->footSpace, &s_ray, lightDist);
+	}
+	
+	// if the light is not being blocked by an object
+	if (!Ray_occluded(&s_ray, scene->module, lightDist,
+								&(th->occluder[i % RAY_OCCLUDERS]))) {
+		diffuse = Ray_diffuse(scene, inter, vrp, i);
+	}
+	return diffuse;
+}
+
+
+/*
+ * Bounds the cosine between a surface normal and the direction from
+ * the surface to anywhere in a box. Lights here do not fall off with
+ * distance, so this is all that separates near and far lights.
+ * @b: the box
+ * @inter: the point being lit
+ * @return: an upper bound on the cosine, 0 if the box is behind the surface
+ */
+static double cosineBound(BBox *b, Intersection *inter) {
+	Real *p = inter->p.val;
+	Real *n = inter->nor.v;
+	double d[3], dist, radius = 0.0, front = -1.0, cosC, sinC, cosR, sinR;
+	int i, k;
+
+	for (k=0; k<8; k++) {
+		double dot = 0.0;
+
+		for (i=0; i<3; i++) {
+			dot += (((k >> i) & 1 ? b->max[i] : b->min[i]) - p[i]) * n[i];
 		}
-		
+		front = dot > front ? dot : front;
+	}
+	if (front <= 0) {
+		return 0.0;
+	}
+
+	// the cone from p around the box's bounding sphere
+	for (i=0; i<3; i++) {
+		d[i] = 0.5 * (b->min[i] + b->max[i]) - p[i];
+		radius += 0.25 * (b->max[i] - b->min[i]) * (b->max[i] - b->min[i]);
+	}
+	radius = sqrt(radius);
+	dist = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+	if (dist <= radius) {
+		return 1.0;
+	}
+	cosC = (d[0]*n[0] + d[1]*n[1] + d[2]*n[2]) / dist;
+	sinC = sqrt(1.0 - (cosC < 1.0 ? cosC*cosC : 1.0));
+	sinR = radius / dist;
+	cosR = sqrt(1.0 - sinR*sinR);
+	if (cosC >= cosR) {
+		return 1.0; 	// the normal points into the cone
+	}
+	// cos(angle to the axis - cone half angle)
+	cosC = cosC * cosR + sinC * sinR;
+	return cosC > 0.0 ? cosC : 0.0;
+}
+
+
+/*
+ * Estimates how much light one light could bring to a point, before
+ * shadows. Area lights keep a small weight even when their center is
+ * below the surface, since their edges may not be.
+ * @l: the light
+ * @inter: the point being lit
+ * @return: the estimate, 0 only if the light cannot reach the point
+ */
+static double lightWeight(Light *l, Intersection *inter) {
+	double d[3], len, cosine;
+	int i;
+
+	for (i=0; i<3; i++) {
+		d[i] = l->position.val[i] - inter->p.val[i];
+	}
+	len = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+	cosine = len > 0 ? (d[0]*inter->nor.v[0] + d[1]*inter->nor.v[1]
+										+ d[2]*inter->nor.v[2]) / len : 1.0;
+	cosine = cosine > 0 ? cosine : 0.0;
+
+	if (l->type == LightArea || l->type == LightSphere) {
+		return lightLuminance(l) * (cosine + 0.05);
+	}
+	return lightLuminance(l) * cosine;
+}
+
+
+/*
+ * Picks one light by walking the light hierarchy from the root, going
+ * down each side in proportion to its brightness times the cosine
+ * bound, then choosing within the leaf by each light's own estimate.
+ * u is rescaled at every step, so evenly spaced values of u give
+ * picks spread evenly over the tree.
+ * @scene: the scene
+ * @inter: the point being lit
+ * @u: a number in [0, 1)
+ * @pdf: set to the chance the light had of being picked
+ * @return: the light number, or -1 if no light can reach the point
+ */
+static int pickLight(RayScene *scene, Intersection *inter, double u, double *pdf) {
+	BVH *tree = scene->lightTree;
+	BVHNode *nd;
+	double wl, wr, w, total;
+	int node = 0, i, last = -1;
+
+	*pdf = 1.0;
+	while (tree->node[node].count == 0) {
+		nd = &(tree->node[node]);
+		wl = scene->lightPower[node+1] * cosineBound(&(tree->node[node+1].box), inter);
+		wr = scene->lightPower[nd->right] * cosineBound(&(tree->node[nd->right].box), inter);
+		if (wl + wr <= 0) {
+			return -1;
+		}
+		if (u < wl / (wl + wr)) {
+			u = u * (wl + wr) / wl;
+			*pdf *= wl / (wl + wr);
+			node = node + 1;
+		}
+		else {
+			u = (u - wl / (wl + wr)) * (wl + wr) / wr;
+			*pdf *= wr / (wl + wr);
+			node = nd->right;
+		}
+		u = u < 1.0 ? u : 0.999999;
+	}
+
+	nd = &(tree->node[node]);
+	total = 0.0;
+	for (i=nd->start; i<nd->start + nd->count; i++) {
+		total += lightWeight(&(scene->light->light[tree->index[i]]), inter);
+	}
+	if (total <= 0) {
+		return -1;
+	}
+	u *= total;
+	for (i=nd->start; i<nd->start + nd->count; i++) {
+		w = lightWeight(&(scene->light->light[tree->index[i]]), inter);
+		if (w > 0) {
+			last = i;
+			if (u < w) {
+				break;
+			}
+			u -= w;
+		}
+	}
+	*pdf *= lightWeight(&(scene->light->light[tree->index[last]]), inter) / total;
+	return tree->index[last];
+}
+
+
+/*
+ * Lights a point with scene->lightSamples picks from the light
+ * hierarchy, spread evenly over it from one random offset. Each pick is
+ * divided by its chance of being picked, so the average over many
+ * points is the same as using every light. The same light picked more
+ * than once is only traced once.
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @inter: an intersection
+ * @vrp: the view reference point
+ * @return: the diffuse color
+ */
+static Color sampleLights(RayScene *scene, RayThread *th, Intersection *inter,
+																Point vrp) {
+	Color newColor = {{0.0,0.0,0.0}};
+	Color diffuse;
+	int n = scene->lightSamples;
+	double r = sampleMix(lightHash(&(inter->p), -1), 0) / 4294967296.0;
+	double pdf, weight = 0.0;
+	int j, light, prev = -1;
+
+	// picks come out in tree order, so repeats are next to each other
+	for (j=0; j<=n; j++) {
+		light = j < n ? pickLight(scene, inter, (j + r) / n, &pdf) : -1;
+		if (light >= 0 && light == prev) {
+			weight += 1.0 / (n * pdf);
+			continue;
+		}
+		if (prev >= 0) {
+			diffuse = Ray_light(scene, th, inter, vrp, prev);
+			diffuse.c[0] *= weight;
+			diffuse.c[1] *= weight;
+			diffuse.c[2] *= weight;
+			Color_sum(&newColor, &diffuse, &newColor);
+		}
+		prev = light;
+		weight = light >= 0 ? 1.0 / (n * pdf) : 0.0;
+	}
+	return newColor;
+}
+
+
+/*
+ * Sends a shadow ray from the current point to each light source and
+ * sums the diffuse color from the lights that are not blocked. With
+ * more lights than scene->lightSamples, only that many are sampled.
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @inter: an intersection
+ * @vrp: the view reference point
+ * @return: the diffuse color
+ */
+Color Ray_send(RayScene *scene, RayThread *th, Intersection *inter, Point vrp) {
+	Color newColor = {{0.0,0.0,0.0}};
+	Color diffuse;
+	int i;
+	
+	if (scene->lightTree != NULL && scene->lightSamples < scene->light->nLights) {
+		return sampleLights(scene, th, inter, vrp);
+	}
+	
+	// send shadow ray to each light
+	for (i = 0; i< scene->light->nLights; i++) {
+		diffuse = Ray_light(scene, th, inter, vrp, i);
 		Color_sum(&newColor, &diffuse, &newColor);
 	}
 	return newColor;
 }
 
 
+/*
+ * Decides whether anything lies on a shadow ray before it reaches the
+ * light. The object that blocked this light last time is tested first,
+ * since neighbouring points are usually shadowed by the same thing.
+ * @ray: the shadow ray, pointing at the light
+ * @rmd: the ray module to search
+ * @maxDist: distance to the light
+ * @cache: the last blocker found for this light, updated on a hit
+ * @return: 1 if the light is blocked, 0 if not
+ */
+int Ray_occluded(Ray *ray, RayModule *rmd, double maxDist, RayElement **cache) {
+	RayElement *blocker;
+	double t;
+	
+	rayStats.rays[RayShadow]++;
+	if (*cache != NULL) {
+		t = Ray_intersect(ray, *cache, NULL);
+		if (t >= 0 && t < maxDist) {
+			rayStats.hits++;
+			return 1;
+		}
+	}
+	
+	blocker = Ray_anyHit(ray, rmd, maxDist);
+	if (blocker != NULL) {
+		*cache = blocker;
+		rayStats.hits++;
+		return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Decides whether a reflected or refracted ray off a hit is worth
+ * tracing: it is not if what it brings back could hardly change the
+ * pixel, the path's weight times the ray's coefficient being below
+ * scene->minWeight. With scene->roulette set such a ray is kept anyway
+ * with a chance in proportion to its weight, and its coefficient scaled
+ * up to make up for the ones that were not, so the image keeps its
+ * brightness on average.
+ * @scene: the scene
+ * @ray: the new ray
+ * @level: surfaces shaded along the path, counting the hit
+ * @coeff: the color its light is scaled by, scaled up if roulette keeps it
+ * @weight: the weight of the path up to the hit
+ * @return: the weight of the path with the new ray, 0 to drop it
+ */
+double Ray_pathWeight(RayScene *scene, Ray *ray, int level, Color *coeff, double weight) {
+	double w = coeff->c[0], keep, draw;
+	int i;
+
+	w = coeff->c[1] > w ? coeff->c[1] : w;
+	w = weight * (coeff->c[2] > w ? coeff->c[2] : w);
+	if (w <= 0) {
+		return 0.0;
+	}
+	if (w < scene->minWeight) {
+		// the draw hangs on the ray, so any thread makes the same one
+		keep = w / scene->minWeight;
+		draw = sampleMix(lightHash(&(ray->p), level), 0x2545f491u) / 4294967296.0;
+		if (!scene->roulette || draw >= keep) {
+			return 0.0;
+		}
+		for (i=0; i<3; i++) {
+			coeff->c[i] /= keep;
+		}
+		w = scene->minWeight;
+	}
+	return w;
+}
+
+
+/*
+ * Traces a reflected or refracted ray off a hit, if Ray_pathWeight
+ * finds it worth tracing
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @ray: the new ray
+ * @kind: the kind of ray, for the counters
+ * @coeff: the color its light is scaled by, scaled up if roulette keeps it
+ * @weight: the weight of the path up to the hit
+ * @depth: maximum depth, counting the hit
+ * @eye: our point of view
+ * @vrp: the view reference point
+ * @return: the color the ray sees, black if it was not traced
+ */
+static Color traceSecondary(RayScene *scene, RayThread *th, Ray *ray, RayKind kind,
+								Color *coeff, double weight, int depth, Point eye, Point vrp) {
+	Color c = {{0.0, 0.0, 0.0}};
+	double w, saved;
+
+	if (depth <= 1) {
+		return c;
+	}
+	w = Ray_pathWeight(scene, ray, rayLevel, coeff, weight);
+	if (w <= 0) {
+		return c;
+	}
+
+	rayStats.rays[kind]++;
+	saved = rayWeight;
+	rayWeight = w;
+	c = Ray_trace(scene, th, ray, depth - 1, eye, vrp);
+	rayWeight = saved;
+	return c;
+}
+
+
 /*
  * Intersects a ray with all objects in the scene and returns the
  * color at the given screen coordinates.
+ * @scene: the scene
+ * @th: the calling thread's tracing state
  * @ray: a ray
  * @depth: maximum depth
  * @eye: our point of view
  * @vrp: the view reference point
  * @return: color in screen coordinates
  */
-Color Ray_trace(Ray *ray, int depth, Point eye, Point vrp) {
+Color Ray_trace(RayScene *scene, RayThread *th, Ray *ray, int depth,
+													Point eye, Point vrp) {
 	Color pointColor = {{0.0, 0.0, 0.0}};
-	Color reflectValue = {{0.0,0.0,0.0}};
-	Color refractValue = {{0.0,0.0,0.0}};
-	Color coeffReflect = {{0.0,0.0,0.0}}; 
-	Color coeffRefract = {{0.0,0.0,0.0}};
-	
-	RayElement *e;
-	Intersection *ret;
-	Intersection *currIntersect;
-	double minDist = 10e10;
+	Intersection hit;
+	double t;
 	
 	// return black if max depth is reached;
 	if (depth == 0) {
 		return pointColor; 
 	}
 	
-	// allocate memory
-	ret = malloc(sizeof(Intersection));
+	// find the nearest object along the ray
+	t = Ray_closestHit(ray, scene->module, &hit);
+	if (th->footSpace != NULL) {
+		RayFootprint_ray(&(th->foot), th->footSpace, ray, t);
+	}
+	if (t >= 0) {
+		rayStats.hits++;
+		pointColor = Ray_shade(scene, th, ray, &hit, depth, eye, vrp);
+	}
 	
-	// get the first element
-	e = global_rayModule->head;
+	return pointColor;
+}
+
+
+/*
+ * Computes the color where a ray hit an object: the light reaching the
+ * point plus whatever the reflected and refracted rays bring back.
+ * Called from outside for a primary hit, it starts a new path with a
+ * weight of 1 and counts how deep the path went.
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @ray: the ray that hit the object
+ * @hit: where it hit
+ * @depth: maximum depth, counting this hit
+ * @eye: our point of view
+ * @vrp: the view reference point
+ * @return: the color seen along the ray
+ */
+Color Ray_shade(RayScene *scene, RayThread *th, Ray *ray, Intersection *hit,
+										int depth, Point eye, Point vrp) {
+	Color pointColor = {{0.0, 0.0, 0.0}};
+	Color reflectValue = {{0.0,0.0,0.0}};
+	Color refractValue = {{0.0,0.0,0.0}};
+	Color coeffReflect = {{0.0,0.0,0.0}}; 
+	Color coeffRefract = {{0.0,0.0,0.0}};
+	double weight = rayLevel == 0 ? 1.0 : rayWeight;
+	Ray next;
 	
-	// for each element in the module
-	while (e) {
-		currIntersect = Ray_intersect(ray,e);
-		if (currIntersect != NULL) {
-			// calculate the distance of the nearest intersection of R with the object
-			double dist = Point_dist(&eye, &(currIntersect->p));
-			
-			if (dist < minDist) {
-				// update dist to this distance
-				minDist = dist;
+	rayLevel++;
+	rayDeepest = rayLevel > rayDeepest ? rayLevel : rayDeepest;
+	pointColor = Ray_send(scene, th, hit, vrp);
+	if (RayElement_isReflective(hit->e) == 1){
+		coeffReflect = RayElement_getSpecularColor(hit->e);
+		Ray_reflect(ray, hit, &next);
+		reflectValue = traceSecondary(scene, th, &next, RayReflected, &coeffReflect,
+													weight, depth, eye, vrp);
+	}
+	if (RayElement_isRefractive(hit->e) == 1) {
+		RayKind kind;
 
-				Intersection_copy(ret, currIntersect);
-				ret->e = e;				
-			}
-		}
-		// get the next element
-		e = e->next;
-	} 
-	
-	if (minDist < 10e10) {
-		pointColor = Ray_send(ret, vrp);
-		if (RayElement_isReflective(result->e) == 1){
-			Ray reflectedRay;
-			
-			// calculate reflected ray and color
-			Ray_reflect(ray, ret, &reflectedRay);
-			reflectValue = Ray_trace(&reflectedRay, depth - 1, eye, vrp);
-			
-			// calculate reflection coefficient
-			coeffReflect = RayElement_getSpecularColor(result->e);
-		}
-		// sum up the all the light at the point
-		pointColor = addColors(pointColor, reflectValue, coeffReflect,
-												refractValue, coeffRefract);
+		// light that cannot get out is reflected back in, all of it
+		coeffRefract = RayElement_getRefractionColor(hit->e);
+		kind = Ray_refract(ray, hit, &next) ? RayRefracted : RayReflected;
+		refractValue = traceSecondary(scene, th, &next, kind, &coeffRefract,
+													weight, depth, eye, vrp);
 	}
-	
-	free(ret);
-	return pointColor;
+
+	// back at the primary hit, the path is done
+	if (--rayLevel == 0) {
+		rayStats.paths++;
+		rayStats.depthSum += rayDeepest;
+		rayStats.maxDepth = rayDeepest > rayStats.maxDepth ? rayDeepest : rayStats.maxDepth;
+		rayDeepest = 0;
+	}
+
+	// sum up the all the light at the point
+	return addColors(pointColor, reflectValue, coeffReflect,
+											refractValue, coeffRefract);
 }
 
 
@@ -297,72 +1023,104 @@ void Intersection_set(Intersection *i, Point p, Vector nor) {
 void Intersection_copy(Intersection *dest, Intersection *src) {
 	Point_copy(&(dest->p), &(src->p));
 	Vector_copy(&(dest->nor), &(src->nor));
+	dest->t = src->t;
+}
+
+
+/*
+ * Returns how many primitive intersection tests the calling thread has
+ * made so far. A mesh counts one test per triangle tried.
+ * @return: the number of tests
+ */
+long Ray_tests(void) {
+	long n = 0;
+	int i;
+
+	for (i=0; i<=RayObjInstance; i++) {
+		n += rayStats.tests[i];
+	}
+	return n;
+}
+
+
+/*
+ * Returns the calling thread's counters. Only that thread may use
+ * them while it traces; copy or add them up once it is done.
+ * @return: the counters
+ */
+RayStats *Ray_stats(void) {
+	return &rayStats;
 }
 
 
 /*
  * Intersects a ray with a ray object element and calls the 
  * appropriate function
- * @r: the ray
+ * @ray: the ray
  * @e: an object element to intersect with
- * @return:
+ * @inter: filled in on a hit, may be NULL if only the distance is needed
+ * @return: the distance along the ray to the hit, negative on a miss
  */
-Intersection* Ray_intersect(Ray *ray, RayElement *e) {
-	Intersection *intersect;
-	intersect = NULL;
+double Ray_intersect(Ray *ray, RayElement *e, Intersection *inter) {
+	double t = RAY_MISS;
 	switch (e->type) {
 		case RayObjPlane:
-			intersect = Ray_planeIntersect(ray, &(e->obj.plane), 1);
+			rayStats.tests[RayObjPlane]++;
+			t = Ray_planeIntersect(ray, &(e->obj.plane), 1, inter);
 			break;
 		case RayObjSphere:
-			intersect = Ray_sphereIntersect(ray, &(e->obj.sphere));
+			rayStats.tests[RayObjSphere]++;
+			t = Ray_sphereIntersect(ray, &(e->obj.sphere), inter);
+			break;
+		case RayObjMesh:
+			t = Ray_meshIntersect(ray, &(e->obj.mesh), inter);
 			break;
+		case RayObjInstance:
+			// the hit record names the element inside the instance
+			rayStats.tests[RayObjInstance]++;
+			return Ray_instanceIntersect(ray, &(e->obj.instance), inter);
 	}
-	return intersect;
+	if (inter != NULL && t >= 0) {
+		inter->e = e;
+	}
+	return t;
 }
 
 
 /*
  * Looks for possible intersections between a ray and a sphere
- * and returns the closet one. If there are no intersections
- * then NULL is returned.
- * @r: the ray
+ * and finds the closest one.
+ * @ray: the ray
  * @sphere: the sphere the ray is trying to intersect
- * @return: the intersection if the ray hits the sphere
+ * @inter: filled in on a hit, may be NULL
+ * @return: the distance along the ray to the hit, negative on a miss
  */
-Intersection* Ray_sphereIntersect(Ray *ray, Sphere *sphere) {
-	// get values from ray
-	Point ray_p = ray->p;						// ray oriting
-	Vector ray_v = ray->v;						// ray vector
-	
-	// get values from sphere
-	Point sphere_c = sphere->c;					// sphere center
-	double sphere_r = sphere->r;				// sphere radius
-	
-	// new values
-	Vector distRtoS;							// length from ray to sphere
-	double distRtoS_2;							// ray to sphere squared
-	double sphere_r_2 = sphere_r*sphere_r;		// sphere radius squared
-	double ray_close, halfCord_2, inter_dist;
+double Ray_sphereIntersect(Ray *ray, Sphere *sphere, Intersection *inter) {
+	Real *ray_p = ray->p.val;					// ray origin
+	Real *ray_v = ray->v.v;					// ray vector
+	Real *sphere_c = sphere->c.val;			// sphere center
+	Real sphere_r = sphere->r;				// sphere radius
 	
-	// return variables
-	Point inter;								// intersection point 
-	Vector normal;								// normal at intersection point
-	Intersection *ret;							// itnersection object to return
+	Real distRtoS[3];							// ray origin to sphere center
+	Real distRtoS_2;							// ray to sphere squared
+	Real sphere_r_2 = sphere_r*sphere_r;		// sphere radius squared
+	Real ray_close, halfCord_2, inter_dist;
 	
 	// calculate distance between ray origin and sphere center
-	Vector_set(&distRtoS, sphere_c.val[0] - ray_p.val[0],
-								sphere_c.val[1] - ray_p.val[1],
-								sphere_c.val[2] - ray_p.val[2]);
+	distRtoS[0] = sphere_c[0] - ray_p[0];
+	distRtoS[1] = sphere_c[1] - ray_p[1];
+	distRtoS[2] = sphere_c[2] - ray_p[2];
+	
 	// sqaure the distance
-	distRtoS_2 = Vector_lenSquared(&distRtoS);
+	distRtoS_2 = distRtoS[0]*distRtoS[0] + distRtoS[1]*distRtoS[1]
+												+ distRtoS[2]*distRtoS[2];
 	
 	// calculate ray distance which is closest to the center
-	ray_close = Vector_dot(&distRtoS, &ray_v);
+	ray_close = distRtoS[0]*ray_v[0] + distRtoS[1]*ray_v[1] + distRtoS[2]*ray_v[2];
 	
 	// test if ray is outside and points away from sphere
 	if ((ray_close < 0) && (distRtoS_2 >= sphere_r_2) ) {
-		return NULL;
+		return RAY_MISS;
 	}
 	
 	// find square of half chord intersection distance
@@ -370,7 +1128,7 @@ Intersection* Ray_sphereIntersect(Ray *ray, Sphere *sphere) {
 	
 	// just in case
 	if (halfCord_2 < 0) {
-		return NULL;
+		return RAY_MISS;
 	}
 	
 	// calculate intersection distance
@@ -382,132 +1140,535 @@ Intersection* Ray_sphereIntersect(Ray *ray, Sphere *sphere) {
 	}
 	
 	if (inter_dist == 0.0) {
-		return NULL;
+		return RAY_MISS;
 	}
 	
-	// calculate and set intersection point
-	Point_set(&inter, ray_p.val[0] + ray_v.v[0] * inter_dist,
-							ray_p.val[1] + ray_v.v[1] * inter_dist,
-							ray_p.val[2] + ray_v.v[2] * inter_dist);
-							
-	// calculate and set normal at intersection point
-	Vector_set(&normal, (inter.val[0] - sphere_c.val[0])/sphere_r,
-						(inter.val[1] - sphere_c.val[1])/sphere_r,
-						(inter.val[2] - sphere_c.val[2])/sphere_r);
-	
-	// make space for return value
-	ret = malloc(sizeof(Intersection));
-	
-	// set the return value
-	Intersection_set(ret, inter, normal);
+	if (inter != NULL) {
+		// calculate and set intersection point
+		Point_set(&(inter->p), ray_p[0] + ray_v[0] * inter_dist,
+								ray_p[1] + ray_v[1] * inter_dist,
+								ray_p[2] + ray_v[2] * inter_dist);
+								
+		// calculate and set normal at intersection point
+		Vector_set(&(inter->nor), (inter->p.val[0] - sphere_c[0])/sphere_r,
+									(inter->p.val[1] - sphere_c[1])/sphere_r,
+									(inter->p.val[2] - sphere_c[2])/sphere_r);
+		inter->t = inter_dist;
+	}
 	
-	return ret;
+	return inter_dist;
 }
 
 
 /*
- * Looks for possible intersections between a ray and a plane
- * and returns the closet one. If there are no intersections
- * then NULL is returned.
+ * Looks for possible intersections between a ray and a plane.
  * @ray: the ray
- * @plane: the sphere the ray is trying to intersect
- * @return: the intersection if the ray hits the sphere
+ * @plane: the plane the ray is trying to intersect
+ * @singleSide: 1 to ignore hits on the back of the plane
+ * @inter: filled in on a hit, may be NULL
+ * @return: the distance along the ray to the hit, negative on a miss
  */
-Intersection* Ray_planeIntersect(Ray *ray, Plane *plane, int singleSide) {
-	Point ray_p, inter;
-	Vector normal, ray_v;
-	Intersection *result;
-	double A,B,C,D, v_out, v_0, inter_dist;
+double Ray_planeIntersect(Ray *ray, Plane *plane, int singleSide,
+												Intersection *inter) {
+	Real *ray_p = ray->p.val;
+	Real *ray_v = ray->v.v;
+	Real A,B,C,D, v_out, v_0, inter_dist;
 	
 	A = plane->p[0];
 	B = plane->p[1];
 	C = plane->p[2];
 	D = plane->p[3];
-	
-	ray_p = ray->p;
-	ray_v = ray->v;
   
 	// calculate the ray that comes out (planes index of refraction * ray vector)
-	v_out = A * ray_v.v[0] + B * ray_v.v[1] + C * ray_v.v[2];
+	v_out = A * ray_v[0] + B * ray_v[1] + C * ray_v[2];
 	
 	// if the plane is parallel to the ray or if it has been culled
 	if ( (v_out == 0) || ((v_out > 0) && (singleSide == 1))) {
-		return NULL;
+		return RAY_MISS;
 	}
 	
 	// calculate v_0 and t and compare t to zero
-	v_0 = - (A * ray_p.val[0] + B * ray_p.val[1] + C * ray_p.val[2] + D);
+	v_0 = - (A * ray_p[0] + B * ray_p[1] + C * ray_p[2] + D);
 	inter_dist = v_0/v_out;
 	
 	// if it intersects behind the origin
 	if (inter_dist < 0) {
-		return NULL;
+		return RAY_MISS;
+	}
+	
+	if (inter != NULL) {
+		// compute intersection point
+		Point_set(&(inter->p), ray_p[0] + ray_v[0] * inter_dist,
+								ray_p[1] + ray_v[1] * inter_dist,
+								ray_p[2] + ray_v[2] * inter_dist);
+		
+		// set the normal, toward the ray unless the plane is the face
+		// of something refractive, which needs to know its inside
+		if (v_out < 0 || plane->isRefractive) {
+			Vector_set(&(inter->nor), A, B, C);
+		}
+		else {
+			Vector_set(&(inter->nor), -A, -B, -C);
+		}
+		inter->t = inter_dist;
 	}
 	
-	// compute intersection point
-	Point_set(&inter, ray_p.val[0] + ray_v.v[0] * inter_dist,
-						ray_p.val[1] + ray_v.v[1] * inter_dist,
-						ray_p.val[2] + ray_v.v[2] * inter_dist);
+	return inter_dist;
+}
+
+
+/*
+ * Intersects a ray with one triangle of a mesh (Moller-Trumbore)
+ * @ray: the ray
+ * @tri: the triangle
+ * @tmax: hits at or beyond this distance are ignored
+ * @bu, bv: set to the barycentric coordinates of a hit
+ * @return: the distance along the ray to the hit, negative on a miss
+ */
+static double triangleIntersect(Ray *ray, MeshTri *tri, double tmax,
+												double *bu, double *bv) {
+	Real *d = ray->v.v;
+	Real p[3], q[3], s[3];
+	Real det, inv, u, v, t;
+	
+	rayStats.tests[RayObjMesh]++;
+	p[0] = d[1]*tri->e2[2] - d[2]*tri->e2[1];
+	p[1] = d[2]*tri->e2[0] - d[0]*tri->e2[2];
+	p[2] = d[0]*tri->e2[1] - d[1]*tri->e2[0];
+	det = tri->e1[0]*p[0] + tri->e1[1]*p[1] + tri->e1[2]*p[2];
 	
-	// set the normal
-	if (v_out < 0) {
-		Vector_set(&normal, A, B, C);
+	// the ray is parallel to the triangle
+	if (det > -1e-12 && det < 1e-12) {
+		return RAY_MISS;
 	}
-	else {
-		Vector_set(&normal, -A, -B, -C);
+	inv = 1.0 / det;
+	
+	s[0] = ray->p.val[0] - tri->v0[0];
+	s[1] = ray->p.val[1] - tri->v0[1];
+	s[2] = ray->p.val[2] - tri->v0[2];
+	u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv;
+	if (u < 0.0 || u > 1.0) {
+		return RAY_MISS;
+	}
+	
+	q[0] = s[1]*tri->e1[2] - s[2]*tri->e1[1];
+	q[1] = s[2]*tri->e1[0] - s[0]*tri->e1[2];
+	q[2] = s[0]*tri->e1[1] - s[1]*tri->e1[0];
+	v = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) * inv;
+	if (v < 0.0 || u + v > 1.0) {
+		return RAY_MISS;
 	}
-  
-	// set the result
-	result = malloc(sizeof(Intersection));
-	Intersection_set(result, inter, normal);
 	
-	return result;
+	t = (tri->e2[0]*q[0] + tri->e2[1]*q[1] + tri->e2[2]*q[2]) * inv;
+	if (t <= 0.0 || t >= tmax) {
+		return RAY_MISS;
+	}
+	*bu = u;
+	*bv = v;
+	return t;
 }
 
 
 /*
- * Traces a ray until it finds an intersection
- * @ray: a ray
- * @depth: maximum depth
- * @eye: our point of view
- * @return: the intersection
+ * Finds the nearest triangle of a built mesh hit by a ray, walking the
+ * mesh's own hierarchy. The normal is interpolated from the vertex
+ * normals if the mesh has them, and always faces the ray.
+ * @ray: the ray
+ * @mesh: the mesh, built with Mesh_build
+ * @inter: filled in on a hit, may be NULL
+ * @return: the distance along the ray to the hit, negative on a miss
  */
-Intersection* trace(Ray *ray, int depth, Point eye) {
-	double minDist = 10e10;
-	Intersection *new;
-	Intersection *currIntersect;
-	RayElement *e;
+double Ray_meshIntersect(Ray *ray, Mesh *mesh, Intersection *inter) {
+	double tmax = 10e10;
+	double t, u, v, bu = 0.0, bv = 0.0;
+	Real org[3], inv[3];
+	int stack[BVH_MAX_DEPTH];
+	int top = 0;
+	int best = -1;
+	int i, n;
+	BVHNode *node;
+	
+	if (mesh->bvh == NULL || mesh->nTriangle == 0) {
+		return RAY_MISS;
+	}
+	
+	for (i=0; i<3; i++) {
+		org[i] = ray->p.val[i];
+		inv[i] = 1.0 / ray->v.v[i];
+	}
 	
-	new = malloc(sizeof(Intersection));
+	stack[top++] = 0;
+	while (top > 0) {
+		n = stack[--top];
+		node = &(mesh->bvh->node[n]);
+		if (!BBox_hit(&(node->box), org, inv, tmax)) {
+			continue;
+		}
+		if (node->count > 0) {
+			for (i=node->start; i<node->start + node->count; i++) {
+				t = triangleIntersect(ray, &(mesh->tri[i]), tmax, &u, &v);
+				if (t >= 0) {
+					tmax = t;
+					best = i;
+					bu = u;
+					bv = v;
+				}
+			}
+		}
+		else if (ray->v.v[node->axis] < 0) {
+			stack[top++] = n + 1;
+			stack[top++] = node->right;
+		}
+		else {
+			stack[top++] = node->right;
+			stack[top++] = n + 1;
+		}
+	}
 	
-	// get the first element
-	e = global_rayModule->head;
+	if (best < 0) {
+		return RAY_MISS;
+	}
 	
-	// for each element in the module
-	while (e) {
-	currIntersect = Ray_intersect(ray,e);
-		if (currIntersect != NULL) {
-			// calculate the distance of the nearest intersection of with the object
-			double dist = Point_dist(&eye, &(currIntersect->p));
+	if (inter != NULL) {
+		MeshTri *tri = &(mesh->tri[best]);
+		Vector geom;
+		
+		Point_set(&(inter->p), ray->p.val[0] + ray->v.v[0] * tmax,
+								ray->p.val[1] + ray->v.v[1] * tmax,
+								ray->p.val[2] + ray->v.v[2] * tmax);
+		
+		Vector_set(&geom, tri->e1[1]*tri->e2[2] - tri->e1[2]*tri->e2[1],
+							tri->e1[2]*tri->e2[0] - tri->e1[0]*tri->e2[2],
+							tri->e1[0]*tri->e2[1] - tri->e1[1]*tri->e2[0]);
+		if (mesh->normal != NULL) {
+			Vector *n0 = &(mesh->normal[mesh->index[3*best]]);
+			Vector *n1 = &(mesh->normal[mesh->index[3*best+1]]);
+			Vector *n2 = &(mesh->normal[mesh->index[3*best+2]]);
+			double w = 1.0 - bu - bv;
 			
-			if (dist < minDist) {
-				// update the distance
-				minDist = dist;
-				Intersection_copy(new, currIntersect);
-				new->e = e;
+			Vector_set(&(inter->nor), w*n0->v[0] + bu*n1->v[0] + bv*n2->v[0],
+									w*n0->v[1] + bu*n1->v[1] + bv*n2->v[1],
+									w*n0->v[2] + bu*n1->v[2] + bv*n2->v[2]);
+		}
+		else {
+			Vector_copy(&(inter->nor), &geom);
+		}
+		Vector_normalize(&(inter->nor));
+		
+		// the mesh is two sided; turn the normal toward the ray, unless
+		// the mesh is a refractive solid, which needs to know its inside
+		if (!mesh->isRefractive && Vector_dot(&geom, &(ray->v)) > 0) {
+			Vector_set(&(inter->nor), -inter->nor.v[0], -inter->nor.v[1],
+														-inter->nor.v[2]);
+		}
+		inter->t = tmax;
+	}
+	
+	return tmax;
+}
+
+
+/*
+ * Intersects a ray with an instance by carrying the ray into the
+ * instance's object space and searching its module there. The hit
+ * record comes back in world space and names the element that was hit
+ * inside the module, so it is shaded with that element's material.
+ * @ray: the ray
+ * @inst: the instance
+ * @inter: filled in on a hit, may be NULL
+ * @return: the distance along the ray to the hit, negative on a miss
+ */
+double Ray_instanceIntersect(Ray *ray, RayInstance *inst, Intersection *inter) {
+	Real *a = inst->inv.m;
+	Real *o = ray->p.val;
+	Real *d = ray->v.v;
+	double scale, t;
+	Ray local;
+	Vector n;
+	
+	// points are taken to have w = 1, which ray origins do not always store
+	Point_set(&(local.p), a[0]*o[0] + a[1]*o[1] + a[2]*o[2] + a[3],
+							a[4]*o[0] + a[5]*o[1] + a[6]*o[2] + a[7],
+							a[8]*o[0] + a[9]*o[1] + a[10]*o[2] + a[11]);
+	Vector_set(&(local.v), a[0]*d[0] + a[1]*d[1] + a[2]*d[2],
+							a[4]*d[0] + a[5]*d[1] + a[6]*d[2],
+							a[8]*d[0] + a[9]*d[1] + a[10]*d[2]);
+	
+	// distances along the object space ray are scaled by its length
+	scale = Vector_length(&(local.v));
+	if (scale == 0.0) {
+		return RAY_MISS;
+	}
+	Vector_normalize(&(local.v));
+	
+	t = Ray_closestHit(&local, inst->module, inter);
+	if (t < 0) {
+		return RAY_MISS;
+	}
+	t /= scale;
+	
+	if (inter != NULL) {
+		Point_set(&(inter->p), o[0] + d[0] * t, o[1] + d[1] * t, o[2] + d[2] * t);
+		
+		// normals go to world space by the inverse transpose
+		Vector_copy(&n, &(inter->nor));
+		Vector_set(&(inter->nor), a[0]*n.v[0] + a[4]*n.v[1] + a[8]*n.v[2],
+								a[1]*n.v[0] + a[5]*n.v[1] + a[9]*n.v[2],
+								a[2]*n.v[0] + a[6]*n.v[1] + a[10]*n.v[2]);
+		Vector_normalize(&(inter->nor));
+		inter->t = t;
+	}
+	return t;
+}
+
+
+/*
+ * Walks a ray through a grid cell by cell with a 3D-DDA, testing the
+ * primitives of each cell it passes and descending into the finer grid
+ * of a crowded cell. A primitive may be hit beyond the cell it was
+ * found in, so the walk goes on until the nearest hit lies within the
+ * cell being left.
+ * @g: the grid
+ * @ray: the ray
+ * @prim: the module's bounded elements, numbered as in the grid
+ * @org: the ray origin
+ * @inv: one over each component of the ray direction
+ * @t0: where the ray's part of interest starts
+ * @tmax: the nearest hit so far, updated as nearer ones are found
+ * @any: 1 to return at the first hit closer than tmax
+ * @return: the nearest element hit before the starting tmax, or NULL
+ */
+static RayElement *gridWalk(RayGrid *g, Ray *ray, RayElement **prim,
+					Real org[3], Real inv[3], double t0, double *tmax, int any) {
+	RayElement *best = NULL;
+	RayElement *e;
+	double t1 = *tmax;
+	double tNext[3], tDelta[3], t;
+	int cell[3], step[3];
+	int i, c, axis;
+	
+	if (!BBox_clip(&(g->box), org, inv, &t0, &t1)) {
+		return NULL;
+	}
+	
+	for (i=0; i<3; i++) {
+		double p = org[i] + ray->v.v[i] * t0;
+		
+		cell[i] = (int)floor((p - g->box.min[i]) / g->size[i]);
+		cell[i] = cell[i] < 0 ? 0 : (cell[i] >= g->res[i] ? g->res[i] - 1 : cell[i]);
+		if (ray->v.v[i] > 0) {
+			step[i] = 1;
+			tNext[i] = (g->box.min[i] + (cell[i] + 1) * g->size[i] - org[i]) * inv[i];
+			tDelta[i] = g->size[i] * inv[i];
+		}
+		else if (ray->v.v[i] < 0) {
+			step[i] = -1;
+			tNext[i] = (g->box.min[i] + cell[i] * g->size[i] - org[i]) * inv[i];
+			tDelta[i] = -g->size[i] * inv[i];
+		}
+		else {
+			step[i] = 0;
+			tNext[i] = HUGE_VAL;
+			tDelta[i] = HUGE_VAL;
+		}
+	}
+	
+	while (1) {
+		axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2)
+									: (tNext[1] < tNext[2] ? 1 : 2);
+		c = cell[0] + g->res[0] * (cell[1] + g->res[1] * cell[2]);
+		
+		if (g->sub != NULL && g->sub[c] != NULL) {
+			e = gridWalk(g->sub[c], ray, prim, org, inv, t0, tmax, any);
+			if (e != NULL) {
+				best = e;
+				if (any) {
+					return best;
+				}
+			}
+		}
+		else {
+			for (i=g->start[c]; i<g->start[c+1]; i++) {
+				t = Ray_intersect(ray, prim[g->item[i]], NULL);
+				if (t >= 0 && t < *tmax) {
+					*tmax = t;
+					best = prim[g->item[i]];
+					if (any) {
+						return best;
+					}
+				}
 			}
 		}
-		// get the next element
-		e = e->next;
-	}  
+		
+		// done once the nearest hit is inside this cell
+		if (*tmax <= tNext[axis] || tNext[axis] > t1) {
+			break;
+		}
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= g->res[axis]) {
+			break;
+		}
+		t0 = tNext[axis];
+		tNext[axis] += tDelta[axis];
+	}
+	return best;
+}
+
+
+/*
+ * Finds the nearest object hit by a ray. Planes are tested one by one,
+ * everything else through the module's hierarchy or grid; a module
+ * that has not been built is searched linearly. Only distances are compared
+ * during the search; the hit point and normal are computed once, for
+ * the winner.
+ * @ray: a ray
+ * @rmd: the ray module to search
+ * @hit: filled in with the nearest intersection
+ * @return: the distance to the nearest hit, negative if nothing is hit
+ */
+double Ray_closestHit(Ray *ray, RayModule *rmd, Intersection *hit) {
+	RayElement *best = NULL;
+	double tmax = 10e10;
+	double t;
+	Real org[3], inv[3];
+	int stack[BVH_MAX_DEPTH];
+	int top = 0;
+	int i, n;
+	RayElement *e;
+	BVHNode *node;
 	
-	// if the distance is reasonable return it
-	if (minDist < 10e10) {
-		return new;
+	if (!rmd->built) {
+		for (e = rmd->head; e; e = e->next) {
+			t = Ray_intersect(ray, e, NULL);
+			if (t >= 0 && t < tmax) {
+				tmax = t;
+				best = e;
+			}
+		}
 	}
 	else {
+		for (i=0; i<rmd->nPlanes; i++) {
+			t = Ray_intersect(ray, rmd->plane[i], NULL);
+			if (t >= 0 && t < tmax) {
+				tmax = t;
+				best = rmd->plane[i];
+			}
+		}
+		
+		for (i=0; i<3; i++) {
+			org[i] = ray->p.val[i];
+			inv[i] = 1.0 / ray->v.v[i];
+		}
+		
+		if (rmd->grid != NULL && rmd->nPrims > 0) {
+			e = gridWalk(rmd->grid, ray, rmd->prim, org, inv, 0.0, &tmax, 0);
+			best = e != NULL ? e : best;
+		}
+		
+		// walk the tree front to back, skipping boxes beyond the nearest hit
+		if (rmd->bvh != NULL && rmd->bvh->nPrims > 0) {
+			stack[top++] = 0;
+		}
+		while (top > 0) {
+			n = stack[--top];
+			node = &(rmd->bvh->node[n]);
+			if (!BBox_hit(&(node->box), org, inv, tmax)) {
+				continue;
+			}
+			if (node->count > 0) {
+				for (i=node->start; i<node->start + node->count; i++) {
+					t = Ray_intersect(ray, rmd->prim[i], NULL);
+					if (t >= 0 && t < tmax) {
+						tmax = t;
+						best = rmd->prim[i];
+					}
+				}
+			}
+			else if (ray->v.v[node->axis] < 0) {
+				stack[top++] = n + 1;
+				stack[top++] = node->right;
+			}
+			else {
+				stack[top++] = node->right;
+				stack[top++] = n + 1;
+			}
+		}
+	}
+	
+	if (best == NULL) {
+		return RAY_MISS;
+	}
+	return Ray_intersect(ray, best, hit);
+}
+
+
+/*
+ * Determines whether a ray hits anything closer than maxDist. Stops
+ * at the first hit found.
+ * @ray: a ray
+ * @rmd: the ray module to search
+ * @maxDist: the farthest distance that counts as a hit
+ * @return: the element hit, or NULL if nothing is hit
+ */
+RayElement *Ray_anyHit(Ray *ray, RayModule *rmd, double maxDist) {
+	double t;
+	Real org[3], inv[3];
+	int stack[BVH_MAX_DEPTH];
+	int top = 0;
+	int i, n;
+	RayElement *e;
+	BVHNode *node;
+	
+	if (!rmd->built) {
+		for (e = rmd->head; e; e = e->next) {
+			t = Ray_intersect(ray, e, NULL);
+			if (t >= 0 && t < maxDist) {
+				return e;
+			}
+		}
+		return NULL;
+	}
+	
+	for (i=0; i<rmd->nPlanes; i++) {
+		t = Ray_intersect(ray, rmd->plane[i], NULL);
+		if (t >= 0 && t < maxDist) {
+			return rmd->plane[i];
+		}
+	}
+	if (rmd->nPrims == 0) {
 		return NULL;
 	}
+	
+	for (i=0; i<3; i++) {
+		org[i] = ray->p.val[i];
+		inv[i] = 1.0 / ray->v.v[i];
+	}
+	
+	if (rmd->grid != NULL) {
+		return gridWalk(rmd->grid, ray, rmd->prim, org, inv, 0.0, &maxDist, 1);
+	}
+	
+	stack[top++] = 0;
+	while (top > 0) {
+		n = stack[--top];
+		node = &(rmd->bvh->node[n]);
+		if (!BBox_hit(&(node->box), org, inv, maxDist)) {
+			continue;
+		}
+		if (node->count > 0) {
+			for (i=node->start; i<node->start + node->count; i++) {
+				t = Ray_intersect(ray, rmd->prim[i], NULL);
+				if (t >= 0 && t < maxDist) {
+					return rmd->prim[i];
+				}
+			}
+		}
+		else {
+			stack[top++] = node->right;
+			stack[top++] = n + 1;
+		}
+	}
+	return NULL;
 }
 
 
@@ -529,8 +1690,204 @@ Color addColors(Color pointC, Color reflectV, Color coeffReflect,
 	for (i=0; i<3; i++) {
 		new.c[i] = pointC.c[i] +
 					reflectV.c[i] * coeffReflect.c[i] +
-					refractV.c[i] * coeffRefract.c[0];
+					refractV.c[i] * coeffRefract.c[i];
 	}
 	return new;
 }
 
+
+// ###########################
+// ### Footprint Functions ###
+// ###########################
+
+/*
+ * Empties a footprint
+ * @fp: the footprint
+ * @return: void
+ */
+void RayFootprint_clear(RayFootprint *fp) {
+	int i;
+	
+	for (i=0; i<RAY_FOOT_WORDS; i++) {
+		fp->bit[i] = 0;
+	}
+}
+
+
+/*
+ * Adds the voxels a ray crosses before distance t to a footprint,
+ * stepping through them with a 3D-DDA. The part of the ray outside
+ * space is not recorded.
+ * @fp: the footprint
+ * @space: the space divided into voxels
+ * @ray: the ray
+ * @t: how far along the ray it went, negative if it never stopped
+ * @return: void
+ */
+void RayFootprint_ray(RayFootprint *fp, BBox *space, Ray *ray, double t) {
+	Real org[3], inv[3];
+	double size[3], tNext[3], tDelta[3];
+	double t0 = 0.0, t1 = t < 0 ? HUGE_VAL : t;
+	int cell[3], step[3];
+	int i, k, axis;
+	
+	for (i=0; i<3; i++) {
+		org[i] = ray->p.val[i];
+		inv[i] = 1.0 / ray->v.v[i];
+		size[i] = (space->max[i] - space->min[i]) / RAY_FOOT_RES;
+	}
+	if (!BBox_clip(space, org, inv, &t0, &t1)) {
+		return;
+	}
+	
+	for (i=0; i<3; i++) {
+		double p = org[i] + ray->v.v[i] * t0;
+		
+		cell[i] = (int)floor((p - space->min[i]) / size[i]);
+		cell[i] = cell[i] < 0 ? 0 : (cell[i] >= RAY_FOOT_RES ? RAY_FOOT_RES - 1 : cell[i]);
+		step[i] = ray->v.v[i] > 0 ? 1 : (ray->v.v[i] < 0 ? -1 : 0);
+		tNext[i] = HUGE_VAL;
+		tDelta[i] = HUGE_VAL;
+		if (step[i] != 0) {
+			tNext[i] = (space->min[i] + (cell[i] + (step[i] > 0)) * size[i] - org[i])
+																	* inv[i];
+			tDelta[i] = size[i] * inv[i] * step[i];
+		}
+	}
+	
+	while (1) {
+		k = cell[0] + RAY_FOOT_RES * (cell[1] + RAY_FOOT_RES * cell[2]);
+		fp->bit[k >> 6] |= 1ULL << (k & 63);
+		
+		axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2)
+									: (tNext[1] < tNext[2] ? 1 : 2);
+		if (tNext[axis] > t1) {
+			break;
+		}
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= RAY_FOOT_RES) {
+			break;
+		}
+		tNext[axis] += tDelta[axis];
+	}
+}
+
+
+/*
+ * Adds the voxels a box overlaps to a footprint
+ * @fp: the footprint
+ * @space: the space divided into voxels
+ * @box: the box
+ * @return: 1, or 0 if part of the box lies outside space and so
+ * cannot be recorded
+ */
+int RayFootprint_box(RayFootprint *fp, BBox *space, BBox *box) {
+	int lo[3], hi[3];
+	int i, x, y, z, k;
+	
+	for (i=0; i<3; i++) {
+		double size = (space->max[i] - space->min[i]) / RAY_FOOT_RES;
+		
+		if (box->min[i] < space->min[i] || box->max[i] > space->max[i]) {
+			return 0;
+		}
+		lo[i] = (int)floor((box->min[i] - space->min[i]) / size);
+		hi[i] = (int)floor((box->max[i] - space->min[i]) / size);
+		lo[i] = lo[i] < RAY_FOOT_RES ? lo[i] : RAY_FOOT_RES - 1;
+		hi[i] = hi[i] < RAY_FOOT_RES ? hi[i] : RAY_FOOT_RES - 1;
+	}
+	
+	for (z=lo[2]; z<=hi[2]; z++) {
+		for (y=lo[1]; y<=hi[1]; y++) {
+			for (x=lo[0]; x<=hi[0]; x++) {
+				k = x + RAY_FOOT_RES * (y + RAY_FOOT_RES * z);
+				fp->bit[k >> 6] |= 1ULL << (k & 63);
+			}
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * Tests whether two footprints share a voxel
+ * @a: a footprint
+ * @b: another footprint
+ * @return: 1 if they overlap, 0 if not
+ */
+int RayFootprint_overlap(RayFootprint *a, RayFootprint *b) {
+	int i;
+	
+	for (i=0; i<RAY_FOOT_WORDS; i++) {
+		if (a->bit[i] & b->bit[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+// #######################
+// ### Stats Functions ###
+// #######################
+
+/*
+ * Zeroes a set of counters
+ * @s: the counters
+ * @return: void
+ */
+void RayStats_clear(RayStats *s) {
+	memset(s, 0, sizeof(RayStats));
+}
+
+
+/*
+ * Adds one set of counters into another. Times add up, so with several
+ * threads the stage times are thread time, not elapsed time.
+ * @dest: the running total
+ * @src: the counters to add
+ * @return: void
+ */
+void RayStats_add(RayStats *dest, RayStats *src) {
+	int i;
+
+	for (i=0; i<RayKinds; i++) {
+		dest->rays[i] += src->rays[i];
+	}
+	for (i=0; i<=RayObjInstance; i++) {
+		dest->tests[i] += src->tests[i];
+	}
+	for (i=0; i<RayStages; i++) {
+		dest->ms[i] += src->ms[i];
+	}
+	dest->hits += src->hits;
+	dest->paths += src->paths;
+	dest->depthSum += src->depthSum;
+	dest->maxDepth = src->maxDepth > dest->maxDepth ? src->maxDepth : dest->maxDepth;
+	dest->wallMs += src->wallMs;
+}
+
+
+/*
+ * Writes a set of counters as one JSON object
+ * @s: the counters
+ * @fp: where to write them
+ * @return: void
+ */
+void RayStats_print(RayStats *s, FILE *fp) {
+	fprintf(fp, "{\"rays\": {\"primary\": %ld, \"reflected\": %ld, \"refracted\": %ld, "
+				"\"shadow\": %ld}, \"hits\": %ld, ",
+				s->rays[RayPrimary], s->rays[RayReflected], s->rays[RayRefracted],
+				s->rays[RayShadow], s->hits);
+	fprintf(fp, "\"tests\": {\"sphere\": %ld, \"plane\": %ld, \"triangle\": %ld, "
+				"\"instance\": %ld}, ",
+				s->tests[RayObjSphere], s->tests[RayObjPlane], s->tests[RayObjMesh],
+				s->tests[RayObjInstance]);
+	fprintf(fp, "\"depth\": {\"paths\": %ld, \"mean\": %.3f, \"max\": %d}, ",
+				s->paths, s->paths > 0 ? (double)s->depthSum / s->paths : 0.0,
+				s->maxDepth);
+	fprintf(fp, "\"ms\": {\"camera\": %.3f, \"primary\": %.3f, \"shade\": %.3f, "
+				"\"wall\": %.3f}}",
+				s->ms[RayStageCamera], s->ms[RayStagePrimary], s->ms[RayStageShade],
+				s->wallMs);
+}
@@ -0,0 +1,357 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_bvh.c
+ * Builds a bounding volume hierarchy with the surface area heuristic
+ * and flattens it into a node array
+ */
+
+
+#include "cb_graphics.h"
+
+
+#define BVH_BINS 16
+
+
+// Builder state shared by the recursive calls
+typedef struct {
+	BBox *boxes; 			// primitive boxes
+	double (*centroid)[3]; 	// primitive box centers
+	BVH *bvh;
+} BVHBuild;
+
+// One bin of the SAH sweep
+typedef struct {
+	BBox box;
+	int count;
+} BVHBin;
+
+
+// #####################
+// ### Box Functions ###
+// #####################
+
+/*
+ * Makes a box that contains nothing
+ * @b: a box
+ * @return: void
+ */
+void BBox_empty(BBox *b) {
+	int i;
+
+	for (i=0; i<3; i++) {
+		b->min[i] = 1e300;
+		b->max[i] = -1e300;
+	}
+}
+
+
+/*
+ * Computes the box around two boxes. dest may be a or b.
+ * @dest: the combined box
+ * @a: a box
+ * @b: a box
+ * @return: void
+ */
+void BBox_union(BBox *dest, BBox *a, BBox *b) {
+	int i;
+
+	for (i=0; i<3; i++) {
+		dest->min[i] = a->min[i] < b->min[i] ? a->min[i] : b->min[i];
+		dest->max[i] = a->max[i] > b->max[i] ? a->max[i] : b->max[i];
+	}
+}
+
+
+/*
+ * Returns the surface area of a box, 0 for an empty box
+ * @b: a box
+ * @return: the surface area
+ */
+double BBox_area(BBox *b) {
+	double dx = b->max[0] - b->min[0];
+	double dy = b->max[1] - b->min[1];
+	double dz = b->max[2] - b->min[2];
+
+	if (dx < 0 || dy < 0 || dz < 0) {
+		return 0.0;
+	}
+	return 2.0 * (dx*dy + dy*dz + dz*dx);
+}
+
+
+/*
+ * Slab test of a ray against a box
+ * @b: a box
+ * @org: the ray origin
+ * @inv: one over each component of the ray direction
+ * @tmax: the farthest distance of interest along the ray
+ * @return: 1 if the ray enters the box between 0 and tmax, 0 if not
+ */
+int BBox_hit(BBox *b, Real org[3], Real inv[3], double tmax) {
+	Real tmin = 0.0, tfar = tmax;
+	Real t0, t1, tmp;
+	int i;
+
+	for (i=0; i<3; i++) {
+		t0 = (b->min[i] - org[i]) * inv[i];
+		t1 = (b->max[i] - org[i]) * inv[i];
+		if (t0 > t1) {
+			tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		t1 *= BBOX_ROUND;
+		// written so that a NaN from 0 * inf leaves the interval alone
+		tmin = t0 > tmin ? t0 : tmin;
+		tfar = t1 < tfar ? t1 : tfar;
+		if (tmin > tfar) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * Clips the part of a ray between t0 and t1 to a box
+ * @b: a box
+ * @org: the ray origin
+ * @inv: one over each component of the ray direction
+ * @t0: the near end, moved up to where the ray enters the box
+ * @t1: the far end, moved back to where the ray leaves the box
+ * @return: 1 if any of the ray is left inside the box, 0 if not
+ */
+int BBox_clip(BBox *b, Real org[3], Real inv[3], double *t0, double *t1) {
+	double tmin = *t0, tmax = *t1;
+	double a, c, tmp;
+	int i;
+
+	for (i=0; i<3; i++) {
+		a = (b->min[i] - org[i]) * inv[i];
+		c = (b->max[i] - org[i]) * inv[i];
+		if (a > c) {
+			tmp = a;
+			a = c;
+			c = tmp;
+		}
+		tmin = a > tmin ? a : tmin;
+		tmax = c < tmax ? c : tmax;
+		if (tmin > tmax) {
+			return 0;
+		}
+	}
+	*t0 = tmin;
+	*t1 = tmax;
+	return 1;
+}
+
+
+// #####################
+// ### BVH Functions ###
+// #####################
+
+/*
+ * Turns node into a leaf holding index[start, end)
+ * @bvh: the hierarchy
+ * @node: the node number
+ * @start: first index
+ * @end: one past the last index
+ * @return: void
+ */
+static void makeLeaf(BVH *bvh, int node, int start, int end) {
+	bvh->node[node].start = start;
+	bvh->node[node].count = end - start;
+	bvh->node[node].right = -1;
+	bvh->node[node].axis = 0;
+}
+
+
+/*
+ * Recursively builds the subtree for index[start, end) into node
+ * @b: the builder state
+ * @node: the node number to fill in
+ * @start: first index
+ * @end: one past the last index
+ * @depth: depth of node in the tree
+ * @return: void
+ */
+static void buildNode(BVHBuild *b, int node, int start, int end, int depth) {
+	BVH *bvh = b->bvh;
+	int *index = bvh->index;
+	int n = end - start;
+	BBox box, cbox;
+	BVHBin bin[BVH_BINS];
+	BBox left[BVH_BINS];
+	int leftCount[BVH_BINS];
+	double bestCost, cost, area;
+	int bestAxis = -1, bestBin = 0;
+	int i, j, axis, mid;
+
+	// bounds of the boxes and of their centers
+	BBox_empty(&box);
+	BBox_empty(&cbox);
+	for (i=start; i<end; i++) {
+		BBox_union(&box, &box, &(b->boxes[index[i]]));
+		for (j=0; j<3; j++) {
+			double c = b->centroid[index[i]][j];
+			cbox.min[j] = c < cbox.min[j] ? c : cbox.min[j];
+			cbox.max[j] = c > cbox.max[j] ? c : cbox.max[j];
+		}
+	}
+	bvh->node[node].box = box;
+
+	// stop before the tree gets deeper than the traversal stack
+	if (n <= 1 || depth >= BVH_MAX_DEPTH - 1) {
+		makeLeaf(bvh, node, start, end);
+		return;
+	}
+
+	// the cost of a leaf is one intersection test per primitive
+	area = BBox_area(&box);
+	bestCost = (double)n;
+
+	// bin the centers along each axis and sweep for the cheapest split
+	for (axis=0; axis<3; axis++) {
+		double lo = cbox.min[axis];
+		double extent = cbox.max[axis] - lo;
+		BBox right;
+		int rightCount;
+
+		if (extent <= 0.0) {
+			continue;
+		}
+
+		for (i=0; i<BVH_BINS; i++) {
+			BBox_empty(&(bin[i].box));
+			bin[i].count = 0;
+		}
+		for (i=start; i<end; i++) {
+			int k = (int)(BVH_BINS * (b->centroid[index[i]][axis] - lo) / extent);
+			k = k < BVH_BINS ? k : BVH_BINS - 1;
+			bin[k].count++;
+			BBox_union(&(bin[k].box), &(bin[k].box), &(b->boxes[index[i]]));
+		}
+
+		BBox_empty(&(left[0]));
+		BBox_union(&(left[0]), &(left[0]), &(bin[0].box));
+		leftCount[0] = bin[0].count;
+		for (i=1; i<BVH_BINS; i++) {
+			BBox_union(&(left[i]), &(left[i-1]), &(bin[i].box));
+			leftCount[i] = leftCount[i-1] + bin[i].count;
+		}
+
+		// split after bin i; walk right to left accumulating the right side
+		BBox_empty(&right);
+		rightCount = 0;
+		for (i=BVH_BINS-2; i>=0; i--) {
+			BBox_union(&right, &right, &(bin[i+1].box));
+			rightCount += bin[i+1].count;
+			if (leftCount[i] == 0 || rightCount == 0) {
+				continue;
+			}
+			// one traversal step plus the expected number of tests
+			cost = 0.125 + (BBox_area(&(left[i])) * leftCount[i]
+							+ BBox_area(&right) * rightCount) / area;
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = i;
+			}
+		}
+	}
+
+	if (bestAxis < 0) {
+		if (n <= BVH_LEAF_SIZE) {
+			makeLeaf(bvh, node, start, end);
+			return;
+		}
+		// all centers coincide or no split pays off; halve the list anyway
+		mid = start + n/2;
+		bestAxis = 0;
+	}
+	else {
+		double lo = cbox.min[bestAxis];
+		double extent = cbox.max[bestAxis] - lo;
+
+		// partition the index list around the chosen bin boundary
+		i = start;
+		j = end - 1;
+		while (i <= j) {
+			int k = (int)(BVH_BINS * (b->centroid[index[i]][bestAxis] - lo) / extent);
+			k = k < BVH_BINS ? k : BVH_BINS - 1;
+			if (k <= bestBin) {
+				i++;
+			}
+			else {
+				int tmp = index[i];
+				index[i] = index[j];
+				index[j] = tmp;
+				j--;
+			}
+		}
+		mid = i;
+	}
+
+	// left child directly after this node, right child after the left subtree
+	bvh->node[node].count = 0;
+	bvh->node[node].start = 0;
+	bvh->node[node].axis = bestAxis;
+	buildNode(b, bvh->nNodes++, start, mid, depth + 1);
+	bvh->node[node].right = bvh->nNodes++;
+	buildNode(b, bvh->node[node].right, mid, end, depth + 1);
+}
+
+
+/*
+ * Builds a hierarchy over n primitives given their bounding boxes.
+ * Primitive i is referred to by the number i in the index list.
+ * @boxes: the primitive boxes
+ * @n: number of primitives
+ * @return: the hierarchy
+ */
+BVH *BVH_create(BBox *boxes, int n) {
+	BVH *bvh = malloc(sizeof(BVH));
+	BVHBuild b;
+	int i, j;
+
+	bvh->nPrims = n;
+	bvh->nNodes = 0;
+	bvh->index = malloc(sizeof(int) * (size_t)(n > 0 ? n : 1));
+	// a binary tree with n leaves has 2n-1 nodes
+	bvh->node = malloc(sizeof(BVHNode) * (size_t)(n > 0 ? 2*n - 1 : 1));
+
+	if (n <= 0) {
+		return bvh;
+	}
+
+	b.bvh = bvh;
+	b.boxes = boxes;
+	b.centroid = malloc(sizeof(double[3]) * n);
+	for (i=0; i<n; i++) {
+		bvh->index[i] = i;
+		for (j=0; j<3; j++) {
+			b.centroid[i][j] = 0.5 * (boxes[i].min[j] + boxes[i].max[j]);
+		}
+	}
+
+	bvh->nNodes = 1;
+	buildNode(&b, 0, 0, n, 0);
+
+	free(b.centroid);
+	return bvh;
+}
+
+
+/*
+ * Frees a hierarchy
+ * @bvh: the hierarchy
+ * @return: void
+ */
+void BVH_delete(BVH *bvh) {
+	if (bvh == NULL) {
+		return;
+	}
+	free(bvh->node);
+	free(bvh->index);
+	free(bvh);
+}
@@ -0,0 +1,166 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_camera.c
+ * Sets up primary rays for the ray tracer from a 3D view
+ */
+
+
+#include "cb_graphics.h"
+
+
+// ########################
+// ### Camera Functions ###
+// ########################
+
+/*
+ * Sets up a camera from a view: the view reference coordinates, the
+ * center of projection, and the per column and per row direction
+ * terms. The crop window starts out as the whole image.
+ * @cam: the camera
+ * @view: the view parameters
+ * @return: void
+ */
+void RayCamera_init(RayCamera *cam, View3D *view) {
+	double a, b;
+	int x, y, i;
+
+	// view reference coordinates, the same way Matrix_setView3D builds them
+	cam->view = *view;
+	cam->rows = view->screeny;
+	cam->cols = view->screenx;
+	Point_copy(&(cam->vrp), &(view->vrp));
+	Vector_copy(&(cam->vpn), &(view->vpn));
+	Vector_cross(&(view->vup), &(cam->vpn), &(cam->u));
+	Vector_cross(&(cam->vpn), &(cam->u), &(cam->v));
+	Vector_normalize(&(cam->u));
+	Vector_normalize(&(cam->v));
+
+	Point_set(&(cam->eye), view->vrp.val[0] - view->d * view->vpn.v[0],
+							view->vrp.val[1] - view->d * view->vpn.v[1],
+							view->vrp.val[2] - view->d * view->vpn.v[2]);
+
+	cam->colDir = malloc(sizeof(double) * 3 * (cam->cols > 0 ? cam->cols : 1));
+	cam->rowDir = malloc(sizeof(double) * 3 * (cam->rows > 0 ? cam->rows : 1));
+	for (x=0; x<cam->cols; x++) {
+		a = view->du * ((2*(double)x+1)/(2*(double)cam->cols) - 0.5);
+		for (i=0; i<3; i++) {
+			cam->colDir[3*x+i] = view->d * cam->vpn.v[i] + a * cam->u.v[i];
+		}
+	}
+	for (y=0; y<cam->rows; y++) {
+		b = view->dv * ((2*(double)y+1)/(2*(double)cam->rows) - 0.5);
+		for (i=0; i<3; i++) {
+			cam->rowDir[3*y+i] = b * cam->v.v[i];
+		}
+	}
+
+	cam->x0 = 0;
+	cam->y0 = 0;
+	cam->x1 = cam->cols;
+	cam->y1 = cam->rows;
+}
+
+
+/*
+ * Frees the direction tables of a camera
+ * @cam: the camera
+ * @return: void
+ */
+void RayCamera_clear(RayCamera *cam) {
+	free(cam->colDir);
+	free(cam->rowDir);
+	cam->colDir = NULL;
+	cam->rowDir = NULL;
+}
+
+
+/*
+ * Limits rendering to a rectangle of the image, given in image rows and
+ * columns. The window is clipped to the image.
+ * @cam: the camera
+ * @r0, c0: top left pixel of the window
+ * @r1, c1: one past its bottom right pixel
+ * @return: void
+ */
+void RayCamera_crop(RayCamera *cam, int r0, int c0, int r1, int c1) {
+	r0 = r0 < 0 ? 0 : r0;
+	c0 = c0 < 0 ? 0 : c0;
+	r1 = r1 > cam->rows ? cam->rows : r1;
+	c1 = c1 > cam->cols ? cam->cols : c1;
+
+	cam->x0 = c0;
+	cam->x1 = c1 > c0 ? c1 : c0;
+	cam->y0 = cam->rows - (r1 > r0 ? r1 : r0);
+	cam->y1 = cam->rows - r0;
+}
+
+
+/*
+ * Sets up a primary ray through any point on the screen
+ * @cam: the camera
+ * @fx: screen x in pixels, from the left edge
+ * @fy: screen y in pixels, from the bottom edge
+ * @ray: set to the primary ray
+ * @return: void
+ */
+void RayCamera_ray(RayCamera *cam, double fx, double fy, Ray *ray) {
+	Vector dir;
+	double a, b;
+	int i;
+
+	a = cam->view.du * (fx/cam->cols - 0.5);
+	b = cam->view.dv * (fy/cam->rows - 0.5);
+
+	for (i=0; i<3; i++) {
+		dir.v[i] = cam->view.d * cam->vpn.v[i] + a * cam->u.v[i] + b * cam->v.v[i];
+	}
+	dir.v[3] = 0.0;
+
+	Ray_set(ray, cam->eye, dir);
+}
+
+
+/*
+ * Sets up the primary ray through the center of pixel (x, y)
+ * @cam: the camera
+ * @x: pixel column
+ * @y: pixel row from the bottom
+ * @ray: set to the primary ray
+ * @return: void
+ */
+void RayCamera_pixelRay(RayCamera *cam, int x, int y, Ray *ray) {
+	double *a = &(cam->colDir[3*x]);
+	double *b = &(cam->rowDir[3*y]);
+
+	ray->p = cam->eye;
+	Vector_set(&(ray->v), a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+	Vector_normalize(&(ray->v));
+}
+
+
+/*
+ * Sets up the primary rays through every pixel center of a rectangle,
+ * a row at a time from the bottom
+ * @cam: the camera
+ * @x0, y0: lower left pixel
+ * @x1, y1: one past the upper right pixel
+ * @rays: filled with (x1 - x0) * (y1 - y0) rays
+ * @return: the number of rays
+ */
+int RayCamera_tile(RayCamera *cam, int x0, int y0, int x1, int y1, Ray *rays) {
+	double *a, *b;
+	Ray *ray = rays;
+	int x, y;
+
+	for (y=y0; y<y1; y++) {
+		b = &(cam->rowDir[3*y]);
+		for (x=x0; x<x1; x++) {
+			a = &(cam->colDir[3*x]);
+			ray->p = cam->eye;
+			Vector_set(&(ray->v), a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+			Vector_normalize(&(ray->v));
+			ray++;
+		}
+	}
+	return (int)(ray - rays);
+}
@@ -0,0 +1,428 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_checkpoint.c
+ * Saves the finished tiles of a render to a file and restores them, so
+ * a render that is stopped can pick up where it left off
+ */
+
+
+#include <time.h>
+#include <unistd.h>
+#include "cb_graphics.h"
+
+
+#define CHECKPOINT_MAGIC "CBRAYCK2"
+
+
+// Modules already hashed in one walk of a scene, so a shared module is
+// hashed once however often it is placed
+typedef struct {
+	RayModule **module;
+	int n;
+	int max;
+} HashSeen;
+
+
+// ##########################
+// ### Checkpoint Helpers ###
+// ##########################
+
+/*
+ * Reads a clock for spacing out the saves
+ * @return: milliseconds from some fixed point
+ */
+static double clockMs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+/*
+ * Finds the pixels of one tile inside the crop window
+ * @head: the checkpoint header
+ * @tile: the tile index, in scanline order
+ * @x0, y0: set to the lower left pixel
+ * @x1, y1: set to one past the upper right pixel
+ * @return: void
+ */
+static void tileRect(RayCheckpointHeader *head, int tile, int *x0, int *y0,
+														int *x1, int *y1) {
+	int size = head->tileSize;
+	int tilesX = (head->cols + size - 1) / size;
+
+	*x0 = (tile % tilesX) * size;
+	*y0 = (tile / tilesX) * size;
+	*x1 = *x0 + size < head->cols ? *x0 + size : head->cols;
+	*y1 = *y0 + size < head->rows ? *y0 + size : head->rows;
+	*x0 = *x0 > head->x0 ? *x0 : head->x0;
+	*y0 = *y0 > head->y0 ? *y0 : head->y0;
+	*x1 = *x1 < head->x1 ? *x1 : head->x1;
+	*y1 = *y1 < head->y1 ? *y1 : head->y1;
+}
+
+
+/*
+ * Copies one tile's pixels between two images' pixel arrays
+ * @head: the checkpoint header, giving the image size and the tiling
+ * @tile: the tile index, in scanline order
+ * @dst: the pixels to copy to
+ * @src: the pixels to copy from
+ * @return: void
+ */
+static void copyTile(RayCheckpointHeader *head, int tile, FPixel *dst, FPixel *src) {
+	int x, y, x0, y0, x1, y1;
+
+	tileRect(head, tile, &x0, &y0, &x1, &y1);
+	for (y=y0; y<y1; y++) {
+		size_t row = (size_t)(head->rows-1-y) * head->cols;
+
+		for (x=x0; x<x1; x++) {
+			dst[row + x] = src[row + x];
+		}
+	}
+}
+
+
+/*
+ * Adds bytes to a 64 bit FNV-1a hash
+ * @h: the hash
+ * @p: the bytes
+ * @n: number of bytes
+ * @return: void
+ */
+static void hashBytes(unsigned long long *h, const void *p, size_t n) {
+	const unsigned char *b = p;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		*h = (*h ^ b[i]) * 1099511628211ull;
+	}
+}
+
+
+/*
+ * Adds an element's material to a hash
+ * @h: the hash
+ * @diffuse, specular, refraction: its colors
+ * @isReflective, isRefractive: its flags
+ * @rIndex: its index of refraction
+ * @return: void
+ */
+static void hashMaterial(unsigned long long *h, Color *diffuse, Color *specular,
+						Color *refraction, int isReflective, int isRefractive,
+														double rIndex) {
+	hashBytes(h, diffuse->c, sizeof(diffuse->c));
+	hashBytes(h, specular->c, sizeof(specular->c));
+	hashBytes(h, refraction->c, sizeof(refraction->c));
+	hashBytes(h, &isReflective, sizeof(int));
+	hashBytes(h, &isRefractive, sizeof(int));
+	hashBytes(h, &rIndex, sizeof(double));
+}
+
+
+/*
+ * Adds a light to a hash, field by field so padding is left out
+ * @h: the hash
+ * @l: the light
+ * @return: void
+ */
+static void hashLight(unsigned long long *h, Light *l) {
+	int type = l->type;
+
+	hashBytes(h, &type, sizeof(int));
+	hashBytes(h, l->color.c, sizeof(l->color.c));
+	hashBytes(h, l->direction.v, 3 * sizeof(Real));
+	hashBytes(h, l->position.val, 3 * sizeof(Real));
+	hashBytes(h, &(l->cutoff), sizeof(float));
+	hashBytes(h, &(l->sharpness), sizeof(float));
+	hashBytes(h, l->edge[0].v, 3 * sizeof(Real));
+	hashBytes(h, l->edge[1].v, 3 * sizeof(Real));
+	hashBytes(h, &(l->radius), sizeof(float));
+	hashBytes(h, &(l->samples), sizeof(int));
+}
+
+
+/*
+ * Adds every element of a ray module to a hash: its geometry, its
+ * material and, for an instance, its transform and the module it
+ * places, walked the same way. A module met before in the walk is
+ * added by its place in the walk instead.
+ * @h: the hash
+ * @rmd: the module
+ * @seen: the modules met so far
+ * @return: void
+ */
+static void hashModule(unsigned long long *h, RayModule *rmd, HashSeen *seen) {
+	RayElement *e;
+	int i, type;
+
+	for (i=0; i<seen->n && seen->module[i] != rmd; i++);
+	hashBytes(h, &i, sizeof(int));
+	if (i < seen->n) {
+		return;
+	}
+	if (seen->n == seen->max) {
+		seen->max = seen->max > 0 ? 2 * seen->max : 16;
+		seen->module = realloc(seen->module, sizeof(RayModule *) * seen->max);
+	}
+	seen->module[seen->n++] = rmd;
+
+	for (e = rmd->head; e; e = e->next) {
+		type = e->type;
+		hashBytes(h, &type, sizeof(int));
+		switch (e->type) {
+			case RayObjSphere: {
+				Sphere *sp = &(e->obj.sphere);
+
+				hashBytes(h, sp->c.val, 3 * sizeof(Real));
+				hashBytes(h, &(sp->r), sizeof(Real));
+				hashMaterial(h, &(sp->diffuse), &(sp->specular), &(sp->refraction),
+								sp->isReflective, sp->isRefractive, sp->rIndex);
+				break;
+			}
+			case RayObjPlane: {
+				Plane *pl = &(e->obj.plane);
+
+				hashBytes(h, pl->p, sizeof(pl->p));
+				hashMaterial(h, &(pl->diffuse), &(pl->specular), &(pl->refraction),
+								pl->isReflective, pl->isRefractive, pl->rIndex);
+				break;
+			}
+			case RayObjMesh: {
+				Mesh *m = &(e->obj.mesh);
+				int k, hasNormals = m->normal != NULL;
+
+				hashBytes(h, &(m->nVertex), sizeof(int));
+				for (k=0; k<m->nVertex; k++) {
+					hashBytes(h, m->vertex[k].val, 3 * sizeof(Real));
+					if (hasNormals) {
+						hashBytes(h, m->normal[k].v, 3 * sizeof(Real));
+					}
+				}
+				hashBytes(h, &hasNormals, sizeof(int));
+				hashBytes(h, &(m->nTriangle), sizeof(int));
+				hashBytes(h, m->index, 3 * sizeof(int) * m->nTriangle);
+				hashMaterial(h, &(m->diffuse), &(m->specular), &(m->refraction),
+								m->isReflective, m->isRefractive, m->rIndex);
+				break;
+			}
+			case RayObjInstance:
+				hashBytes(h, e->obj.instance.m.m, sizeof(e->obj.instance.m.m));
+				hashModule(h, e->obj.instance.module, seen);
+				break;
+		}
+	}
+}
+
+
+/*
+ * Hashes what a scene looks like: every light and every element,
+ * through instances and meshes. Two scenes that render differently
+ * hash differently, short of a collision.
+ * @scene: the scene
+ * @return: the hash
+ */
+static unsigned long long hashScene(RayScene *scene) {
+	unsigned long long h = 14695981039346656037ull;
+	HashSeen seen = {NULL, 0, 0};
+	int i;
+
+	hashBytes(&h, &(scene->light->nLights), sizeof(int));
+	for (i=0; i<scene->light->nLights; i++) {
+		hashLight(&h, &(scene->light->light[i]));
+	}
+	hashModule(&h, scene->module, &seen);
+	free(seen.module);
+	return h;
+}
+
+
+// ############################
+// ### Checkpoint Functions ###
+// ############################
+
+/*
+ * Sets up the checkpoint of a render from its settings, with no tile
+ * finished. Nothing is read or written.
+ * @ck: the checkpoint
+ * @rr: the render settings, giving the file and how often to save
+ * @scene: the scene
+ * @cam: the camera
+ * @nTiles: number of tiles the image is split into
+ * @return: void
+ */
+void RayCheckpoint_init(RayCheckpoint *ck, RayRender *rr, RayScene *scene,
+										RayCamera *cam, int nTiles) {
+	RayCheckpointHeader *h = &(ck->head);
+	View3D *v = &(cam->view);
+	int i;
+
+	ck->path = rr->checkpoint;
+	ck->everyMs = rr->checkpointMs;
+	ck->done = calloc(nTiles > 0 ? nTiles : 1, 1);
+	ck->nDone = 0;
+	ck->lastSave = clockMs();
+
+	memset(h, 0, sizeof(RayCheckpointHeader));
+	memcpy(h->magic, CHECKPOINT_MAGIC, 8);
+	h->rows = cam->rows;
+	h->cols = cam->cols;
+	h->x0 = cam->x0;
+	h->y0 = cam->y0;
+	h->x1 = cam->x1;
+	h->y1 = cam->y1;
+	h->tileSize = rr->tileSize;
+	h->nTiles = nTiles;
+	h->depth = rr->depth;
+	h->aa = rr->aa;
+	h->aaMax = rr->aaMax;
+	h->wavefront = rr->wavefront;
+	h->sortSecondary = rr->sortSecondary;
+	h->aaThreshold = rr->aaThreshold;
+	h->precision = sizeof(Real);
+	h->lightSamples = scene->lightSamples;
+	h->roulette = scene->roulette;
+	h->minWeight = scene->minWeight;
+	h->nLights = scene->light->nLights;
+	h->nPrims = scene->module->nPrims;
+	h->sceneHash = hashScene(scene);
+	for (i=0; i<3; i++) {
+		h->box[i] = scene->module->box.min[i];
+		h->box[3+i] = scene->module->box.max[i];
+		h->view[i] = v->vrp.val[i];
+		h->view[3+i] = v->vpn.v[i];
+		h->view[6+i] = v->vup.v[i];
+	}
+	h->view[9] = v->d;
+	h->view[10] = v->du;
+	h->view[11] = v->dv;
+	h->view[12] = v->f;
+	h->view[13] = v->b;
+
+	ck->data = calloc((size_t)h->rows * h->cols > 0 ? (size_t)h->rows * h->cols : 1,
+															sizeof(FPixel));
+}
+
+
+/*
+ * Frees a checkpoint's tile flags and pixels. The file is left alone.
+ * @ck: the checkpoint
+ * @return: void
+ */
+void RayCheckpoint_clear(RayCheckpoint *ck) {
+	free(ck->done);
+	free(ck->data);
+	ck->done = NULL;
+	ck->data = NULL;
+	ck->nDone = 0;
+}
+
+
+/*
+ * Resumes from the checkpoint file, if there is one made by a render
+ * with the same settings of the same scene: its finished tiles are
+ * marked done and their pixels copied into src and the checkpoint's
+ * own copy. Any other file is
+ * ignored, and is replaced at the next save.
+ * @ck: the checkpoint, from RayCheckpoint_init
+ * @src: the image being rendered
+ * @return: the number of tiles taken from the file
+ */
+int RayCheckpoint_load(RayCheckpoint *ck, Image *src) {
+	RayCheckpointHeader head;
+	size_t nPixels = (size_t)src->rows * src->cols;
+	FPixel *data = NULL;
+	char *done = NULL;
+	int ok, i;
+	FILE *fp;
+
+	fp = fopen(ck->path, "rb");
+	if (fp == NULL) {
+		return 0;
+	}
+	ok = fread(&head, sizeof(RayCheckpointHeader), 1, fp) == 1
+				&& memcmp(&head, &(ck->head), sizeof(RayCheckpointHeader)) == 0
+				&& (size_t)head.rows * head.cols == nPixels;
+	if (ok) {
+		done = malloc(head.nTiles > 0 ? head.nTiles : 1);
+		data = malloc(sizeof(FPixel) * (nPixels > 0 ? nPixels : 1));
+		ok = fread(done, 1, head.nTiles, fp) == (size_t)head.nTiles
+				&& fread(data, sizeof(FPixel), nPixels, fp) == nPixels;
+	}
+	fclose(fp);
+
+	// only the finished tiles, so the rest of src is as the caller left it
+	for (i=0; ok && i<head.nTiles; i++) {
+		if (!done[i]) {
+			continue;
+		}
+		ck->done[i] = 1;
+		ck->nDone++;
+		copyTile(&head, i, src->data, data);
+		copyTile(&head, i, ck->data, data);
+	}
+	free(done);
+	free(data);
+	return ck->nDone;
+}
+
+
+/*
+ * Writes the checkpoint file: the header, the tile flags and the
+ * checkpoint's copy of the pixels, which holds only finished tiles, so
+ * nothing is read from an image other threads are still drawing. The
+ * file is written under a temporary name, flushed to disk and renamed
+ * over the old one.
+ * @ck: the checkpoint
+ * @return: 1 if the file was written, 0 if not
+ */
+int RayCheckpoint_save(RayCheckpoint *ck) {
+	size_t nPixels = (size_t)ck->head.rows * ck->head.cols;
+	size_t len = strlen(ck->path);
+	char *tmp = malloc(len + 5);
+	int ok;
+	FILE *fp;
+
+	memcpy(tmp, ck->path, len);
+	memcpy(tmp + len, ".tmp", 5);
+	fp = fopen(tmp, "wb");
+	ok = fp != NULL;
+	if (ok) {
+		ok = fwrite(&(ck->head), sizeof(RayCheckpointHeader), 1, fp) == 1
+				&& fwrite(ck->done, 1, ck->head.nTiles, fp) == (size_t)ck->head.nTiles
+				&& fwrite(ck->data, sizeof(FPixel), nPixels, fp) == nPixels
+				&& fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+		ok = fclose(fp) == 0 && ok;
+	}
+	ok = ok && rename(tmp, ck->path) == 0;
+	if (!ok) {
+		fprintf(stderr, "Unable to write %s\n", ck->path);
+		remove(tmp);
+	}
+	free(tmp);
+	ck->lastSave = clockMs();
+	return ok;
+}
+
+
+/*
+ * Marks a tile finished and copies its pixels out of src, then saves
+ * the checkpoint if it has not been saved for ck->everyMs. Not safe to
+ * call from more than one thread at a time.
+ * @ck: the checkpoint
+ * @tile: the tile index, in scanline order
+ * @src: the image being rendered, with the tile's pixels in it
+ * @return: void
+ */
+void RayCheckpoint_tile(RayCheckpoint *ck, int tile, Image *src) {
+	if (!ck->done[tile]) {
+		ck->done[tile] = 1;
+		ck->nDone++;
+	}
+	copyTile(&(ck->head), tile, ck->data, src->data);
+	if (clockMs() - ck->lastSave >= ck->everyMs) {
+		RayCheckpoint_save(ck);
+	}
+}
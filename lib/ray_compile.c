@@ -0,0 +1,419 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_compile.c
+ * Compiles Module scene graphs into ray modules, so one scene can be
+ * drawn by Module_draw and ray traced
+ */
+
+
+#include "cb_graphics.h"
+
+
+// Triangles gathered from a run of polygons with the same colors
+typedef struct {
+	Point *vertex;
+	Vector *normal;
+	int nVertex, maxVertex;
+	int *index; 			// three vertices per triangle
+	int nTriangle, maxTriangle;
+	int smooth; 			// 1 while every polygon so far came with normals
+} MeshRun;
+
+
+// #######################
+// ### Compile Helpers ###
+// #######################
+
+/*
+ * Tests whether two materials are the same
+ * @a: a material
+ * @b: another material
+ * @return: 1 if they are, 0 if not
+ */
+static int sameMaterial(RayMaterial *a, RayMaterial *b) {
+	int i;
+
+	for (i=0; i<3; i++) {
+		if (a->body.c[i] != b->body.c[i] || a->surface.c[i] != b->surface.c[i]) {
+			return 0;
+		}
+	}
+	return a->coeff == b->coeff;
+}
+
+
+/*
+ * Makes an empty ray module and records it as compiled from source
+ * with material mat
+ * @rc: the compiler
+ * @source: the Module it is made from, NULL for helper modules
+ * @mat: the material it is made with
+ * @return: the new module
+ */
+static RayModule *newModule(RayCompile *rc, Module *source, RayMaterial *mat) {
+	RayCompiled *entry;
+
+	if (rc->nEntries == rc->maxEntries) {
+		rc->maxEntries = rc->maxEntries > 0 ? 2 * rc->maxEntries : 8;
+		rc->entry = realloc(rc->entry, sizeof(RayCompiled) * rc->maxEntries);
+	}
+	entry = &(rc->entry[rc->nEntries++]);
+	entry->source = source;
+	entry->material = *mat;
+	entry->module = RayModule_create();
+	RayModule_setAccel(entry->module, rc->accel);
+	return entry->module;
+}
+
+
+/*
+ * Adds a polygon to a run as a fan of triangles, in the space the
+ * transform takes it to
+ * @run: the run
+ * @pg: the polygon
+ * @LTM: the transform
+ * @normalTM: inverse of the transform for the normals, NULL if it has none
+ * @return: void
+ */
+static void addPolygon(MeshRun *run, Polygon *pg, Matrix *LTM, Matrix *normalTM) {
+	Real *a;
+	int i, k, flip;
+
+	if (pg->nVertex < 3) {
+		return;
+	}
+	if (run->nVertex + pg->nVertex > run->maxVertex) {
+		run->maxVertex = 2 * (run->nVertex + pg->nVertex);
+		run->vertex = realloc(run->vertex, sizeof(Point) * run->maxVertex);
+		run->normal = realloc(run->normal, sizeof(Vector) * run->maxVertex);
+	}
+	if (run->nTriangle + pg->nVertex - 2 > run->maxTriangle) {
+		run->maxTriangle = 2 * (run->nTriangle + pg->nVertex - 2);
+		run->index = realloc(run->index, sizeof(int) * 3 * run->maxTriangle);
+	}
+	if (pg->normal == NULL || normalTM == NULL) {
+		run->smooth = 0;
+	}
+
+	for (i=0; i<pg->nVertex; i++) {
+		Matrix_xformPoint(LTM, &(pg->vertex[i]), &(run->vertex[run->nVertex + i]));
+		Point_normalize(&(run->vertex[run->nVertex + i]));
+		if (run->smooth) {
+			// normals go by the inverse transpose
+			Vector *n = &(pg->normal[i]);
+
+			a = normalTM->m;
+			Vector_set(&(run->normal[run->nVertex + i]),
+						a[0]*n->v[0] + a[4]*n->v[1] + a[8]*n->v[2],
+						a[1]*n->v[0] + a[5]*n->v[1] + a[9]*n->v[2],
+						a[2]*n->v[0] + a[6]*n->v[1] + a[10]*n->v[2]);
+			Vector_normalize(&(run->normal[run->nVertex + i]));
+		}
+	}
+	// the ray tracer turns normals to the side the winding faces, so
+	// wind the fan the way the normals point
+	flip = 0;
+	if (run->smooth) {
+		Point *p = &(run->vertex[run->nVertex]);
+		Vector e1, e2, geom;
+		double dot = 0.0;
+
+		for (k=1; k+1<pg->nVertex; k++) {
+			Vector_set(&e1, p[k].val[0] - p[0].val[0], p[k].val[1] - p[0].val[1],
+											p[k].val[2] - p[0].val[2]);
+			Vector_set(&e2, p[k+1].val[0] - p[0].val[0], p[k+1].val[1] - p[0].val[1],
+											p[k+1].val[2] - p[0].val[2]);
+			Vector_cross(&e1, &e2, &geom);
+			for (i=0; i<3; i++) {
+				dot += geom.v[i] * (run->normal[run->nVertex].v[i]
+							+ run->normal[run->nVertex + k].v[i]
+							+ run->normal[run->nVertex + k + 1].v[i]);
+			}
+		}
+		flip = dot < 0;
+	}
+	for (k=1; k+1<pg->nVertex; k++) {
+		run->index[3*run->nTriangle] = run->nVertex;
+		run->index[3*run->nTriangle + 1] = run->nVertex + (flip ? k + 1 : k);
+		run->index[3*run->nTriangle + 2] = run->nVertex + (flip ? k : k + 1);
+		run->nTriangle++;
+	}
+	run->nVertex += pg->nVertex;
+}
+
+
+/*
+ * Turns the triangles gathered so far into a mesh in rmd, colored by
+ * mat, and starts a new run
+ * @run: the run
+ * @rmd: the module to add the mesh to
+ * @mat: the material of the run
+ * @return: void
+ */
+static void flushRun(MeshRun *run, RayModule *rmd, RayMaterial *mat) {
+	Color black = {{0.0, 0.0, 0.0}};
+	Mesh m;
+	int mirror;
+
+	if (run->nTriangle > 0) {
+		mirror = mat->coeff > 0 && (mat->surface.c[0] > 0 || mat->surface.c[1] > 0
+													|| mat->surface.c[2] > 0);
+		Mesh_set(&m, run->nVertex, run->vertex, run->smooth ? run->normal : NULL,
+									run->nTriangle, run->index);
+		Mesh_setColor(&m, mat->body, mat->surface, black, 0, mirror);
+		RayModule_mesh(rmd, &m);
+	}
+	run->nVertex = 0;
+	run->nTriangle = 0;
+	run->smooth = 1;
+}
+
+
+/*
+ * Adds a sphere placed by a transform. A transform that keeps it round
+ * moves and scales the sphere itself; any other puts it in a module
+ * of its own, placed as an instance.
+ * @rc: the compiler
+ * @rmd: the module to add it to
+ * @s: the sphere
+ * @LTM: the transform
+ * @mat: the material in effect, for the helper module
+ * @return: void
+ */
+static void addSphere(RayCompile *rc, RayModule *rmd, Sphere *s, Matrix *LTM,
+														RayMaterial *mat) {
+	Real *a = LTM->m;
+	double len[3], dot;
+	Sphere copy = *s;
+	RayModule *sub;
+	int i, j, round = 1;
+
+	for (i=0; i<3; i++) {
+		len[i] = sqrt(a[i]*a[i] + a[4+i]*a[4+i] + a[8+i]*a[8+i]);
+	}
+	for (i=0; i<3 && round; i++) {
+		round = fabs(len[i] - len[0]) <= 1e-6 * len[0] && a[12+i] == 0.0;
+		for (j=i+1; j<3 && round; j++) {
+			dot = a[i]*a[j] + a[4+i]*a[4+j] + a[8+i]*a[8+j];
+			round = fabs(dot) <= 1e-6 * len[0] * len[0];
+		}
+	}
+
+	if (round && len[0] > 0) {
+		Matrix_xformPoint(LTM, &(s->c), &(copy.c));
+		Point_normalize(&(copy.c));
+		copy.r = s->r * len[0];
+		RayModule_sphere(rmd, &copy);
+		return;
+	}
+	sub = newModule(rc, NULL, mat);
+	RayModule_sphere(sub, s);
+	RayModule_instance(rmd, sub, LTM);
+}
+
+
+/*
+ * Adds a plane placed by a transform. The plane coefficients go by
+ * the inverse of the transform, then are scaled to a unit normal.
+ * @rmd: the module to add it to
+ * @p: the plane
+ * @LTM: the transform
+ * @return: void
+ */
+static void addPlane(RayModule *rmd, Plane *p, Matrix *LTM) {
+	Plane copy = *p;
+	Matrix inv;
+	double q[4], len;
+	int i;
+
+	if (!Matrix_invert(LTM, &inv)) {
+		return;
+	}
+	for (i=0; i<4; i++) {
+		q[i] = p->p[0] * inv.m[i] + p->p[1] * inv.m[4+i]
+					+ p->p[2] * inv.m[8+i] + p->p[3] * inv.m[12+i];
+	}
+	len = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2]);
+	if (len == 0) {
+		return;
+	}
+	for (i=0; i<4; i++) {
+		copy.p[i] = q[i] / len;
+	}
+	RayModule_plane(rmd, &copy);
+}
+
+
+/*
+ * Compiles a Module into a ray module in the Module's own space,
+ * following Module_draw: the LTM starts as the identity, matrices
+ * multiply onto it from the left, and a sub-module is placed through
+ * the LTM in effect with a copy of the colors. Runs of polygons with
+ * the same colors become one triangle mesh. Lines, points, circles and
+ * textures have nothing to hit and are left out.
+ * @rc: the compiler
+ * @md: the Module
+ * @mat: the colors in effect where it is placed
+ * @return: the ray module, shared with any other place md was put with
+ * the same colors
+ */
+static RayModule *compileModule(RayCompile *rc, Module *md, RayMaterial *mat) {
+	RayMaterial cur = *mat;
+	RayModule *rmd, *sub;
+	MeshRun run;
+	Matrix LTM, inv;
+	Element *e;
+	int i, haveInv = 0;
+
+	for (i=0; i<rc->nEntries; i++) {
+		if (rc->entry[i].source == md && sameMaterial(&(rc->entry[i].material), mat)) {
+			return rc->entry[i].module;
+		}
+	}
+	rmd = newModule(rc, md, mat);
+
+	run.vertex = NULL;
+	run.normal = NULL;
+	run.index = NULL;
+	run.maxVertex = run.maxTriangle = 0;
+	run.nVertex = run.nTriangle = 0;
+	run.smooth = 1;
+	Matrix_identity(&LTM);
+
+	for (e = md->head; e; e = e->next) {
+		switch (e->type) {
+			case ObjPolygon:
+				if (!haveInv) {
+					haveInv = Matrix_invert(&LTM, &inv) ? 1 : -1;
+				}
+				addPolygon(&run, &(e->obj.polygon), &LTM, haveInv > 0 ? &inv : NULL);
+				break;
+			case ObjSphere:
+				addSphere(rc, rmd, &(e->obj.sphere), &LTM, &cur);
+				break;
+			case ObjPlane:
+				addPlane(rmd, &(e->obj.plane), &LTM);
+				break;
+			case ObjIdentity:
+				Matrix_identity(&LTM);
+				haveInv = 0;
+				break;
+			case ObjMatrix:
+				Matrix_multiply(&(e->obj.matrix), &LTM, &LTM);
+				haveInv = 0;
+				break;
+			case ObjBodyColor:
+			case ObjSurfaceColor:
+			case ObjSurfaceCoeff:
+				// a new material ends the run
+				flushRun(&run, rmd, &cur);
+				if (e->type == ObjBodyColor) {
+					cur.body = e->obj.color;
+				}
+				else if (e->type == ObjSurfaceColor) {
+					cur.surface = e->obj.color;
+				}
+				else {
+					cur.coeff = e->obj.coeff;
+				}
+				break;
+			case ObjModule:
+				sub = compileModule(rc, e->obj.module, &cur);
+				if (sub->head != NULL) {
+					RayModule_instance(rmd, sub, &LTM);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	flushRun(&run, rmd, &cur);
+	free(run.vertex);
+	free(run.normal);
+	free(run.index);
+
+	RayModule_build(rmd);
+	return rmd;
+}
+
+
+// #########################
+// ### Compile Functions ###
+// #########################
+
+/*
+ * Sets up an empty compiler that builds hierarchies
+ * @rc: the compiler
+ * @return: void
+ */
+void RayCompile_init(RayCompile *rc) {
+	rc->accel = RayAccelBVH;
+	rc->root = NULL;
+	rc->entry = NULL;
+	rc->nEntries = 0;
+	rc->maxEntries = 0;
+}
+
+
+/*
+ * Frees every ray module the compiler made. The settings are left
+ * alone.
+ * @rc: the compiler
+ * @return: void
+ */
+void RayCompile_clear(RayCompile *rc) {
+	int i;
+
+	for (i=0; i<rc->nEntries; i++) {
+		RayModule_delete(rc->entry[i].module);
+	}
+	free(rc->entry);
+	rc->root = NULL;
+	rc->entry = NULL;
+	rc->nEntries = 0;
+	rc->maxEntries = 0;
+}
+
+
+/*
+ * Compiles a Module hierarchy into a built ray module ready for
+ * RayScene_init, the same scene Module_draw would draw with the GTM
+ * and draw state. Polygons become triangle meshes colored by the body
+ * color, with the surface color as their specular color; a surface
+ * coefficient above 0 makes them mirrors, since the ray tracer reflects
+ * its specular color. Spheres and planes keep their own colors. Each
+ * sub-module becomes an instance of a module compiled once per set of
+ * colors it is placed with. Anything compiled before is freed first.
+ * @rc: the compiler, its accel set as wanted
+ * @md: the root Module
+ * @GTM: transform for the whole scene, NULL for the identity
+ * @ds: the starting colors, NULL for the draw state defaults
+ * @return: the scene's ray module, also left in rc->root; owned by rc
+ */
+RayModule *RayCompile_module(RayCompile *rc, Module *md, Matrix *GTM, DrawState *ds) {
+	RayMaterial mat;
+	RayModule *scene;
+
+	RayCompile_clear(rc);
+	Color_set(&(mat.body), 1.0, 1.0, 1.0);
+	Color_set(&(mat.surface), 1.0, 1.0, 1.0);
+	mat.coeff = 0.0;
+	if (ds != NULL) {
+		mat.body = ds->body;
+		mat.surface = ds->surface;
+		mat.coeff = ds->surfaceCoeff;
+	}
+
+	scene = compileModule(rc, md, &mat);
+	if (GTM != NULL) {
+		rc->root = newModule(rc, NULL, &mat);
+		if (scene->head != NULL) {
+			RayModule_instance(rc->root, scene, GTM);
+		}
+		RayModule_build(rc->root);
+	}
+	else {
+		rc->root = scene;
+	}
+	return rc->root;
+}
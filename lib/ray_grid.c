@@ -0,0 +1,197 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_grid.c
+ * Builds uniform grids over primitive boxes, optionally with a second,
+ * finer grid inside each crowded cell
+ */
+
+
+#include "cb_graphics.h"
+
+
+// ######################
+// ### Grid Functions ###
+// ######################
+
+/*
+ * Finds the range of cells a box overlaps along one axis
+ * @g: the grid
+ * @b: the box
+ * @axis: the axis
+ * @lo: set to the first cell
+ * @hi: set to the last cell
+ * @return: void
+ */
+static void cellRange(RayGrid *g, BBox *b, int axis, int *lo, int *hi) {
+	int l = (int)floor((b->min[axis] - g->box.min[axis]) / g->size[axis]);
+	int h = (int)floor((b->max[axis] - g->box.min[axis]) / g->size[axis]);
+
+	*lo = l < 0 ? 0 : (l >= g->res[axis] ? g->res[axis] - 1 : l);
+	*hi = h < 0 ? 0 : (h >= g->res[axis] ? g->res[axis] - 1 : h);
+}
+
+
+/*
+ * Builds a grid over the primitives listed in ids. Each primitive is
+ * counted into every cell its box overlaps, then the counts are summed
+ * into offsets and the primitives dropped into place, so the build is
+ * linear in the number of primitive-cell overlaps.
+ * @boxes: the box of every primitive
+ * @ids: the primitives to grid
+ * @n: number of entries in ids
+ * @bounds: the space to grid
+ * @levels: 2 to give crowded cells a grid of their own, 1 not to
+ * @return: the grid
+ */
+static RayGrid *buildGrid(BBox *boxes, int *ids, int n, BBox *bounds, int levels) {
+	RayGrid *g = malloc(sizeof(RayGrid));
+	double extent[3], volume, scale, pad;
+	int lo[3], hi[3];
+	int nCells, i, x, y, z, c, k;
+	int *fill;
+
+	// pad flat boxes so every axis has some thickness
+	pad = 0.0;
+	for (i=0; i<3; i++) {
+		extent[i] = bounds->max[i] - bounds->min[i];
+		pad = extent[i] > pad ? extent[i] : pad;
+	}
+	pad = pad * 1e-6 + 1e-9;
+	g->box = *bounds;
+	volume = 1.0;
+	for (i=0; i<3; i++) {
+		g->box.min[i] -= pad;
+		g->box.max[i] += pad;
+		extent[i] = g->box.max[i] - g->box.min[i];
+		volume *= extent[i];
+	}
+
+	// about GRID_DENSITY cells per primitive, in cells as cubic as possible
+	scale = cbrt(GRID_DENSITY * (n > 0 ? n : 1) / volume);
+	nCells = 1;
+	for (i=0; i<3; i++) {
+		g->res[i] = (int)(extent[i] * scale + 0.5);
+		g->res[i] = g->res[i] < 1 ? 1 : (g->res[i] > GRID_MAX_RES ? GRID_MAX_RES : g->res[i]);
+		g->size[i] = extent[i] / g->res[i];
+		nCells *= g->res[i];
+	}
+
+	// count, offset, fill
+	g->start = calloc((size_t)nCells + 1, sizeof(int));
+	for (k=0; k<n; k++) {
+		for (i=0; i<3; i++) {
+			cellRange(g, &(boxes[ids[k]]), i, &(lo[i]), &(hi[i]));
+		}
+		for (z=lo[2]; z<=hi[2]; z++) {
+			for (y=lo[1]; y<=hi[1]; y++) {
+				for (x=lo[0]; x<=hi[0]; x++) {
+					g->start[x + g->res[0] * (y + g->res[1] * z) + 1]++;
+				}
+			}
+		}
+	}
+	for (c=0; c<nCells; c++) {
+		g->start[c+1] += g->start[c];
+	}
+	g->item = malloc(sizeof(int) * (g->start[nCells] > 0 ? g->start[nCells] : 1));
+	fill = malloc(sizeof(int) * nCells);
+	memcpy(fill, g->start, sizeof(int) * nCells);
+	for (k=0; k<n; k++) {
+		for (i=0; i<3; i++) {
+			cellRange(g, &(boxes[ids[k]]), i, &(lo[i]), &(hi[i]));
+		}
+		for (z=lo[2]; z<=hi[2]; z++) {
+			for (y=lo[1]; y<=hi[1]; y++) {
+				for (x=lo[0]; x<=hi[0]; x++) {
+					g->item[fill[x + g->res[0] * (y + g->res[1] * z)]++] = ids[k];
+				}
+			}
+		}
+	}
+	free(fill);
+
+	// a finer grid inside each crowded cell
+	g->sub = NULL;
+	if (levels > 1) {
+		g->sub = malloc(sizeof(RayGrid *) * nCells);
+		for (z=0; z<g->res[2]; z++) {
+			for (y=0; y<g->res[1]; y++) {
+				for (x=0; x<g->res[0]; x++) {
+					BBox cell;
+					int count;
+
+					c = x + g->res[0] * (y + g->res[1] * z);
+					count = g->start[c+1] - g->start[c];
+					g->sub[c] = NULL;
+					if (count <= GRID_CROWDED) {
+						continue;
+					}
+					cell.min[0] = g->box.min[0] + x * g->size[0];
+					cell.min[1] = g->box.min[1] + y * g->size[1];
+					cell.min[2] = g->box.min[2] + z * g->size[2];
+					for (i=0; i<3; i++) {
+						cell.max[i] = cell.min[i] + g->size[i];
+					}
+					g->sub[c] = buildGrid(boxes, &(g->item[g->start[c]]), count,
+																&cell, 1);
+				}
+			}
+		}
+	}
+
+	return g;
+}
+
+
+/*
+ * Builds a grid over n primitives given their bounding boxes.
+ * Primitive i is referred to by the number i in the item lists.
+ * @boxes: the primitive boxes
+ * @n: number of primitives
+ * @levels: 1 for a uniform grid, 2 for a two-level grid
+ * @return: the grid
+ */
+RayGrid *RayGrid_create(BBox *boxes, int n, int levels) {
+	RayGrid *g;
+	BBox bounds;
+	int *ids = malloc(sizeof(int) * (n > 0 ? n : 1));
+	int i;
+
+	BBox_empty(&bounds);
+	for (i=0; i<n; i++) {
+		ids[i] = i;
+		BBox_union(&bounds, &bounds, &(boxes[i]));
+	}
+	if (n == 0) {
+		for (i=0; i<3; i++) {
+			bounds.min[i] = bounds.max[i] = 0.0;
+		}
+	}
+
+	g = buildGrid(boxes, ids, n, &bounds, levels);
+	free(ids);
+	return g;
+}
+
+
+/*
+ * Frees a grid and any grids inside it
+ * @g: the grid
+ * @return: void
+ */
+void RayGrid_delete(RayGrid *g) {
+	int c;
+
+	if (g == NULL) {
+		return;
+	}
+	if (g->sub != NULL) {
+		for (c=0; c<g->res[0] * g->res[1] * g->res[2]; c++) {
+			RayGrid_delete(g->sub[c]);
+		}
+		free(g->sub);
+	}
+	free(g->start);
+	free(g->item);
+	free(g);
+}
@@ -45,6 +45,13 @@ RayElement *RayElement_init(RayObjType type, void *obj) {
 		case RayObjSphere:
 			memcpy(&(e->obj.sphere), obj, sizeof(Sphere));
 			break;
+		case RayObjMesh:
+			// the arrays are not copied; the element takes them over
+			memcpy(&(e->obj.mesh), obj, sizeof(Mesh));
+			break;
+		case RayObjInstance:
+			memcpy(&(e->obj.instance), obj, sizeof(RayInstance));
+			break;
 		default:
 			break;
   }
@@ -58,6 +65,9 @@ RayElement *RayElement_init(RayObjType type, void *obj) {
  * @return: void
  */
 void RayElement_delete(RayElement *e) {
+	if (e->type == RayObjMesh) {
+		Mesh_clear(&(e->obj.mesh));
+	}
 	free(e);
 }
 
@@ -74,6 +84,8 @@ Color RayElement_getDiffuseColor(RayElement *e) {
 			return e->obj.plane.diffuse;
 		case RayObjSphere:
 			return e->obj.sphere.diffuse;
+		case RayObjMesh:
+			return e->obj.mesh.diffuse;
 		default:
 			return c;
 	}
@@ -92,6 +104,8 @@ Color RayElement_getSpecularColor(RayElement *e) {
 			return e->obj.plane.specular;
 		case RayObjSphere:
 			return e->obj.sphere.specular;
+		case RayObjMesh:
+			return e->obj.mesh.specular;
 		default:
 			return c;
 	}
@@ -110,6 +124,8 @@ Color RayElement_getRefractionColor(RayElement *e) {
 			return e->obj.plane.refraction;
 		case RayObjSphere:
 			return e->obj.sphere.refraction;
+		case RayObjMesh:
+			return e->obj.mesh.refraction;
 		default:
 			return c;
 	}
@@ -129,6 +145,8 @@ double RayElement_getIndexOfRefraction(RayElement *e) {
 			break;
 		case RayObjSphere:
 			return e->obj.sphere.rIndex;
+		case RayObjMesh:
+			return e->obj.mesh.rIndex;
 		default:
 			return rIndex;
 	}
@@ -148,6 +166,8 @@ int RayElement_isRefractive(RayElement *e) {
 			break;
 		case RayObjSphere:
 			return e->obj.sphere.isRefractive;
+		case RayObjMesh:
+			return e->obj.mesh.isRefractive;
 		default:
 			return bool;
 	}
@@ -168,12 +188,77 @@ int RayElement_isReflective(RayElement *e) {
 		case RayObjSphere:
 			return e->obj.sphere.isReflective;
 			break;
+		case RayObjMesh:
+			return e->obj.mesh.isReflective;
 		default:
 			return bool;
 	}
 }
 
 
+/*
+ * Computes the world space box around an instance by transforming the
+ * corners of its module's box
+ * @inst: an instance
+ * @box: set to the bounding box
+ * @return: 1 if the instance is bounded, 0 if not
+ */
+static int instanceBounds(RayInstance *inst, BBox *box) {
+	RayModule *sub = inst->module;
+	BBox *b;
+	Point corner, p;
+	int i, j;
+
+	if (!sub->built || sub->nPlanes > 0 || sub->nPrims == 0) {
+		return 0;
+	}
+	b = &(sub->box);
+
+	BBox_empty(box);
+	for (i=0; i<8; i++) {
+		Point_set(&corner, (i & 1) ? b->max[0] : b->min[0],
+							(i & 2) ? b->max[1] : b->min[1],
+							(i & 4) ? b->max[2] : b->min[2]);
+		Matrix_xformPoint(&(inst->m), &corner, &p);
+		for (j=0; j<3; j++) {
+			box->min[j] = p.val[j] < box->min[j] ? p.val[j] : box->min[j];
+			box->max[j] = p.val[j] > box->max[j] ? p.val[j] : box->max[j];
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * Computes the bounding box of a ray object
+ * @e: a ray element
+ * @box: set to the bounding box
+ * @return: 1 if the element is bounded, 0 if not (planes, empty meshes,
+ * instances of modules with planes in them)
+ */
+int RayElement_bounds(RayElement *e, BBox *box) {
+	int i;
+	switch (e->type) {
+		case RayObjSphere:
+			for (i=0; i<3; i++) {
+				box->min[i] = e->obj.sphere.c.val[i] - e->obj.sphere.r;
+				box->max[i] = e->obj.sphere.c.val[i] + e->obj.sphere.r;
+			}
+			return 1;
+		case RayObjMesh:
+			if (e->obj.mesh.bvh == NULL || e->obj.mesh.nTriangle == 0) {
+				return 0;
+			}
+			*box = e->obj.mesh.bvh->node[0].box;
+			return 1;
+		case RayObjInstance:
+			return instanceBounds(&(e->obj.instance), box);
+		default:
+			return 0;
+	}
+}
+
+
 
 // ##################
 // ### RAY MODULE ###
@@ -189,6 +274,16 @@ RayModule *RayModule_create() {
 	RayModule *rmd = malloc(sizeof(RayModule));
 	rmd->head = NULL;
 	rmd->tail = NULL;
+	rmd->accel = RayAccelBVH;
+	rmd->built = 0;
+	rmd->bvh = NULL;
+	rmd->grid = NULL;
+	rmd->prim = NULL;
+	rmd->nPrims = 0;
+	rmd->plane = NULL;
+	rmd->nPlanes = 0;
+	rmd->soa.cx = rmd->soa.cy = rmd->soa.cz = rmd->soa.r2 = NULL;
+	rmd->soa.n = 0;
 	return rmd;
 }
 
@@ -203,12 +298,15 @@ RayModule *RayModule_create() {
  */
 void RayModule_clear(RayModule *rmd) {
 	RayElement *p,*q;
+	RayModule_unbuild(rmd);
 	p = rmd->head;
 	while (p) {
 		q = p;
 		p = p->next;
 		RayElement_delete(q);
 	}
+	rmd->head = NULL;
+	rmd->tail = NULL;
 }
 
 
@@ -236,6 +334,7 @@ void RayModule_delete(RayModule *rmd) {
  * This function is modified from Module_insert in module.c
  */
 void RayModule_insert(RayModule *rmd, RayElement *e) {
+	RayModule_unbuild(rmd);
 	if (rmd->head == NULL) {
 		rmd->head = e;
 		rmd->tail = e;
@@ -271,6 +370,169 @@ void RayModule_sphere(RayModule *rmd, Sphere *s) {
 }
 
 
+/*
+ * Adds m to the tail of the ray module's list, building its hierarchy
+ * if it has none. The module takes over the mesh's arrays; m must not
+ * be cleared afterwards.
+ * @rmd: a ray module
+ * @m: a ray object mesh
+ * @return: void
+ */
+void RayModule_mesh(RayModule *rmd, Mesh *m) {
+	RayElement *e = RayElement_init(RayObjMesh, m);
+	if (e->obj.mesh.tri == NULL) {
+		Mesh_build(&(e->obj.mesh));
+	}
+	RayModule_insert(rmd, e);
+}
 
 
+/*
+ * Adds an instance of sub, placed by the transform m, to the tail of
+ * the ray module's list. sub is shared, not copied, and is built here
+ * if it has not been; it must outlive rmd and must not be changed
+ * while rmd is being rendered.
+ * @rmd: a ray module
+ * @sub: the module to place
+ * @m: object space to world space, an affine transform
+ * @return: 0 on success, -1 if m cannot be inverted
+ */
+int RayModule_instance(RayModule *rmd, RayModule *sub, Matrix *m) {
+	RayInstance inst;
+	RayElement *e;
+
+	inst.module = sub;
+	Matrix_copy(&(inst.m), m);
+	if (!Matrix_invert(m, &(inst.inv))) {
+		return -1;
+	}
+	if (!sub->built) {
+		RayModule_build(sub);
+	}
+	e = RayElement_init(RayObjInstance, &inst);
+	RayModule_insert(rmd, e);
+	return 0;
+}
+
+
+/*
+ * Chooses the structure RayModule_build makes. A hierarchy is the
+ * fastest to trace; a grid builds in linear time, which pays off when
+ * the module is rebuilt every frame.
+ * @rmd: a ray module
+ * @accel: the structure
+ * @return: void
+ */
+void RayModule_setAccel(RayModule *rmd, RayAccel accel) {
+	RayModule_unbuild(rmd);
+	rmd->accel = accel;
+}
 
+
+/*
+ * Builds the hierarchy or grid used by the tracer. Planes have no
+ * bounds and go in a separate list that is always tested. Inserting
+ * into the module afterwards throws the structure away.
+ * @rmd: a ray module
+ * @return: void
+ */
+void RayModule_build(RayModule *rmd) {
+	RayElement *e;
+	RayElement **bounded;
+	BBox *boxes;
+	int n = 0, nPlanes = 0, i;
+
+	RayModule_unbuild(rmd);
+
+	for (e = rmd->head; e; e = e->next) {
+		n++;
+	}
+	bounded = malloc(sizeof(RayElement *) * (n > 0 ? n : 1));
+	boxes = malloc(sizeof(BBox) * (n > 0 ? n : 1));
+	rmd->plane = malloc(sizeof(RayElement *) * (n > 0 ? n : 1));
+
+	// sort the elements into bounded and unbounded
+	n = 0;
+	for (e = rmd->head; e; e = e->next) {
+		if (RayElement_bounds(e, &(boxes[n]))) {
+			bounded[n++] = e;
+		}
+		else {
+			rmd->plane[nPlanes++] = e;
+		}
+	}
+	rmd->nPlanes = nPlanes;
+
+	BBox_empty(&(rmd->box));
+	for (i=0; i<n; i++) {
+		BBox_union(&(rmd->box), &(rmd->box), &(boxes[i]));
+	}
+	rmd->nPrims = n;
+	rmd->prim = malloc(sizeof(RayElement *) * (n > 0 ? n : 1));
+	
+	if (rmd->accel == RayAccelBVH) {
+		// store the bounded elements in leaf order so leaves are contiguous
+		rmd->bvh = BVH_create(boxes, n);
+		for (i=0; i<n; i++) {
+			rmd->prim[i] = bounded[rmd->bvh->index[i]];
+		}
+	}
+	else {
+		rmd->grid = RayGrid_create(boxes, n,
+								rmd->accel == RayAccelTwoLevelGrid ? 2 : 1);
+		for (i=0; i<n; i++) {
+			rmd->prim[i] = bounded[i];
+		}
+	}
+	
+
+	// single precision copy of the spheres for the packet tracer
+	rmd->soa.n = n;
+	rmd->soa.cx = malloc(sizeof(float) * (n > 0 ? n : 1));
+	rmd->soa.cy = malloc(sizeof(float) * (n > 0 ? n : 1));
+	rmd->soa.cz = malloc(sizeof(float) * (n > 0 ? n : 1));
+	rmd->soa.r2 = malloc(sizeof(float) * (n > 0 ? n : 1));
+	for (i=0; i<n; i++) {
+		if (rmd->prim[i]->type == RayObjSphere) {
+			Sphere *sp = &(rmd->prim[i]->obj.sphere);
+			rmd->soa.cx[i] = sp->c.val[0];
+			rmd->soa.cy[i] = sp->c.val[1];
+			rmd->soa.cz[i] = sp->c.val[2];
+			rmd->soa.r2[i] = sp->r * sp->r;
+		}
+		else {
+			rmd->soa.cx[i] = rmd->soa.cy[i] = rmd->soa.cz[i] = 0.0;
+			rmd->soa.r2[i] = -1.0;
+		}
+	}
+
+	free(boxes);
+	free(bounded);
+	rmd->built = 1;
+}
+
+
+/*
+ * Frees the hierarchy or grid of a ray module, if it has one
+ * @rmd: a ray module
+ * @return: void
+ */
+void RayModule_unbuild(RayModule *rmd) {
+	BVH_delete(rmd->bvh);
+	RayGrid_delete(rmd->grid);
+	free(rmd->prim);
+	free(rmd->plane);
+	free(rmd->soa.cx);
+	free(rmd->soa.cy);
+	free(rmd->soa.cz);
+	free(rmd->soa.r2);
+	rmd->built = 0;
+	rmd->bvh = NULL;
+	rmd->grid = NULL;
+	rmd->prim = NULL;
+	rmd->nPrims = 0;
+	rmd->plane = NULL;
+	rmd->nPlanes = 0;
+	rmd->soa.cx = rmd->soa.cy = rmd->soa.cz = rmd->soa.r2 = NULL;
+	rmd->soa.n = 0;
+}
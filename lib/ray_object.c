@@ -1,7 +1,7 @@
 /* Dan Nelson
  * Graphics Package
  * ray_object.c
- * Plane and sphere functions for ray tracing
+ * Plane, sphere and mesh functions for ray tracing
  */
 
 
@@ -24,6 +24,9 @@ void Plane_set(Plane *pl, double A, double B, double C, double D) {
 	pl->p[1] = B/factor;
 	pl->p[2] = C/factor;
 	pl->p[3] = D/factor;
+	Color_set(&(pl->refraction), 0.0, 0.0, 0.0);
+	pl->isRefractive = 0;
+	pl->rIndex = 1.0;
 }
 
 
@@ -57,6 +60,7 @@ void Plane_setColor(Plane *p, Color diffuse, Color specular, int isReflective) {
 void Sphere_set(Sphere *s, Point c, float r) {
 	s->c = c;
 	s->r = r;
+	s->rIndex = 1.0;
 }
 
 
@@ -92,5 +96,183 @@ void Sphere_setRIndex(Sphere *s, float rIndex) {
 }
 
 
+// ######################
+// ### Mesh functions ###
+// ######################
+
+/*
+ * Initializes an unbuilt, black mesh around the given arrays without
+ * copying them
+ * @m: a mesh
+ * @return: void
+ */
+static void meshAdopt(Mesh *m, int nVertex, Point *vertex, Vector *normal,
+										int nTriangle, int *index) {
+	Color black = {{0.0, 0.0, 0.0}};
+
+	m->nVertex = nVertex;
+	m->vertex = vertex;
+	m->normal = normal;
+	m->nTriangle = nTriangle;
+	m->index = index;
+	m->tri = NULL;
+	m->bvh = NULL;
+	Mesh_setColor(m, black, black, black, 0, 0);
+	m->rIndex = 1.0;
+}
+
+
+/*
+ * Sets a mesh from a copy of the given vertex and index lists
+ * @m: a mesh
+ * @nVertex: number of vertices
+ * @vlist: the vertices
+ * @nlist: a normal for each vertex, or NULL for flat shading
+ * @nTriangle: number of triangles
+ * @ilist: three indices into vlist per triangle
+ * @return: void
+ */
+void Mesh_set(Mesh *m, int nVertex, Point *vlist, Vector *nlist,
+										int nTriangle, int *ilist) {
+	Point *vertex = malloc(sizeof(Point) * (nVertex > 0 ? nVertex : 1));
+	Vector *normal = NULL;
+	int *index = malloc(sizeof(int) * 3 * (nTriangle > 0 ? nTriangle : 1));
+
+	memcpy(vertex, vlist, sizeof(Point) * nVertex);
+	if (nlist != NULL) {
+		normal = malloc(sizeof(Vector) * (nVertex > 0 ? nVertex : 1));
+		memcpy(normal, nlist, sizeof(Vector) * nVertex);
+	}
+	memcpy(index, ilist, sizeof(int) * 3 * nTriangle);
+
+	meshAdopt(m, nVertex, vertex, normal, nTriangle, index);
+}
+
+
+/*
+ * Loads a mesh from an ascii PLY file
+ * @m: a mesh
+ * @filename: the file to read
+ * @return: 0 on success, -1 if the file could not be read
+ */
+int Mesh_readPLY(Mesh *m, char *filename) {
+	Point *vertex;
+	Vector *normal;
+	int *index;
+	int nVertex, nTriangle;
+
+	if (readPLYMesh(filename, &nVertex, &vertex, &normal,
+										&nTriangle, &index) < 0) {
+		meshAdopt(m, 0, NULL, NULL, 0, NULL);
+		return -1;
+	}
+	meshAdopt(m, nVertex, vertex, normal, nTriangle, index);
+	return 0;
+}
+
+
+/*
+ * Sets the color of a mesh
+ * @m: a mesh
+ * @diffuse: the diffuse color
+ * @specular: the specular color
+ * @refraction: the refraction color
+ * @isRefractive: boolean value
+ * @isReflective: boolean value
+ * @return: void
+ */
+void Mesh_setColor(Mesh *m, Color diffuse, Color specular, Color refraction,
+											int isRefractive, int isReflective) {
+	Color_copy(&(m->diffuse), &diffuse);
+	Color_copy(&(m->specular), &specular);
+	Color_copy(&(m->refraction), &refraction);
+	
+	m->isReflective = isReflective;
+	m->isRefractive = isRefractive;
+}
+
+
+/*
+ * Sets the index of refraction of a mesh
+ * @m: a mesh
+ * @rIndex: the index of refraction
+ * @return: void
+ */
+void Mesh_setRIndex(Mesh *m, float rIndex) {
+	m->rIndex = rIndex;
+}
 
 
+/*
+ * Builds the hierarchy over a mesh's triangles and precomputes their
+ * edges. The index list is reordered to match the hierarchy's leaves,
+ * so triangle i of the mesh is triangle i of tri.
+ * @m: a mesh
+ * @return: void
+ */
+void Mesh_build(Mesh *m) {
+	BBox *boxes;
+	int *index;
+	int i, j, k;
+
+	BVH_delete(m->bvh);
+	free(m->tri);
+
+	boxes = malloc(sizeof(BBox) * (m->nTriangle > 0 ? m->nTriangle : 1));
+	for (i=0; i<m->nTriangle; i++) {
+		BBox_empty(&(boxes[i]));
+		for (k=0; k<3; k++) {
+			Real *v = m->vertex[m->index[3*i+k]].val;
+			for (j=0; j<3; j++) {
+				boxes[i].min[j] = v[j] < boxes[i].min[j] ? v[j] : boxes[i].min[j];
+				boxes[i].max[j] = v[j] > boxes[i].max[j] ? v[j] : boxes[i].max[j];
+			}
+		}
+	}
+	m->bvh = BVH_create(boxes, m->nTriangle);
+	free(boxes);
+
+	// put the triangles in leaf order
+	index = malloc(sizeof(int) * 3 * (m->nTriangle > 0 ? m->nTriangle : 1));
+	for (i=0; i<m->nTriangle; i++) {
+		for (k=0; k<3; k++) {
+			index[3*i+k] = m->index[3*m->bvh->index[i]+k];
+		}
+		m->bvh->index[i] = i;
+	}
+	free(m->index);
+	m->index = index;
+
+	m->tri = malloc(sizeof(MeshTri) * (m->nTriangle > 0 ? m->nTriangle : 1));
+	for (i=0; i<m->nTriangle; i++) {
+		Real *v0 = m->vertex[index[3*i]].val;
+		Real *v1 = m->vertex[index[3*i+1]].val;
+		Real *v2 = m->vertex[index[3*i+2]].val;
+		for (j=0; j<3; j++) {
+			m->tri[i].v0[j] = v0[j];
+			m->tri[i].e1[j] = v1[j] - v0[j];
+			m->tri[i].e2[j] = v2[j] - v0[j];
+		}
+	}
+}
+
+
+/*
+ * Frees everything a mesh holds
+ * @m: a mesh
+ * @return: void
+ */
+void Mesh_clear(Mesh *m) {
+	free(m->vertex);
+	free(m->normal);
+	free(m->index);
+	free(m->tri);
+	BVH_delete(m->bvh);
+	m->vertex = NULL;
+	m->normal = NULL;
+	m->index = NULL;
+	m->tri = NULL;
+	m->bvh = NULL;
+	m->nVertex = 0;
+	m->nTriangle = 0;
+}
@@ -0,0 +1,338 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_packet.c
+ * Traces packets of coherent rays through a ray module's hierarchy,
+ * intersecting every lane with a sphere at once
+ */
+
+
+#include "cb_graphics.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Lane-wide operations. Each set works on RAY_PACKET_SIZE floats.
+#if defined(__AVX__)
+
+typedef __m256 vfloat;
+#define vload(p) _mm256_load_ps(p)
+#define vstore(p, a) _mm256_store_ps(p, a)
+#define vset1(x) _mm256_set1_ps(x)
+#define vadd(a, b) _mm256_add_ps(a, b)
+#define vsub(a, b) _mm256_sub_ps(a, b)
+#define vmul(a, b) _mm256_mul_ps(a, b)
+#define vmin(a, b) _mm256_min_ps(a, b)
+#define vmax(a, b) _mm256_max_ps(a, b)
+#define vsqrt(a) _mm256_sqrt_ps(a)
+#define vand(a, b) _mm256_and_ps(a, b)
+#define vandnot(a, b) _mm256_andnot_ps(a, b)
+#define vor(a, b) _mm256_or_ps(a, b)
+#define vlt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vle(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define vge(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define vgt(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define vmask(a) _mm256_movemask_ps(a)
+
+#elif defined(__SSE2__)
+
+typedef __m128 vfloat;
+#define vload(p) _mm_load_ps(p)
+#define vstore(p, a) _mm_store_ps(p, a)
+#define vset1(x) _mm_set1_ps(x)
+#define vadd(a, b) _mm_add_ps(a, b)
+#define vsub(a, b) _mm_sub_ps(a, b)
+#define vmul(a, b) _mm_mul_ps(a, b)
+#define vmin(a, b) _mm_min_ps(a, b)
+#define vmax(a, b) _mm_max_ps(a, b)
+#define vsqrt(a) _mm_sqrt_ps(a)
+#define vand(a, b) _mm_and_ps(a, b)
+#define vandnot(a, b) _mm_andnot_ps(a, b)
+#define vor(a, b) _mm_or_ps(a, b)
+#define vlt(a, b) _mm_cmplt_ps(a, b)
+#define vle(a, b) _mm_cmple_ps(a, b)
+#define vge(a, b) _mm_cmpge_ps(a, b)
+#define vgt(a, b) _mm_cmpgt_ps(a, b)
+#define vmask(a) _mm_movemask_ps(a)
+
+#endif
+
+// pick a where the mask is set, b elsewhere
+#define vselect(m, a, b) vor(vand(m, a), vandnot(m, b))
+
+
+// ########################
+// ### Packet Functions ###
+// ########################
+
+/*
+ * Loads up to RAY_PACKET_SIZE rays into a packet. Unused lanes are
+ * given a negative tmax so they never report a hit.
+ * @pk: the packet
+ * @rays: the rays, with normalized vectors
+ * @n: number of rays
+ * @return: void
+ */
+void RayPacket_set(RayPacket *pk, Ray *rays, int n) {
+	int i;
+
+	pk->n = n;
+	for (i=0; i<RAY_PACKET_SIZE; i++) {
+		Ray *r = &(rays[i < n ? i : 0]);
+		float d[3];
+		int j;
+
+		for (j=0; j<3; j++) {
+			d[j] = r->v.v[j];
+			// keep the slab test away from 0 * infinity
+			if (fabsf(d[j]) < 1e-20f) {
+				d[j] = d[j] < 0 ? -1e-20f : 1e-20f;
+			}
+		}
+		pk->ox[i] = r->p.val[0];
+		pk->oy[i] = r->p.val[1];
+		pk->oz[i] = r->p.val[2];
+		pk->dx[i] = r->v.v[0];
+		pk->dy[i] = r->v.v[1];
+		pk->dz[i] = r->v.v[2];
+		pk->ix[i] = 1.0f / d[0];
+		pk->iy[i] = 1.0f / d[1];
+		pk->iz[i] = 1.0f / d[2];
+		pk->tmax[i] = i < n ? 10e10f : -1.0f;
+		pk->best[i] = NULL;
+		if (i < n) {
+			Ray_copy(&(pk->ray[i]), r);
+		}
+	}
+}
+
+
+/*
+ * Tests one element against each lane in double precision. Used for
+ * elements that have no packet test.
+ * @pk: the packet
+ * @e: the element
+ * @return: void
+ */
+static void packetElement(RayPacket *pk, RayElement *e) {
+	double t;
+	int i;
+
+	for (i=0; i<pk->n; i++) {
+		t = Ray_intersect(&(pk->ray[i]), e, NULL);
+		if (t >= 0 && t < pk->tmax[i]) {
+			pk->tmax[i] = t;
+			pk->best[i] = e;
+		}
+	}
+}
+
+
+#if defined(__SSE2__)
+
+/*
+ * Tests whether any lane of the packet enters a box before its
+ * nearest hit
+ * @pk: the packet
+ * @b: the box
+ * @return: 1 if some lane enters the box, 0 if not
+ */
+static int packetBox(RayPacket *pk, BBox *b) {
+	vfloat t0, t1, tnear, tfar;
+
+	t0 = vmul(vsub(vset1((float)b->min[0]), vload(pk->ox)), vload(pk->ix));
+	t1 = vmul(vsub(vset1((float)b->max[0]), vload(pk->ox)), vload(pk->ix));
+	tnear = vmax(vmin(t0, t1), vset1(0.0f));
+	tfar = vmin(vmax(t0, t1), vload(pk->tmax));
+
+	t0 = vmul(vsub(vset1((float)b->min[1]), vload(pk->oy)), vload(pk->iy));
+	t1 = vmul(vsub(vset1((float)b->max[1]), vload(pk->oy)), vload(pk->iy));
+	tnear = vmax(vmin(t0, t1), tnear);
+	tfar = vmin(vmax(t0, t1), tfar);
+
+	t0 = vmul(vsub(vset1((float)b->min[2]), vload(pk->oz)), vload(pk->iz));
+	t1 = vmul(vsub(vset1((float)b->max[2]), vload(pk->oz)), vload(pk->iz));
+	tnear = vmax(vmin(t0, t1), tnear);
+	tfar = vmin(vmax(t0, t1), tfar);
+
+	return vmask(vle(tnear, tfar)) != 0;
+}
+
+
+/*
+ * Intersects every lane with one sphere, keeping the nearer hits.
+ * Follows the same steps as Ray_sphereIntersect.
+ * @pk: the packet
+ * @soa: the module's spheres
+ * @i: the sphere slot
+ * @e: the element in that slot
+ * @return: void
+ */
+static void packetSphere(RayPacket *pk, SphereSoA *soa, int i, RayElement *e) {
+	vfloat lx, ly, lz, px, py, pz, d2, tca, h2, r2, s, t, tmax;
+	vfloat outside, hit;
+	int mask, j;
+
+	Ray_stats()->tests[RayObjSphere] += pk->n;
+	r2 = vset1(soa->r2[i]);
+	lx = vsub(vset1(soa->cx[i]), vload(pk->ox));
+	ly = vsub(vset1(soa->cy[i]), vload(pk->oy));
+	lz = vsub(vset1(soa->cz[i]), vload(pk->oz));
+
+	d2 = vadd(vadd(vmul(lx, lx), vmul(ly, ly)), vmul(lz, lz));
+	tca = vadd(vadd(vmul(lx, vload(pk->dx)), vmul(ly, vload(pk->dy))),
+											vmul(lz, vload(pk->dz)));
+
+	// r^2 - d^2 + tca^2 cancels badly in float for small, distant spheres,
+	// so take the squared distance from the center to the ray directly
+	px = vsub(lx, vmul(tca, vload(pk->dx)));
+	py = vsub(ly, vmul(tca, vload(pk->dy)));
+	pz = vsub(lz, vmul(tca, vload(pk->dz)));
+	h2 = vsub(r2, vadd(vadd(vmul(px, px), vmul(py, py)), vmul(pz, pz)));
+
+	// outside and pointing away, or missing the sphere entirely
+	outside = vge(d2, r2);
+	hit = vandnot(vand(vlt(tca, vset1(0.0f)), outside), vge(h2, vset1(0.0f)));
+
+	// near root from outside, far root from inside
+	s = vsqrt(vmax(h2, vset1(0.0f)));
+	t = vselect(outside, vsub(tca, s), vadd(tca, s));
+
+	tmax = vload(pk->tmax);
+	hit = vand(hit, vand(vgt(t, vset1(0.0f)), vlt(t, tmax)));
+	mask = vmask(hit);
+	if (mask == 0) {
+		return;
+	}
+
+	vstore(pk->tmax, vselect(hit, t, tmax));
+	for (j=0; j<RAY_PACKET_SIZE; j++) {
+		if (mask & (1 << j)) {
+			pk->best[j] = e;
+		}
+	}
+}
+
+#else
+
+/*
+ * Tests whether any lane of the packet enters a box before its
+ * nearest hit
+ * @pk: the packet
+ * @b: the box
+ * @return: 1 if some lane enters the box, 0 if not
+ */
+static int packetBox(RayPacket *pk, BBox *b) {
+	Real org[3], inv[3];
+	int i;
+
+	for (i=0; i<pk->n; i++) {
+		org[0] = pk->ox[i];
+		org[1] = pk->oy[i];
+		org[2] = pk->oz[i];
+		inv[0] = pk->ix[i];
+		inv[1] = pk->iy[i];
+		inv[2] = pk->iz[i];
+		if (BBox_hit(b, org, inv, pk->tmax[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Intersects every lane with one sphere, keeping the nearer hits
+ * @pk: the packet
+ * @soa: the module's spheres
+ * @i: the sphere slot
+ * @e: the element in that slot
+ * @return: void
+ */
+static void packetSphere(RayPacket *pk, SphereSoA *soa, int i, RayElement *e) {
+	packetElement(pk, e);
+}
+
+#endif
+
+
+/*
+ * Finds the nearest hit for every ray in a packet. The packet walks
+ * the hierarchy as one, entering a node if any lane does, and spheres
+ * are tested against all lanes at once in single precision. The hit
+ * records are then filled in double precision for each lane, so the
+ * results match single ray tracing except where two surfaces are
+ * closer together than float precision can tell apart. A module built
+ * with a grid is traced one lane at a time.
+ * @pk: the packet, from RayPacket_set
+ * @rmd: a built ray module
+ * @hit: array of pk->n hit records
+ * @t: array of pk->n distances, negative where a lane missed
+ * @return: void
+ */
+void RayPacket_closestHit(RayPacket *pk, RayModule *rmd,
+										Intersection *hit, double *t) {
+	int stack[BVH_MAX_DEPTH];
+	int top = 0;
+	int i, n;
+	BVHNode *node;
+
+	// a grid is walked ray by ray
+	if (rmd->bvh == NULL) {
+		for (i=0; i<pk->n; i++) {
+			t[i] = Ray_closestHit(&(pk->ray[i]), rmd, &(hit[i]));
+		}
+		return;
+	}
+
+	// planes go lane by lane
+	for (i=0; i<rmd->nPlanes; i++) {
+		packetElement(pk, rmd->plane[i]);
+	}
+
+	if (rmd->bvh != NULL && rmd->bvh->nPrims > 0) {
+		stack[top++] = 0;
+	}
+	while (top > 0) {
+		n = stack[--top];
+		node = &(rmd->bvh->node[n]);
+		if (!packetBox(pk, &(node->box))) {
+			continue;
+		}
+		if (node->count > 0) {
+			for (i=node->start; i<node->start + node->count; i++) {
+				if (rmd->soa.r2[i] >= 0) {
+					packetSphere(pk, &(rmd->soa), i, rmd->prim[i]);
+				}
+				else {
+					packetElement(pk, rmd->prim[i]);
+				}
+			}
+		}
+		// the lanes are coherent, so the first lane picks the order
+		else if (pk->dx[0] * (node->axis == 0) + pk->dy[0] * (node->axis == 1)
+										+ pk->dz[0] * (node->axis == 2) < 0) {
+			stack[top++] = n + 1;
+			stack[top++] = node->right;
+		}
+		else {
+			stack[top++] = node->right;
+			stack[top++] = n + 1;
+		}
+	}
+
+	// exact hit records for the winners
+	for (i=0; i<pk->n; i++) {
+		t[i] = RAY_MISS;
+		if (pk->best[i] != NULL) {
+			t[i] = Ray_intersect(&(pk->ray[i]), pk->best[i], &(hit[i]));
+		}
+		// a grazing hit float and double disagree on; ask again
+		if (pk->best[i] != NULL && t[i] < 0) {
+			t[i] = Ray_closestHit(&(pk->ray[i]), rmd, &(hit[i]));
+		}
+	}
+}
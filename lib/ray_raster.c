@@ -0,0 +1,446 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_raster.c
+ * Finds what the primary rays of a camera hit by scan converting the
+ * scene into a G-buffer, so the ray tracer only has to follow the
+ * shadow, reflected and refracted rays
+ */
+
+
+#include "cb_graphics.h"
+
+
+// Slack in the barycentric coverage test. A pixel near an edge is
+// given to the triangle; if its ray then misses, RayGBuffer_hit falls
+// back to a full search, so too much coverage only costs time.
+#define RASTER_EDGE 1e-4
+
+// Nearest depth drawn, in front of which triangles are clipped
+#define RASTER_NEAR 1e-6
+
+
+// The camera as scan conversion sees it. A point with camera
+// coordinates (x, y, z), z along the view plane normal, falls on pixel
+// (ox + sx * x / z, oy + sy * y / z), the same pixel as the camera ray
+// through it.
+typedef struct {
+	RayCamera *cam;
+	double u[3], v[3], n[3]; 	// view right, view up and unit view plane normal
+	double sx, sy; 				// pixels per unit across at depth 1
+	double ox, oy; 				// pixel the view plane normal goes through
+} Projection;
+
+// A vertex in camera coordinates
+typedef struct {
+	double x, y, z;
+} CamPoint;
+
+
+// ########################
+// ### G-buffer Helpers ###
+// ########################
+
+/*
+ * Takes a world space point, placed by a transform, to camera coordinates
+ * @pr: the projection
+ * @p: the point
+ * @m: the transform, NULL for none
+ * @c: set to the camera coordinates
+ * @return: void
+ */
+static void toCamera(Projection *pr, Point *p, Matrix *m, CamPoint *c) {
+	Point w = *p;
+	double q[3];
+	int i;
+
+	if (m != NULL) {
+		Matrix_xformPoint(m, p, &w);
+		Point_normalize(&w);
+	}
+	for (i=0; i<3; i++) {
+		q[i] = w.val[i] - pr->cam->eye.val[i];
+	}
+	c->x = q[0]*pr->u[0] + q[1]*pr->u[1] + q[2]*pr->u[2];
+	c->y = q[0]*pr->v[0] + q[1]*pr->v[1] + q[2]*pr->v[2];
+	c->z = q[0]*pr->n[0] + q[1]*pr->n[1] + q[2]*pr->n[2];
+}
+
+
+/*
+ * Finds the pixel centers a triangle's corners span along one axis,
+ * clipped to a range of pixels
+ * @s: the corners' pixel coordinates along the axis
+ * @min: first pixel of the range
+ * @max: one past its last pixel
+ * @a, b: set to the first and last pixel spanned, a > b for none
+ * @return: void
+ */
+static void pixelSpan(double *s, int min, int max, int *a, int *b) {
+	double lo = s[0], hi = s[0];
+	int k;
+
+	for (k=1; k<3; k++) {
+		lo = s[k] < lo ? s[k] : lo;
+		hi = s[k] > hi ? s[k] : hi;
+	}
+	lo = lo > min ? (lo < max ? lo : max) : min;
+	hi = hi < max - 1 ? (hi > min - 1 ? hi : min - 1) : max - 1;
+	*a = (int)ceil(lo - 1e-3);
+	*b = (int)floor(hi + 1e-3);
+	*a = *a > min ? *a : min;
+	*b = *b < max - 1 ? *b : max - 1;
+}
+
+
+/*
+ * Scan converts a triangle lying in front of the eye into the buffer.
+ * Depth is interpolated as 1/z, which is linear across the screen.
+ * @gb: the G-buffer
+ * @pr: the projection
+ * @top: the element the triangle belongs to
+ * @c: the corners in camera coordinates
+ * @return: void
+ */
+static void fillTriangle(RayGBuffer *gb, Projection *pr, RayElement *top, CamPoint *c) {
+	RayCamera *cam = pr->cam;
+	double sx[3], sy[3], iz[3], area, w0, w1, w2, z;
+	int xa, xb, ya, yb, x, y, k, i;
+
+	for (k=0; k<3; k++) {
+		iz[k] = 1.0 / c[k].z;
+		sx[k] = pr->ox + pr->sx * c[k].x * iz[k];
+		sy[k] = pr->oy + pr->sy * c[k].y * iz[k];
+	}
+	area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+	if (area == 0) {
+		return;
+	}
+
+	// pixel centers inside the triangle's box and the crop window
+	pixelSpan(sx, cam->x0, cam->x1, &xa, &xb);
+	pixelSpan(sy, cam->y0, cam->y1, &ya, &yb);
+
+	gb->triangles++;
+	for (y=ya; y<=yb; y++) {
+		for (x=xa; x<=xb; x++) {
+			w0 = ((sx[2] - sx[1]) * (y - sy[1]) - (sy[2] - sy[1]) * (x - sx[1])) / area;
+			w1 = ((sx[0] - sx[2]) * (y - sy[2]) - (sy[0] - sy[2]) * (x - sx[2])) / area;
+			w2 = 1.0 - w0 - w1;
+			if (w0 < -RASTER_EDGE || w1 < -RASTER_EDGE || w2 < -RASTER_EDGE) {
+				continue;
+			}
+			z = 1.0 / (w0 * iz[0] + w1 * iz[1] + w2 * iz[2]);
+			i = y * gb->cols + x;
+			if (z < gb->depth[i]) {
+				gb->depth[i] = z;
+				gb->id[i] = top;
+			}
+		}
+	}
+}
+
+
+/*
+ * Clips a triangle to the near plane and scan converts what is left,
+ * one or two triangles
+ * @gb: the G-buffer
+ * @pr: the projection
+ * @top: the element the triangle belongs to
+ * @c: the corners in camera coordinates
+ * @return: void
+ */
+static void drawTriangle(RayGBuffer *gb, Projection *pr, RayElement *top, CamPoint *c) {
+	CamPoint poly[4], tri[3];
+	double f;
+	int n = 0, k, j;
+
+	for (k=0; k<3; k++) {
+		j = (k + 1) % 3;
+		if (c[k].z >= RASTER_NEAR) {
+			poly[n++] = c[k];
+		}
+		if ((c[k].z >= RASTER_NEAR) != (c[j].z >= RASTER_NEAR)) {
+			f = (RASTER_NEAR - c[k].z) / (c[j].z - c[k].z);
+			poly[n].x = c[k].x + f * (c[j].x - c[k].x);
+			poly[n].y = c[k].y + f * (c[j].y - c[k].y);
+			poly[n++].z = RASTER_NEAR;
+		}
+	}
+	for (k=1; k+1<n; k++) {
+		tri[0] = poly[0];
+		tri[1] = poly[k];
+		tri[2] = poly[k+1];
+		fillTriangle(gb, pr, top, tri);
+	}
+}
+
+
+/*
+ * Scan converts every triangle of a mesh, placed by a transform
+ * @gb: the G-buffer
+ * @pr: the projection
+ * @top: the top level element the mesh belongs to
+ * @mesh: the mesh
+ * @m: the transform, NULL for none
+ * @return: void
+ */
+static void drawMesh(RayGBuffer *gb, Projection *pr, RayElement *top, Mesh *mesh,
+																Matrix *m) {
+	CamPoint *cv = malloc(sizeof(CamPoint) * (mesh->nVertex > 0 ? mesh->nVertex : 1));
+	CamPoint c[3];
+	int i, k;
+
+	for (i=0; i<mesh->nVertex; i++) {
+		toCamera(pr, &(mesh->vertex[i]), m, &(cv[i]));
+	}
+	for (i=0; i<mesh->nTriangle; i++) {
+		for (k=0; k<3; k++) {
+			c[k] = cv[mesh->index[3*i + k]];
+		}
+		drawTriangle(gb, pr, top, c);
+	}
+	free(cv);
+}
+
+
+/*
+ * Tests whether a module holds nothing but meshes, directly or
+ * through instances, so all of it can be scan converted
+ * @rmd: the module
+ * @return: 1 if it does, 0 if not
+ */
+static int meshOnly(RayModule *rmd) {
+	RayElement *e;
+
+	for (e = rmd->head; e; e = e->next) {
+		if (e->type == RayObjInstance) {
+			if (!meshOnly(e->obj.instance.module)) {
+				return 0;
+			}
+		}
+		else if (e->type != RayObjMesh) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * Scan converts the meshes of a module, placed by a transform
+ * @gb: the G-buffer
+ * @pr: the projection
+ * @top: the top level element the module is under
+ * @rmd: the module, holding only meshes
+ * @m: the transform, NULL for none
+ * @return: void
+ */
+static void drawModule(RayGBuffer *gb, Projection *pr, RayElement *top, RayModule *rmd,
+																Matrix *m) {
+	RayElement *e;
+	Matrix sub;
+
+	for (e = rmd->head; e; e = e->next) {
+		if (e->type == RayObjMesh) {
+			drawMesh(gb, pr, top, &(e->obj.mesh), m);
+		}
+		else {
+			if (m != NULL) {
+				Matrix_multiply(m, &(e->obj.instance.m), &sub);
+			}
+			else {
+				sub = e->obj.instance.m;
+			}
+			drawModule(gb, pr, top, e->obj.instance.module, &sub);
+		}
+	}
+}
+
+
+/*
+ * Draws an element that cannot be scan converted by testing the camera
+ * ray of every pixel its bounds cover, the whole crop window for an
+ * unbounded element or one that reaches behind the eye
+ * @gb: the G-buffer
+ * @pr: the projection
+ * @e: the element
+ * @return: void
+ */
+static void drawTested(RayGBuffer *gb, Projection *pr, RayElement *e) {
+	RayCamera *cam = pr->cam;
+	int xa = cam->x0, xb = cam->x1 - 1, ya = cam->y0, yb = cam->y1 - 1;
+	int x, y, k, i;
+	double lo[2], hi[2], px, py, t, z;
+	CamPoint c;
+	Point corner;
+	BBox box;
+	Ray ray;
+
+	if (RayElement_bounds(e, &box)) {
+		lo[0] = lo[1] = HUGE_VAL;
+		hi[0] = hi[1] = -HUGE_VAL;
+		for (k=0; k<8; k++) {
+			Point_set(&corner, k & 1 ? box.max[0] : box.min[0],
+								k & 2 ? box.max[1] : box.min[1],
+								k & 4 ? box.max[2] : box.min[2]);
+			toCamera(pr, &corner, NULL, &c);
+			if (c.z < RASTER_NEAR) {
+				break;
+			}
+			px = pr->ox + pr->sx * c.x / c.z;
+			py = pr->oy + pr->sy * c.y / c.z;
+			lo[0] = px < lo[0] ? px : lo[0];
+			hi[0] = px > hi[0] ? px : hi[0];
+			lo[1] = py < lo[1] ? py : lo[1];
+			hi[1] = py > hi[1] ? py : hi[1];
+		}
+		if (k == 8) {
+			if (hi[0] < cam->x0 - 1 || lo[0] > cam->x1 || hi[1] < cam->y0 - 1
+															|| lo[1] > cam->y1) {
+				return;
+			}
+			xa = lo[0] > cam->x0 ? (int)floor(lo[0]) : cam->x0;
+			xb = hi[0] < cam->x1 - 1 ? (int)ceil(hi[0]) : cam->x1 - 1;
+			ya = lo[1] > cam->y0 ? (int)floor(lo[1]) : cam->y0;
+			yb = hi[1] < cam->y1 - 1 ? (int)ceil(hi[1]) : cam->y1 - 1;
+		}
+	}
+
+	for (y=ya; y<=yb; y++) {
+		for (x=xa; x<=xb; x++) {
+			RayCamera_pixelRay(cam, x, y, &ray);
+			gb->tested++;
+			t = Ray_intersect(&ray, e, NULL);
+			if (t < 0) {
+				continue;
+			}
+			z = t * (ray.v.v[0]*pr->n[0] + ray.v.v[1]*pr->n[1] + ray.v.v[2]*pr->n[2]);
+			i = y * gb->cols + x;
+			if (z < gb->depth[i]) {
+				gb->depth[i] = z;
+				gb->id[i] = e;
+			}
+		}
+	}
+}
+
+
+// ##########################
+// ### G-buffer Functions ###
+// ##########################
+
+/*
+ * Sets up an empty G-buffer
+ * @gb: the G-buffer
+ * @return: void
+ */
+void RayGBuffer_init(RayGBuffer *gb) {
+	gb->rows = 0;
+	gb->cols = 0;
+	gb->module = NULL;
+	gb->id = NULL;
+	gb->depth = NULL;
+	gb->triangles = 0;
+	gb->tested = 0;
+}
+
+
+/*
+ * Frees a G-buffer's pixels
+ * @gb: the G-buffer
+ * @return: void
+ */
+void RayGBuffer_clear(RayGBuffer *gb) {
+	free(gb->id);
+	free(gb->depth);
+	RayGBuffer_init(gb);
+}
+
+
+/*
+ * Finds the element each camera ray in the crop window hits first.
+ * Meshes, and instances holding only meshes, are scan converted with a
+ * depth buffer; spheres, planes and other instances have the camera
+ * ray of each pixel they may cover tested against them. The element
+ * left in a pixel is the top level element of rmd, so a hit inside an
+ * instance is named by the instance.
+ * @gb: the G-buffer, resized to the camera if need be
+ * @rmd: the scene's module, built
+ * @cam: the camera
+ * @return: void
+ */
+void RayGBuffer_draw(RayGBuffer *gb, RayModule *rmd, RayCamera *cam) {
+	Projection pr;
+	RayElement *e;
+	double len;
+	int i;
+
+	if (gb->rows != cam->rows || gb->cols != cam->cols) {
+		free(gb->id);
+		free(gb->depth);
+		gb->rows = cam->rows;
+		gb->cols = cam->cols;
+		i = gb->rows * gb->cols > 0 ? gb->rows * gb->cols : 1;
+		gb->id = malloc(sizeof(RayElement *) * i);
+		gb->depth = malloc(sizeof(double) * i);
+	}
+	for (i=0; i<gb->rows * gb->cols; i++) {
+		gb->id[i] = NULL;
+		gb->depth[i] = HUGE_VAL;
+	}
+	gb->module = rmd;
+	gb->triangles = 0;
+	gb->tested = 0;
+
+	// the camera ray through pixel x leaves the eye along
+	// d * vpn + du * ((x + 0.5) / cols - 0.5) * u, and likewise for y
+	len = sqrt(Vector_dot(&(cam->vpn), &(cam->vpn)));
+	for (i=0; i<3; i++) {
+		pr.u[i] = cam->u.v[i];
+		pr.v[i] = cam->v.v[i];
+		pr.n[i] = cam->vpn.v[i] / len;
+	}
+	pr.cam = cam;
+	pr.sx = cam->view.d * len * cam->cols / cam->view.du;
+	pr.sy = cam->view.d * len * cam->rows / cam->view.dv;
+	pr.ox = cam->cols / 2.0 - 0.5;
+	pr.oy = cam->rows / 2.0 - 0.5;
+
+	for (e = rmd->head; e; e = e->next) {
+		if (e->type == RayObjMesh) {
+			drawMesh(gb, &pr, e, &(e->obj.mesh), NULL);
+		}
+		else if (e->type == RayObjInstance && meshOnly(e->obj.instance.module)) {
+			drawModule(gb, &pr, e, e->obj.instance.module, &(e->obj.instance.m));
+		}
+		else {
+			drawTested(gb, &pr, e);
+		}
+	}
+}
+
+
+/*
+ * Finds where the camera ray of a pixel hits, from the G-buffer: the
+ * ray is intersected with the one element drawn there. When that
+ * misses, as it may for a pixel right on an edge, the whole scene is
+ * searched.
+ * @gb: the G-buffer, drawn
+ * @x, y: the pixel
+ * @ray: the pixel's camera ray
+ * @hit: set to where it hits
+ * @return: the distance along the ray, RAY_MISS if it hits nothing
+ */
+double RayGBuffer_hit(RayGBuffer *gb, int x, int y, Ray *ray, Intersection *hit) {
+	RayElement *e = gb->id[y * gb->cols + x];
+	double t;
+
+	if (e == NULL) {
+		return RAY_MISS;
+	}
+	t = Ray_intersect(ray, e, hit);
+	if (t < 0) {
+		t = Ray_closestHit(ray, gb->module, hit);
+	}
+	return t;
+}
@@ -0,0 +1,1708 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_render.c
+ * Splits an image into tiles and ray traces them on a pool of threads,
+ * or of forked processes
+ */
+
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "cb_graphics.h"
+
+
+// A range of tiles owned by one worker. The owner takes tiles from
+// the head, idle workers steal them from the tail.
+typedef struct {
+	pthread_mutex_t lock;
+	int head;
+	int tail;
+} TileQueue;
+
+// Everything the workers share while rendering one image
+typedef struct {
+	RayRender *rr;
+	RayScene *scene;
+	Image *src;
+	RayCamera *cam;
+	RayGBuffer *gbuf; 		// what the primary rays hit, NULL to trace them
+	int step; 				// pixel spacing of a progressive pass, 0 for a full render
+	int coarsest; 			// spacing of the first pass, which has no samples to skip
+	double deadline; 		// stamp() after which no more tiles are started, 0 for none
+	int skipped; 			// tiles left untraced when the render stopped
+	RayCheckpoint *ck; 		// where finished tiles are saved, NULL for nowhere
+	pthread_mutex_t ckLock; 	// one worker at a time marks a tile in it
+	int tilesX, tilesY;
+	int *tiles; 			// tiles to trace, by index in scanline order
+	int nQueues;
+	TileQueue *queue; 		// ranges of positions in tiles
+} RenderJob;
+
+// Worker thread argument
+typedef struct {
+	RenderJob *job;
+	int id;
+	RayThread th; 			// the worker's tracing state
+	long samples; 			// primary rays traced by this worker
+	RayStats stats; 		// counters from this worker's tiles
+	int *order; 			// cells of the tile in traversal order
+	int *pixel; 			// pixels in the order they were traced, as y * width + x
+	int *rank; 				// order the traced pixels are shaded in
+	Ray *ray; 				// a tile's primary rays, by pixel
+	Intersection *hit; 		// and where they hit
+	double *t; 				// distance to each hit, negative on a miss
+	RayWave wave; 			// queues for tracing a tile a wave at a time
+} RenderWorker;
+
+// What a worker process reports back, kept in memory shared with the
+// process that forked it
+typedef struct {
+	long samples; 			// primary rays traced by the process
+	RayStats stats; 		// counters from the process's tiles
+} ProcessSlot;
+
+// The coordinator's record of one worker process
+typedef struct {
+	pid_t pid; 				// 0 once the worker has been told to stop
+	int cmd; 				// pipe the worker reads tile positions from
+	int res; 				// pipe it writes finished positions back on
+	int busy; 				// position of the tile it is tracing, -1 if idle
+} RenderProcess;
+
+
+// ######################
+// ### Render Helpers ###
+// ######################
+
+/*
+ * Reads a clock for timing the stages of a render
+ * @return: milliseconds from some fixed point
+ */
+static double stamp(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+/*
+ * Finds cell d along a Hilbert curve over an n by n grid
+ * @n: grid size, a power of two
+ * @d: distance along the curve
+ * @x, y: set to the cell
+ * @return: void
+ */
+static void hilbertCell(int n, int d, int *x, int *y) {
+	int rx, ry, s, tmp;
+
+	*x = *y = 0;
+	for (s=1; s<n; s*=2) {
+		rx = 1 & (d / 2);
+		ry = 1 & (d ^ rx);
+		// rotate the quadrant so the sub-curves join up
+		if (ry == 0) {
+			if (rx == 1) {
+				*x = s-1 - *x;
+				*y = s-1 - *y;
+			}
+			tmp = *x;
+			*x = *y;
+			*y = tmp;
+		}
+		*x += s * rx;
+		*y += s * ry;
+		d /= 4;
+	}
+}
+
+
+/*
+ * Lists the cells of a w by h grid in the given order. The curves are
+ * laid over the smallest power of two square that covers the grid and
+ * the cells outside it are skipped.
+ * @order: the traversal order
+ * @w, h: grid size
+ * @cell: filled with y * w + x for each cell in turn
+ * @return: the number of cells, w * h
+ */
+static int tileCells(RayOrder order, int w, int h, int *cell) {
+	int n = 0, side = 1;
+	int d, x, y, b;
+
+	if (order == RayOrderScanline) {
+		for (d=0; d<w*h; d++) {
+			cell[d] = d;
+		}
+		return w*h;
+	}
+
+	while (side < w || side < h) {
+		side *= 2;
+	}
+	for (d=0; d<side*side; d++) {
+		if (order == RayOrderHilbert) {
+			hilbertCell(side, d, &x, &y);
+		}
+		else {
+			// Morton: x takes the even bits of d, y the odd ones
+			x = y = 0;
+			for (b=0; (1 << 2*b) < side*side; b++) {
+				x |= ((d >> 2*b) & 1) << b;
+				y |= ((d >> (2*b+1)) & 1) << b;
+			}
+		}
+		if (x < w && y < h) {
+			cell[n++] = y * w + x;
+		}
+	}
+	return n;
+}
+
+
+/*
+ * Scrambles a pixel and sample number into 32 random looking bits, so
+ * the sample pattern is the same whichever thread traces the pixel
+ * @x: pixel column
+ * @y: pixel row
+ * @s: sample number within the pixel
+ * @return: the hash
+ */
+static unsigned int sampleHash(unsigned int x, unsigned int y, unsigned int s) {
+	unsigned int h = (x * 73856093u) ^ (y * 19349663u) ^ (s * 83492791u);
+
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+
+/*
+ * Traces one jittered sample in each cell of an n by n grid over a
+ * pixel, adding the colors to sum and widening lo and hi to cover them
+ * @w: the worker
+ * @x: pixel column
+ * @y: pixel row from the bottom
+ * @n: cells per side
+ * @first: sample number of the first cell, to vary the jitter
+ * @sum: running total of the colors
+ * @lo: smallest value seen in each channel, clamped to [0, 1]
+ * @hi: largest value seen in each channel, clamped to [0, 1]
+ * @return: void
+ */
+static void sampleGrid(RenderWorker *w, int x, int y, int n, int first,
+										Color *sum, Color *lo, Color *hi) {
+	RenderJob *job = w->job;
+	unsigned int h;
+	double fx, fy;
+	Ray ray;
+	Color c;
+	int i, j, k;
+
+	for (j=0; j<n; j++) {
+		for (i=0; i<n; i++) {
+			h = sampleHash(x, y, first + j*n + i);
+			fx = x + (i + (h & 0xffff) / 65536.0) / n;
+			fy = y + (j + (h >> 16) / 65536.0) / n;
+			RayCamera_ray(job->cam, fx, fy, &ray);
+			c = Ray_trace(job->scene, &(w->th), &ray, job->rr->depth,
+											job->cam->eye, job->cam->vrp);
+			Color_sum(sum, &c, sum);
+
+			for (k=0; k<3; k++) {
+				float v = c.c[k] < 0 ? 0 : (c.c[k] > 1 ? 1 : c.c[k]);
+				lo->c[k] = v < lo->c[k] ? v : lo->c[k];
+				hi->c[k] = v > hi->c[k] ? v : hi->c[k];
+			}
+		}
+	}
+	w->samples += n*n;
+	Ray_stats()->rays[RayPrimary] += n*n;
+}
+
+
+/*
+ * Traces every pixel in a tile with adaptive supersampling. Each pixel
+ * gets aa by aa stratified samples; only if they differ by more than
+ * aaThreshold in some channel is it sampled again on a finer aaMax by
+ * aaMax grid. Flat areas cost aa squared rays a pixel, edges more.
+ * @w: the worker
+ * @x0, y0: lower left pixel of the tile
+ * @x1, y1: one past the upper right pixel
+ * @return: void
+ */
+static void renderAdaptive(RenderWorker *w, int x0, int y0, int x1, int y1) {
+	RenderJob *job = w->job;
+	RayRender *rr = job->rr;
+	Color sum, lo, hi;
+	int x, y, i, k, n, count;
+
+	n = tileCells(rr->order, x1 - x0, y1 - y0, w->order);
+	for (i=0; i<n; i++) {
+		x = x0 + w->order[i] % (x1 - x0);
+		y = y0 + w->order[i] / (x1 - x0);
+		Color_set(&sum, 0.0, 0.0, 0.0);
+		Color_set(&lo, 1.0, 1.0, 1.0);
+		Color_set(&hi, 0.0, 0.0, 0.0);
+		sampleGrid(w, x, y, rr->aa, 0, &sum, &lo, &hi);
+		count = rr->aa * rr->aa;
+
+		if (rr->aaMax > rr->aa && (hi.c[0] - lo.c[0] > rr->aaThreshold
+								|| hi.c[1] - lo.c[1] > rr->aaThreshold
+								|| hi.c[2] - lo.c[2] > rr->aaThreshold)) {
+			sampleGrid(w, x, y, rr->aaMax, count, &sum, &lo, &hi);
+			count += rr->aaMax * rr->aaMax;
+		}
+
+		for (k=0; k<3; k++) {
+			sum.c[k] /= count;
+		}
+		Image_setColor(job->src, job->cam->rows-1-y, x, sum);
+	}
+}
+
+
+/*
+ * Shades the n primary hits a worker has gathered for a tile and
+ * writes the colors to the image. With sortSecondary set the hits are
+ * first grouped by the octant of their reflected direction, keeping
+ * the traversal order within each group, so the reflected rays that
+ * follow one another head the same way through the scene.
+ * @w: the worker, holding the tile's rays, hits and pixels
+ * @x0, y0: lower left pixel of the tile
+ * @width: tile width
+ * @n: number of pixels traced
+ * @return: void
+ */
+static void shadeTile(RenderWorker *w, int x0, int y0, int width, int n) {
+	RenderJob *job = w->job;
+	int count[10];
+	int *key = w->order;
+	int i, j, k, p;
+	Color c;
+
+	if (job->rr->sortSecondary) {
+		// octants 0-7 for mirrors, 8 for everything else, then a counting sort
+		for (k=0; k<10; k++) {
+			count[k] = 0;
+		}
+		for (i=0; i<n; i++) {
+			p = w->pixel[i];
+			key[i] = 8;
+			if (w->t[p] >= 0 && RayElement_isReflective(w->hit[p].e) == 1) {
+				Real *d = w->ray[p].v.v;
+				Real *nor = w->hit[p].nor.v;
+				double dn = 2.0 * (d[0]*nor[0] + d[1]*nor[1] + d[2]*nor[2]);
+
+				key[i] = (d[0] - dn*nor[0] < 0) | (d[1] - dn*nor[1] < 0) << 1
+												| (d[2] - dn*nor[2] < 0) << 2;
+			}
+			count[key[i] + 1]++;
+		}
+		for (k=0; k<9; k++) {
+			count[k+1] += count[k];
+		}
+		for (i=0; i<n; i++) {
+			w->rank[count[key[i]]++] = i;
+		}
+	}
+	else {
+		for (i=0; i<n; i++) {
+			w->rank[i] = i;
+		}
+	}
+
+	for (j=0; j<n; j++) {
+		p = w->pixel[w->rank[j]];
+		Color_set(&c, 0.0, 0.0, 0.0);
+		if (w->t[p] >= 0) {
+			c = Ray_shade(job->scene, &(w->th), &(w->ray[p]), &(w->hit[p]),
+							job->rr->depth, job->cam->eye, job->cam->vrp);
+		}
+		Image_setColor(job->src, job->cam->rows-1-(y0 + p / width), x0 + p % width, c);
+	}
+}
+
+
+/*
+ * Tells whether the job's pass traces a pixel. A progressive pass takes
+ * the pixels on a grid with its spacing that the coarser passes have
+ * not traced yet; a full render takes them all.
+ * @job: the render job
+ * @dx, dy: the pixel's place in its tile
+ * @return: 1 if the pass traces it, 0 if not
+ */
+static int onPass(RenderJob *job, int dx, int dy) {
+	int s = job->step;
+	int skip = s < job->coarsest ? 2 * s : 0;
+
+	if (s <= 0) {
+		return 1;
+	}
+	if (dx % s != 0 || dy % s != 0) {
+		return 0;
+	}
+	return skip == 0 || dx % skip != 0 || dy % skip != 0;
+}
+
+
+/*
+ * Lists the pixels of a tile the job's pass traces, in the render's
+ * pixel order
+ * @job: the render job
+ * @w, h: tile size
+ * @cell: filled with y * w + x for each pixel in turn
+ * @return: the number of pixels
+ */
+static int passCells(RenderJob *job, int w, int h, int *cell) {
+	int n = tileCells(job->rr->order, w, h, cell);
+	int i, m;
+
+	if (job->step <= 0) {
+		return n;
+	}
+	for (i=0, m=0; i<n; i++) {
+		if (onPass(job, cell[i] % w, cell[i] / w)) {
+			cell[m++] = cell[i];
+		}
+	}
+	return m;
+}
+
+
+/*
+ * Traces every pixel in a tile one ray at a time, in the render's
+ * pixel order, then shades the hits
+ * @w: the worker
+ * @x0, y0: lower left pixel of the tile
+ * @x1, y1: one past the upper right pixel
+ * @return: void
+ */
+static void renderRays(RenderWorker *w, int x0, int y0, int x1, int y1) {
+	RenderJob *job = w->job;
+	RayStats *st = Ray_stats();
+	double start = stamp(), now;
+	int i, p, n;
+
+	RayCamera_tile(job->cam, x0, y0, x1, y1, w->ray);
+	now = stamp();
+	st->ms[RayStageCamera] += now - start;
+	start = now;
+
+	n = passCells(job, x1 - x0, y1 - y0, w->pixel);
+	for (i=0; i<n; i++) {
+		p = w->pixel[i];
+		w->t[p] = RAY_MISS;
+		if (job->rr->depth > 0) {
+			w->t[p] = Ray_closestHit(&(w->ray[p]), job->scene->module, &(w->hit[p]));
+			st->hits += w->t[p] >= 0;
+			if (w->th.footSpace != NULL) {
+				RayFootprint_ray(&(w->th.foot), w->th.footSpace, &(w->ray[p]), w->t[p]);
+			}
+		}
+	}
+	w->samples += n;
+	st->rays[RayPrimary] += n;
+	now = stamp();
+	st->ms[RayStagePrimary] += now - start;
+	start = now;
+
+	shadeTile(w, x0, y0, x1 - x0, n);
+	st->ms[RayStageShade] += stamp() - start;
+}
+
+
+/*
+ * Traces a tile in small blocks of pixels, one packet per block, taking
+ * the blocks in the render's pixel order. Only the primary rays travel
+ * as a packet; each lane is shaded, and its shadow and reflected rays
+ * traced, on its own.
+ * @w: the worker
+ * @x0, y0: lower left pixel of the tile
+ * @x1, y1: one past the upper right pixel
+ * @return: void
+ */
+static void renderPackets(RenderWorker *w, int x0, int y0, int x1, int y1) {
+	RenderJob *job = w->job;
+	RayStats *st = Ray_stats();
+	RayPacket pk;
+	Ray ray[RAY_PACKET_SIZE];
+	Intersection hit[RAY_PACKET_SIZE];
+	double t[RAY_PACKET_SIZE];
+	double start = stamp(), now;
+	int width = x1 - x0;
+	int bw = RAY_PACKET_SIZE / 2;
+	int blocksX = (width + bw - 1) / bw;
+	int blocksY = (y1 - y0 + 1) / 2;
+	int bx, by, x, y, b, i, p, nBlocks, first, n;
+
+	RayCamera_tile(job->cam, x0, y0, x1, y1, w->ray);
+	now = stamp();
+	st->ms[RayStageCamera] += now - start;
+	start = now;
+
+	nBlocks = tileCells(job->rr->order, blocksX, blocksY, w->order);
+	n = 0;
+	for (b=0; b<nBlocks; b++) {
+		bx = x0 + (w->order[b] % blocksX) * bw;
+		by = y0 + (w->order[b] / blocksX) * 2;
+
+		// gather the block, clipped to the tile
+		first = n;
+		for (y=by; y<by+2 && y<y1; y++) {
+			for (x=bx; x<bx+bw && x<x1; x++) {
+				if (!onPass(job, x - x0, y - y0)) {
+					continue;
+				}
+				p = (y - y0) * width + (x - x0);
+				ray[n - first] = w->ray[p];
+				w->pixel[n++] = p;
+			}
+		}
+		if (n == first) {
+			continue;
+		}
+
+		RayPacket_set(&pk, ray, n - first);
+		RayPacket_closestHit(&pk, job->scene->module, hit, t);
+		for (i=0; i<n-first; i++) {
+			p = w->pixel[first + i];
+			w->hit[p] = hit[i];
+			w->t[p] = job->rr->depth > 0 ? t[i] : RAY_MISS;
+			st->hits += w->t[p] >= 0;
+			if (w->th.footSpace != NULL && job->rr->depth > 0) {
+				RayFootprint_ray(&(w->th.foot), w->th.footSpace, &(w->ray[p]), w->t[p]);
+			}
+		}
+	}
+	w->samples += n;
+	st->rays[RayPrimary] += n;
+	now = stamp();
+	st->ms[RayStagePrimary] += now - start;
+	start = now;
+
+	shadeTile(w, x0, y0, width, n);
+	st->ms[RayStageShade] += stamp() - start;
+}
+
+
+/*
+ * Takes the primary hits of a tile from the job's G-buffer, so only the
+ * shadow and secondary rays are traced, then shades them
+ * @w: the worker
+ * @x0, y0: lower left pixel of the tile
+ * @x1, y1: one past the upper right pixel
+ * @return: void
+ */
+static void renderRaster(RenderWorker *w, int x0, int y0, int x1, int y1) {
+	RenderJob *job = w->job;
+	RayStats *st = Ray_stats();
+	double start = stamp(), now;
+	int width = x1 - x0;
+	int i, p, n;
+
+	RayCamera_tile(job->cam, x0, y0, x1, y1, w->ray);
+	now = stamp();
+	st->ms[RayStageCamera] += now - start;
+	start = now;
+
+	n = passCells(job, width, y1 - y0, w->pixel);
+	for (i=0; i<n; i++) {
+		p = w->pixel[i];
+		w->t[p] = RayGBuffer_hit(job->gbuf, x0 + p % width, y0 + p / width,
+											&(w->ray[p]), &(w->hit[p]));
+		st->hits += w->t[p] >= 0;
+		if (w->th.footSpace != NULL) {
+			RayFootprint_ray(&(w->th.foot), w->th.footSpace, &(w->ray[p]), w->t[p]);
+		}
+	}
+	w->samples += n;
+	st->rays[RayPrimary] += n;
+	now = stamp();
+	st->ms[RayStagePrimary] += now - start;
+	start = now;
+
+	shadeTile(w, x0, y0, width, n);
+	st->ms[RayStageShade] += stamp() - start;
+}
+
+
+/*
+ * Traces a tile as a wavefront: all of its primary rays are found, then
+ * each wave of hits is lit, its shadow rays traced and the reflected
+ * and refracted rays it spawns found as the next wave, until no path is
+ * left. The primary hits come from the G-buffer when there is one.
+ * @w: the worker
+ * @x0, y0: lower left pixel of the tile
+ * @x1, y1: one past the upper right pixel
+ * @return: void
+ */
+static void renderWave(RenderWorker *w, int x0, int y0, int x1, int y1) {
+	RenderJob *job = w->job;
+	RayWave *wv = &(w->wave);
+	RayStats *st = Ray_stats();
+	double start = stamp(), now;
+	int width = x1 - x0;
+	int i, p, n;
+
+	RayCamera_tile(job->cam, x0, y0, x1, y1, w->ray);
+	now = stamp();
+	st->ms[RayStageCamera] += now - start;
+	start = now;
+
+	n = passCells(job, width, y1 - y0, w->pixel);
+	RayWave_start(wv, w->ray, w->pixel, n);
+	w->samples += n;
+	st->rays[RayPrimary] += n;
+	if (job->rr->depth > 0) {
+		if (job->gbuf != NULL) {
+			for (i=0; i<n; i++) {
+				p = w->pixel[i];
+				wv->t[i] = RayGBuffer_hit(job->gbuf, x0 + p % width, y0 + p / width,
+										&(wv->ray[i].ray), &(wv->hit[i]));
+				st->hits += wv->t[i] >= 0;
+				if (w->th.footSpace != NULL) {
+					RayFootprint_ray(&(w->th.foot), w->th.footSpace,
+												&(wv->ray[i].ray), wv->t[i]);
+				}
+			}
+		}
+		else {
+			RayWave_intersect(wv, job->scene, &(w->th));
+		}
+		now = stamp();
+		st->ms[RayStagePrimary] += now - start;
+		start = now;
+
+		for (;;) {
+			RayWave_shade(wv, job->scene, &(w->th), job->cam->vrp);
+			RayWave_shadow(wv, job->scene, &(w->th), job->cam->vrp);
+			if (RayWave_spawn(wv, job->scene, job->rr->depth) == 0) {
+				break;
+			}
+			RayWave_intersect(wv, job->scene, &(w->th));
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		p = w->pixel[i];
+		Image_setColor(job->src, job->cam->rows-1-(y0 + p / width), x0 + p % width,
+															wv->color[p]);
+	}
+	st->ms[RayStageShade] += stamp() - start;
+}
+
+
+/*
+ * Fills in a tile after a progressive pass: each pixel off the pass's
+ * grid takes the color of the grid pixel at the lower left corner of
+ * its cell, so the tile is whole after every pass
+ * @w: the worker
+ * @x0, y0: lower left pixel of the tile
+ * @x1, y1: one past the upper right pixel
+ * @return: void
+ */
+static void fillPass(RenderWorker *w, int x0, int y0, int x1, int y1) {
+	RenderJob *job = w->job;
+	int s = job->step;
+	int rows = job->cam->rows;
+	int x, y, ax, ay;
+
+	for (y=y0; y<y1; y++) {
+		for (x=x0; x<x1; x++) {
+			ax = x - (x - x0) % s;
+			ay = y - (y - y0) % s;
+			if (ax != x || ay != y) {
+				Image_setColor(job->src, rows-1-y, x,
+									Image_getColor(job->src, rows-1-ay, ax));
+			}
+		}
+	}
+}
+
+
+/*
+ * Traces the pixels of a tile the job's pass takes, in the render's
+ * mode, and writes the colors to the image
+ * @w: the worker
+ * @tile: the tile index, in scanline order
+ * @return: void
+ */
+static void renderTile(RenderWorker *w, int tile) {
+	RenderJob *job = w->job;
+	int size = job->rr->tileSize;
+	int x0 = (tile % job->tilesX) * size;
+	int y0 = (tile / job->tilesX) * size;
+	int x1 = x0 + size < job->cam->cols ? x0 + size : job->cam->cols;
+	int y1 = y0 + size < job->cam->rows ? y0 + size : job->cam->rows;
+	int area = (x1 - x0) * (y1 - y0);
+
+	// clip to the crop window
+	x0 = x0 > job->cam->x0 ? x0 : job->cam->x0;
+	y0 = y0 > job->cam->y0 ? y0 : job->cam->y0;
+	x1 = x1 < job->cam->x1 ? x1 : job->cam->x1;
+	y1 = y1 < job->cam->y1 ? y1 : job->cam->y1;
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	RayFootprint_clear(&(w->th.foot));
+
+	// supersampled rays do not fall on a regular grid, so no packets;
+	// each is made, traced and shaded in one go, all timed as shading.
+	// A supersampled image is finished by tracing its tiles in full.
+	if (job->rr->aa > 1 && job->step <= 1) {
+		double start = stamp();
+
+		renderAdaptive(w, x0, y0, x1, y1);
+		Ray_stats()->ms[RayStageShade] += stamp() - start;
+	}
+	else if (job->rr->wavefront) {
+		renderWave(w, x0, y0, x1, y1);
+	}
+	else if (job->gbuf != NULL) {
+		renderRaster(w, x0, y0, x1, y1);
+	}
+	else if (job->rr->packet) {
+		renderPackets(w, x0, y0, x1, y1);
+	}
+	else {
+		renderRays(w, x0, y0, x1, y1);
+	}
+	if (job->step > 1) {
+		fillPass(w, x0, y0, x1, y1);
+	}
+
+	// a tile cut by the crop window is still partly out of date
+	if (w->th.footSpace != NULL) {
+		job->rr->footprint[tile] = w->th.foot;
+		job->rr->dirty[tile] = (x1 - x0) * (y1 - y0) < area;
+	}
+}
+
+
+/*
+ * Finds the pixel spacing of the first progressive pass
+ * @rr: the render settings
+ * @return: rr->coarse rounded down to a power of 2, at least 1
+ */
+static int coarsestStep(RayRender *rr) {
+	int step = 1;
+
+	while (2 * step <= rr->coarse) {
+		step *= 2;
+	}
+	return step;
+}
+
+
+/*
+ * Tells whether a render should start no more tiles. Full renders and
+ * the first progressive pass always run to the end, so there is a
+ * whole image to show; later passes stop at the deadline or when the
+ * caller cancels.
+ * @job: the render job
+ * @return: 1 to stop, 0 to go on
+ */
+static int stopped(RenderJob *job) {
+	if (job->step <= 0 || job->step >= job->coarsest) {
+		return 0;
+	}
+	if (job->rr->cancel != NULL && *(job->rr->cancel)) {
+		return 1;
+	}
+	return job->deadline > 0 && stamp() > job->deadline;
+}
+
+
+/*
+ * Takes the next tile from the front of a worker's own queue
+ * @q: the queue
+ * @return: a position in the job's tile list, or -1 if the queue is empty
+ */
+static int popTile(TileQueue *q) {
+	int tile = -1;
+
+	pthread_mutex_lock(&(q->lock));
+	if (q->head < q->tail) {
+		tile = q->head++;
+	}
+	pthread_mutex_unlock(&(q->lock));
+	return tile;
+}
+
+
+/*
+ * Steals a tile from the back of the fullest queue of another worker
+ * @job: the render job
+ * @id: the worker doing the stealing
+ * @return: a position in the job's tile list, or -1 if there is no work
+ * left anywhere
+ */
+static int stealTile(RenderJob *job, int id) {
+	int i, victim, most, tile;
+
+	for (;;) {
+		victim = -1;
+		most = 0;
+		for (i=0; i<job->nQueues; i++) {
+			int left;
+
+			if (i == id) {
+				continue;
+			}
+			pthread_mutex_lock(&(job->queue[i].lock));
+			left = job->queue[i].tail - job->queue[i].head;
+			pthread_mutex_unlock(&(job->queue[i].lock));
+			if (left > most) {
+				most = left;
+				victim = i;
+			}
+		}
+		if (victim < 0) {
+			return -1;
+		}
+
+		// the victim may have drained its queue since we looked
+		tile = -1;
+		pthread_mutex_lock(&(job->queue[victim].lock));
+		if (job->queue[victim].head < job->queue[victim].tail) {
+			tile = --job->queue[victim].tail;
+		}
+		pthread_mutex_unlock(&(job->queue[victim].lock));
+		if (tile >= 0) {
+			return tile;
+		}
+	}
+}
+
+
+/*
+ * Records a finished tile in the job's checkpoint, if it has one
+ * @job: the render job
+ * @tile: the tile index, in scanline order
+ * @return: void
+ */
+static void tileDone(RenderJob *job, int tile) {
+	if (job->ck != NULL) {
+		pthread_mutex_lock(&(job->ckLock));
+		RayCheckpoint_tile(job->ck, tile, job->src);
+		pthread_mutex_unlock(&(job->ckLock));
+	}
+}
+
+
+/*
+ * Worker thread: renders its own tiles, then helps the others. The
+ * thread's counters are set aside meanwhile, so the worker's own come
+ * out separately, then added back.
+ * @arg: a RenderWorker
+ * @return: NULL
+ */
+static void *renderWorker(void *arg) {
+	RenderWorker *w = arg;
+	RayStats *st = Ray_stats();
+	RayStats saved = *st;
+	int tile;
+
+	RayStats_clear(st);
+	while (!stopped(w->job) && (tile = popTile(&(w->job->queue[w->id]))) >= 0) {
+		renderTile(w, w->job->tiles[tile]);
+		tileDone(w->job, w->job->tiles[tile]);
+	}
+	while (!stopped(w->job) && (tile = stealTile(w->job, w->id)) >= 0) {
+		renderTile(w, w->job->tiles[tile]);
+		tileDone(w->job, w->job->tiles[tile]);
+	}
+	w->stats = *st;
+	*st = saved;
+	RayStats_add(st, &(w->stats));
+	return NULL;
+}
+
+
+/*
+ * Sets up a worker's tracing state and tile buffers
+ * @w: the worker
+ * @job: the render job
+ * @id: the worker's number
+ * @footSpace: space to record each tile's footprint in, NULL for none
+ * @return: void
+ */
+static void workerInit(RenderWorker *w, RenderJob *job, int id, BBox *footSpace) {
+	int nPixels = job->rr->tileSize * job->rr->tileSize;
+
+	w->job = job;
+	w->id = id;
+	w->samples = 0;
+	RayStats_clear(&(w->stats));
+	RayThread_init(&(w->th));
+	w->th.footSpace = footSpace;
+	w->order = malloc(sizeof(int) * nPixels);
+	w->pixel = malloc(sizeof(int) * nPixels);
+	w->rank = malloc(sizeof(int) * nPixels);
+	w->ray = malloc(sizeof(Ray) * nPixels);
+	w->hit = malloc(sizeof(Intersection) * nPixels);
+	w->t = malloc(sizeof(double) * nPixels);
+	RayWave_init(&(w->wave));
+	w->wave.sort = job->rr->sortSecondary;
+}
+
+
+/*
+ * Frees a worker's tile buffers
+ * @w: the worker
+ * @return: void
+ */
+static void workerFree(RenderWorker *w) {
+	free(w->order);
+	free(w->pixel);
+	free(w->rank);
+	free(w->ray);
+	free(w->hit);
+	free(w->t);
+	RayWave_clear(&(w->wave));
+}
+
+
+/*
+ * Counts the tiles an image is split into, fixing up a bad tile size
+ * @rr: the render settings
+ * @view: the view parameters
+ * @return: the number of tiles
+ */
+static int tileCount(RayRender *rr, View3D *view) {
+	if (rr->tileSize <= 0) {
+		rr->tileSize = RAY_TILE_SIZE;
+	}
+	return ((view->screenx + rr->tileSize - 1) / rr->tileSize)
+				* ((view->screeny + rr->tileSize - 1) / rr->tileSize);
+}
+
+
+/*
+ * Tests whether two views would give the same primary rays
+ * @a: a view
+ * @b: another view
+ * @return: 1 if they would, 0 if not
+ */
+static int sameView(View3D *a, View3D *b) {
+	int i;
+
+	for (i=0; i<3; i++) {
+		if (a->vrp.val[i] != b->vrp.val[i] || a->vpn.v[i] != b->vpn.v[i]
+											|| a->vup.v[i] != b->vup.v[i]) {
+			return 0;
+		}
+	}
+	return a->d == b->d && a->du == b->du && a->dv == b->dv
+				&& a->screenx == b->screenx && a->screeny == b->screeny;
+}
+
+
+// #######################
+// ### Process Helpers ###
+// #######################
+
+/*
+ * Maps memory that stays shared with processes forked after it
+ * @size: bytes to map
+ * @return: the memory, or NULL if it could not be mapped
+ */
+static void *sharedAlloc(size_t size) {
+	void *p = mmap(NULL, size > 0 ? size : 1, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+
+/*
+ * Reads one int from a pipe, riding out signals
+ * @fd: the pipe
+ * @v: where to put it
+ * @return: 1 if it was read, 0 at the end of the pipe or on an error
+ */
+static int readInt(int fd, int *v) {
+	ssize_t n;
+
+	do {
+		n = read(fd, v, sizeof(int));
+	} while (n < 0 && errno == EINTR);
+	return n == sizeof(int);
+}
+
+
+/*
+ * Worker process: traces the tiles the coordinator sends it until the
+ * pipe is closed. Its counters are kept up to date in its slot after
+ * every tile, added to what an earlier worker in the slot left there.
+ * @job: the render job, in memory of its own
+ * @id: the worker's number
+ * @cmd: pipe to read tile positions from
+ * @res: pipe to write each finished position to
+ * @slot: the worker's shared slot
+ * @footSpace: space to record each tile's footprint in, NULL for none
+ * @return: void
+ */
+static void processWorker(RenderJob *job, int id, int cmd, int res, ProcessSlot *slot,
+															BBox *footSpace) {
+	RenderWorker w;
+	RayStats *st = Ray_stats();
+	RayStats base = slot->stats;
+	long samples = slot->samples;
+	int pos;
+
+	workerInit(&w, job, id, footSpace);
+	RayStats_clear(st);
+	while (readInt(cmd, &pos)) {
+		renderTile(&w, job->tiles[pos]);
+		slot->stats = base;
+		RayStats_add(&(slot->stats), st);
+		slot->samples = samples + w.samples;
+		if (write(res, &pos, sizeof(int)) != sizeof(int)) {
+			break;
+		}
+	}
+	workerFree(&w);
+}
+
+
+/*
+ * Forks a worker process with a pipe each way. The child never
+ * returns from here.
+ * @job: the render job
+ * @proc: the coordinator's record of every worker
+ * @nProcs: number of workers
+ * @id: the worker to start, which must not be running
+ * @slot: the workers' shared slots
+ * @footSpace: space to record each tile's footprint in, NULL for none
+ * @return: 1 if it started, 0 if not
+ */
+static int spawnProcess(RenderJob *job, RenderProcess *proc, int nProcs, int id,
+										ProcessSlot *slot, BBox *footSpace) {
+	int cmd[2], res[2], i;
+	pid_t pid;
+
+	if (pipe(cmd) != 0) {
+		return 0;
+	}
+	if (pipe(res) != 0) {
+		close(cmd[0]);
+		close(cmd[1]);
+		return 0;
+	}
+	pid = fork();
+	if (pid < 0) {
+		close(cmd[0]);
+		close(cmd[1]);
+		close(res[0]);
+		close(res[1]);
+		return 0;
+	}
+	if (pid == 0) {
+		// only the coordinator may hold the other workers' pipes, or
+		// their ends would not be seen
+		for (i=0; i<nProcs; i++) {
+			if (i != id && proc[i].pid > 0) {
+				close(proc[i].cmd);
+				close(proc[i].res);
+			}
+		}
+		close(cmd[1]);
+		close(res[0]);
+		processWorker(job, id, cmd[0], res[1], &(slot[id]), footSpace);
+		_exit(0);
+	}
+	close(cmd[0]);
+	close(res[1]);
+	proc[id].pid = pid;
+	proc[id].cmd = cmd[1];
+	proc[id].res = res[0];
+	proc[id].busy = -1;
+	return 1;
+}
+
+
+/*
+ * Stops a worker process by closing its pipes, and waits for it
+ * @proc: the worker
+ * @return: void
+ */
+static void stopProcess(RenderProcess *proc) {
+	close(proc->cmd);
+	close(proc->res);
+	while (waitpid(proc->pid, NULL, 0) < 0 && errno == EINTR);
+	proc->pid = 0;
+	proc->busy = -1;
+}
+
+
+/*
+ * Ray traces a job's tiles on rr->processes worker processes forked
+ * from this one, so each has its own copy of the scene and a worker
+ * that runs out of memory or crashes takes nothing else down. The
+ * coordinator sends one tile position at a time down a pipe to each
+ * idle worker; the pixels, footprints and counters come back through
+ * shared memory. A tile whose worker dies is given to a fresh worker,
+ * up to RAY_TILE_RETRIES more times before it is counted in
+ * rr->lostTiles and left as far as it got. Tiles left over when no
+ * worker can be started are traced here.
+ * @job: the render job
+ * @nTiles: number of tiles in the job's list
+ * @footSpace: space to record each tile's footprint in, NULL for none
+ * @return: 1 if the tiles were traced, 0 if no shared memory could be
+ * had, in which case nothing was done
+ */
+static int renderProcesses(RenderJob *job, int nTiles, BBox *footSpace) {
+	RayRender *rr = job->rr;
+	RayRender sub = *rr;
+	Image *src = job->src;
+	Image shared = *src;
+	RenderProcess *proc;
+	ProcessSlot *slot;
+	struct pollfd *fds;
+	struct sigaction ignore, saved;
+	size_t nPixels = (size_t)src->rows * src->cols;
+	int nProcs = rr->processes < nTiles ? rr->processes : nTiles;
+	int nFoot = footSpace != NULL ? rr->nTiles : 0;
+	int *todo, *tries, *who;
+	int head = 0, queued = nTiles, left = nTiles, lost = 0;
+	int n, i, k, pos;
+
+	nProcs = nProcs > 0 ? nProcs : 1;
+	shared.data = sharedAlloc(sizeof(FPixel) * nPixels);
+	slot = sharedAlloc(sizeof(ProcessSlot) * nProcs);
+	sub.footprint = nFoot > 0 ? sharedAlloc(sizeof(RayFootprint) * nFoot) : NULL;
+	sub.dirty = nFoot > 0 ? sharedAlloc(nFoot) : NULL;
+	if (shared.data == NULL || slot == NULL || (nFoot > 0 && (sub.footprint == NULL
+														|| sub.dirty == NULL))) {
+		if (shared.data != NULL) munmap(shared.data, sizeof(FPixel) * nPixels);
+		if (slot != NULL) munmap(slot, sizeof(ProcessSlot) * nProcs);
+		if (sub.footprint != NULL) munmap(sub.footprint, sizeof(RayFootprint) * nFoot);
+		if (sub.dirty != NULL) munmap(sub.dirty, nFoot);
+		return 0;
+	}
+	memcpy(shared.data, src->data, sizeof(FPixel) * nPixels);
+	if (nFoot > 0) {
+		memcpy(sub.footprint, rr->footprint, sizeof(RayFootprint) * nFoot);
+		memcpy(sub.dirty, rr->dirty, nFoot);
+	}
+	job->rr = &sub;
+	job->src = &shared;
+
+	// a write to a worker that has died must fail, not kill us
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigemptyset(&(ignore.sa_mask));
+	sigaction(SIGPIPE, &ignore, &saved);
+
+	todo = malloc(sizeof(int) * (nTiles > 0 ? nTiles : 1));
+	tries = malloc(sizeof(int) * (nTiles > 0 ? nTiles : 1));
+	for (i=0; i<nTiles; i++) {
+		todo[i] = i;
+		tries[i] = 0;
+	}
+	proc = malloc(sizeof(RenderProcess) * nProcs);
+	fds = malloc(sizeof(struct pollfd) * nProcs);
+	who = malloc(sizeof(int) * nProcs);
+	for (i=0; i<nProcs; i++) {
+		proc[i].pid = 0;
+		proc[i].busy = -1;
+		slot[i].samples = 0;
+		RayStats_clear(&(slot[i].stats));
+	}
+
+	while (left > 0) {
+		// a stopped render waits for the tiles being traced, and no more
+		if (queued > 0 && stopped(job)) {
+			job->skipped += queued;
+			left -= queued;
+			queued = 0;
+		}
+
+		// start or restart workers while there is work, and feed the idle
+		for (i=0; i<nProcs && queued > 0; i++) {
+			if (proc[i].pid == 0 && !spawnProcess(job, proc, nProcs, i, slot, footSpace)) {
+				continue;
+			}
+			if (proc[i].busy < 0) {
+				pos = todo[head];
+				head = (head + 1) % nTiles;
+				queued--;
+				// a worker that cannot be written to is finished off, and
+				// its end is seen below like any other
+				proc[i].busy = pos;
+				if (write(proc[i].cmd, &pos, sizeof(int)) != sizeof(int)) {
+					kill(proc[i].pid, SIGKILL);
+				}
+			}
+		}
+
+		n = 0;
+		for (i=0; i<nProcs; i++) {
+			if (proc[i].busy >= 0) {
+				fds[n].fd = proc[i].res;
+				fds[n].events = POLLIN;
+				fds[n].revents = 0;
+				who[n++] = i;
+			}
+		}
+		if (n == 0) {
+			break; 	// no worker could be started
+		}
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		for (k=0; k<n; k++) {
+			if (fds[k].revents == 0) {
+				continue;
+			}
+			i = who[k];
+			if (readInt(proc[i].res, &pos)) {
+				proc[i].busy = -1;
+				left--;
+				tileDone(job, job->tiles[pos]);
+				continue;
+			}
+
+			// the worker died tracing its tile
+			pos = proc[i].busy;
+			stopProcess(&(proc[i]));
+			if (++tries[pos] <= RAY_TILE_RETRIES) {
+				todo[(head + queued) % nTiles] = pos;
+				queued++;
+			}
+			else {
+				lost++;
+				left--;
+			}
+		}
+	}
+	for (i=0; i<nProcs; i++) {
+		if (proc[i].pid > 0) {
+			stopProcess(&(proc[i]));
+		}
+	}
+
+	RayStats_clear(&(rr->stats));
+	rr->samples = 0;
+	for (i=0; i<nProcs; i++) {
+		rr->samples += slot[i].samples;
+		RayStats_add(&(rr->stats), &(slot[i].stats));
+	}
+
+	// whatever no worker could take is traced here
+	if (queued > 0) {
+		RenderWorker w;
+		RayStats *st = Ray_stats();
+		RayStats saved = *st;
+
+		workerInit(&w, job, 0, footSpace);
+		RayStats_clear(st);
+		for (; queued > 0; queued--) {
+			renderTile(&w, job->tiles[todo[head]]);
+			tileDone(job, job->tiles[todo[head]]);
+			head = (head + 1) % nTiles;
+		}
+		w.stats = *st;
+		*st = saved;
+		RayStats_add(st, &(w.stats));
+		RayStats_add(&(rr->stats), &(w.stats));
+		rr->samples += w.samples;
+		workerFree(&w);
+	}
+	rr->lostTiles = lost;
+
+	job->rr = rr;
+	job->src = src;
+	memcpy(src->data, shared.data, sizeof(FPixel) * nPixels);
+	if (nFoot > 0) {
+		memcpy(rr->footprint, sub.footprint, sizeof(RayFootprint) * nFoot);
+		memcpy(rr->dirty, sub.dirty, nFoot);
+		munmap(sub.footprint, sizeof(RayFootprint) * nFoot);
+		munmap(sub.dirty, nFoot);
+	}
+	munmap(shared.data, sizeof(FPixel) * nPixels);
+	munmap(slot, sizeof(ProcessSlot) * nProcs);
+	sigaction(SIGPIPE, &saved, NULL);
+	free(todo);
+	free(tries);
+	free(proc);
+	free(fds);
+	free(who);
+	return 1;
+}
+
+
+/*
+ * Ray traces a job's tiles on the worker threads. The calling thread
+ * is one of them. Each starts on a run of tiles of its own; a worker
+ * that runs out steals from the others.
+ * @job: the render job
+ * @nTiles: number of tiles in the job's list
+ * @footSpace: space to record each tile's footprint in, NULL for none
+ * @return: void
+ */
+static void renderThreads(RenderJob *job, int nTiles, BBox *footSpace) {
+	RayRender *rr = job->rr;
+	RenderWorker *worker;
+	pthread_t *thread;
+	int nThreads, i;
+
+	nThreads = RayRender_threads(rr);
+	if (nThreads > nTiles) {
+		nThreads = nTiles > 0 ? nTiles : 1;
+	}
+
+	// give each worker a contiguous run of tiles to start with
+	job->nQueues = nThreads;
+	job->queue = malloc(sizeof(TileQueue) * nThreads);
+	for (i=0; i<nThreads; i++) {
+		pthread_mutex_init(&(job->queue[i].lock), NULL);
+		job->queue[i].head = (int)((long)nTiles * i / nThreads);
+		job->queue[i].tail = (int)((long)nTiles * (i+1) / nThreads);
+	}
+
+	worker = malloc(sizeof(RenderWorker) * nThreads);
+	thread = malloc(sizeof(pthread_t) * nThreads);
+	for (i=0; i<nThreads; i++) {
+		workerInit(&(worker[i]), job, i, footSpace);
+	}
+
+	// the calling thread is worker 0
+	for (i=1; i<nThreads; i++) {
+		if (pthread_create(&(thread[i]), NULL, renderWorker, &(worker[i])) != 0) {
+			// not fatal, the remaining workers steal its tiles
+			worker[i].job = NULL;
+		}
+	}
+	renderWorker(&(worker[0]));
+	for (i=1; i<nThreads; i++) {
+		if (worker[i].job != NULL) {
+			pthread_join(thread[i], NULL);
+		}
+	}
+
+	rr->samples = 0;
+	RayStats_clear(&(rr->stats));
+	for (i=0; i<nThreads; i++) {
+		rr->samples += worker[i].samples;
+		RayStats_add(&(rr->stats), &(worker[i].stats));
+		job->skipped += job->queue[i].tail - job->queue[i].head;
+		pthread_mutex_destroy(&(job->queue[i].lock));
+		workerFree(&(worker[i]));
+	}
+	free(thread);
+	free(worker);
+	free(job->queue);
+}
+
+
+/*
+ * Ray traces a list of tiles of a scene as seen by a camera into src,
+ * clipped to the camera's crop window, on the worker threads or, with
+ * rr->processes set, on worker processes. With rr->raster set and one
+ * sample per pixel, what the primary rays hit is found first for the
+ * whole window by scan converting the scene into a G-buffer.
+ * @rr: the render settings
+ * @scene: the scene, from RayScene_init
+ * @cam: the camera
+ * @src: the image to draw into, sized rows by cols
+ * @tiles: the tiles to trace, by index in scanline order
+ * @nTiles: number of tiles in the list
+ * @footSpace: space to record each tile's footprint in, NULL for none
+ * @step: pixel spacing of a progressive pass, 0 for a full render
+ * @deadline: stamp() after which a progressive pass stops, 0 for none
+ * @ck: checkpoint to record finished tiles in, NULL for none
+ * @return: the number of tiles a stopped pass did not start
+ */
+static int renderTiles(RayRender *rr, RayScene *scene, RayCamera *cam, Image *src,
+					int *tiles, int nTiles, BBox *footSpace, int step, double deadline,
+					RayCheckpoint *ck) {
+	RenderJob job;
+	RayGBuffer gbuf;
+	RayStats drawn;
+	double start = stamp();
+
+	job.rr = rr;
+	job.scene = scene;
+	job.src = src;
+	job.cam = cam;
+	job.gbuf = NULL;
+	job.step = step;
+	job.coarsest = coarsestStep(rr);
+	job.deadline = deadline;
+	job.skipped = 0;
+	job.ck = ck;
+	pthread_mutex_init(&(job.ckLock), NULL);
+	job.tilesX = (cam->cols + rr->tileSize - 1) / rr->tileSize;
+	job.tilesY = (cam->rows + rr->tileSize - 1) / rr->tileSize;
+	job.tiles = tiles;
+
+	// the G-buffer is drawn here, counted apart from the workers; a
+	// coarse progressive pass traces too few pixels to pay for one
+	if (rr->raster && rr->aa <= 1 && rr->depth > 0 && step <= 1) {
+		RayStats *st = Ray_stats();
+		RayStats saved = *st;
+
+		RayStats_clear(st);
+		RayGBuffer_init(&gbuf);
+		RayGBuffer_draw(&gbuf, scene->module, cam);
+		job.gbuf = &gbuf;
+		drawn = *st;
+		drawn.ms[RayStagePrimary] += stamp() - start;
+		*st = saved;
+		RayStats_add(st, &drawn);
+	}
+
+	rr->lostTiles = 0;
+	if (rr->processes <= 0 || !renderProcesses(&job, nTiles, footSpace)) {
+		renderThreads(&job, nTiles, footSpace);
+	}
+	if (job.gbuf != NULL) {
+		RayStats_add(&(rr->stats), &drawn);
+		RayGBuffer_clear(&gbuf);
+	}
+	pthread_mutex_destroy(&(job.ckLock));
+	rr->stats.wallMs = stamp() - start;
+	return job.skipped;
+}
+
+
+// ########################
+// ### Render Functions ###
+// ########################
+
+/*
+ * Sets the render settings to their defaults
+ * @rr: the render settings
+ * @return: void
+ */
+void RayRender_init(RayRender *rr) {
+	rr->depth = 10;
+	rr->tileSize = RAY_TILE_SIZE;
+	rr->nThreads = 0;
+	rr->packet = 0;
+	rr->order = RayOrderScanline;
+	rr->sortSecondary = 0;
+	rr->processes = 0;
+	rr->lostTiles = 0;
+	rr->raster = 0;
+	rr->wavefront = 0;
+	rr->coarse = 8;
+	rr->budgetMs = 0.0;
+	rr->cancel = NULL;
+	rr->step = 0;
+	rr->checkpoint = NULL;
+	rr->checkpointMs = RAY_CHECKPOINT_MS;
+	rr->resumedTiles = 0;
+	rr->aa = 1;
+	rr->aaMax = 4;
+	rr->aaThreshold = 0.1;
+	rr->samples = 0;
+	RayStats_clear(&(rr->stats));
+	rr->track = 0;
+	rr->footprint = NULL;
+	rr->dirty = NULL;
+	rr->nTiles = 0;
+	rr->footTileSize = 0;
+}
+
+
+/*
+ * Frees the footprints kept by a tracked render. The settings are
+ * left alone.
+ * @rr: the render settings
+ * @return: void
+ */
+void RayRender_clear(RayRender *rr) {
+	free(rr->footprint);
+	free(rr->dirty);
+	rr->footprint = NULL;
+	rr->dirty = NULL;
+	rr->nTiles = 0;
+}
+
+
+/*
+ * Returns the number of worker threads a render will use
+ * @rr: the render settings
+ * @return: the thread count
+ */
+int RayRender_threads(RayRender *rr) {
+	long n = rr->nThreads;
+
+	if (n <= 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	return n > 0 ? (int)n : 1;
+}
+
+
+/*
+ * Ray traces a scene as seen from view into src. The image is split
+ * into square tiles which are traced on a pool of threads, or on
+ * rr->processes forked worker processes if that is set.
+ * Every pixel is traced independently so the result does not depend
+ * on the number of threads. The number of primary rays traced is left
+ * in rr->samples, and the counters of everything traced in rr->stats.
+ * With rr->track set, the voxels of the scene that each
+ * tile's rays cross are recorded for RayRender_update. With
+ * rr->checkpoint set, finished tiles are saved to that file every
+ * rr->checkpointMs and once more at the end, and a render with the same
+ * settings and scene resumes from it, tracing only the tiles it lacks;
+ * rr->resumedTiles counts the ones it took. A resumed tile is left out
+ * of the footprints, so it stays out of date for RayRender_update.
+ * @rr: the render settings
+ * @scene: the scene, from RayScene_init
+ * @view: the view parameters
+ * @src: the image to draw into, sized screeny by screenx
+ * @return: void
+ */
+void RayRender_image(RayRender *rr, RayScene *scene, View3D *view, Image *src) {
+	RayCamera cam;
+
+	RayCamera_init(&cam, view);
+	RayRender_camera(rr, scene, &cam, src);
+	RayCamera_clear(&cam);
+}
+
+
+/*
+ * Ray traces the part of a scene inside a camera's crop window into
+ * src, leaving the rest of the image alone. Otherwise the same as
+ * RayRender_image; a tracked render counts the tiles outside the window
+ * as out of date.
+ * @rr: the render settings
+ * @scene: the scene, from RayScene_init
+ * @cam: the camera
+ * @src: the image to draw into, sized rows by cols
+ * @return: void
+ */
+void RayRender_camera(RayRender *rr, RayScene *scene, RayCamera *cam, Image *src) {
+	RayModule *rmd = scene->module;
+	BBox *footSpace = NULL;
+	int nTiles = tileCount(rr, &(cam->view));
+	int *tiles = malloc(sizeof(int) * (nTiles > 0 ? nTiles : 1));
+	RayCheckpoint ck;
+	double pad = 0.0;
+	int i, n;
+
+	for (i=0; i<nTiles; i++) {
+		tiles[i] = i;
+	}
+
+	// the footprint voxels divide the objects' box, with room to move
+	RayRender_clear(rr);
+	if (rr->track && rmd->nPrims > 0) {
+		for (i=0; i<3; i++) {
+			double extent = rmd->box.max[i] - rmd->box.min[i];
+			pad = extent > pad ? extent : pad;
+		}
+		pad = pad * 0.25 + 1e-6;
+		for (i=0; i<3; i++) {
+			rr->footSpace.min[i] = rmd->box.min[i] - pad;
+			rr->footSpace.max[i] = rmd->box.max[i] + pad;
+		}
+		rr->footprint = malloc(sizeof(RayFootprint) * (nTiles > 0 ? nTiles : 1));
+		rr->dirty = malloc(nTiles > 0 ? nTiles : 1);
+		for (i=0; i<nTiles; i++) {
+			RayFootprint_clear(&(rr->footprint[i]));
+			rr->dirty[i] = 1;
+		}
+		rr->nTiles = nTiles;
+		rr->footTileSize = rr->tileSize;
+		rr->footView = cam->view;
+		footSpace = &(rr->footSpace);
+	}
+
+	// with a checkpoint, the tiles it has are taken from it
+	rr->resumedTiles = 0;
+	n = nTiles;
+	if (rr->checkpoint != NULL) {
+		RayCheckpoint_init(&ck, rr, scene, cam, nTiles);
+		rr->resumedTiles = RayCheckpoint_load(&ck, src);
+		for (i=n=0; i<nTiles; i++) {
+			if (!ck.done[i]) {
+				tiles[n++] = i;
+			}
+		}
+	}
+
+	renderTiles(rr, scene, cam, src, tiles, n, footSpace, 0, 0.0,
+									rr->checkpoint != NULL ? &ck : NULL);
+	if (rr->checkpoint != NULL) {
+		RayCheckpoint_save(&ck);
+		RayCheckpoint_clear(&ck);
+	}
+	free(tiles);
+}
+
+
+/*
+ * Ray traces a scene as seen from view into src in passes from coarse
+ * to fine, so a whole image is ready early and then gets better. The
+ * first pass traces every rr->coarse-th pixel across and up, rounded
+ * down to a power of 2, and fills in the rest from them; each pass
+ * after it halves the spacing, down to every pixel. The first pass is
+ * always finished. After it no tile is started once rr->budgetMs has
+ * passed since the call or the caller sets *rr->cancel, and the image
+ * is left as far as the passes got, each tile whole at the spacing it
+ * reached. rr->step is set to the spacing of the last pass that was
+ * finished. Every pass is traced in the render's mode, packets,
+ * wavefront or G-buffer, though the G-buffer is only drawn for the
+ * last pass and the coarser ones trace their rays. The counters in
+ * rr->samples and rr->stats add up all the passes. A progressive
+ * render is not tracked.
+ * @rr: the render settings
+ * @scene: the scene, from RayScene_init
+ * @view: the view parameters
+ * @src: the image to draw into, sized screeny by screenx
+ * @return: 1 if every pixel was traced, 0 if the render stopped early
+ */
+int RayRender_progressive(RayRender *rr, RayScene *scene, View3D *view, Image *src) {
+	RayCamera cam;
+	RayStats total;
+	double start = stamp();
+	double deadline = rr->budgetMs > 0 ? start + rr->budgetMs : 0.0;
+	int nTiles = tileCount(rr, view);
+	int *tiles = malloc(sizeof(int) * (nTiles > 0 ? nTiles : 1));
+	long samples = 0;
+	int lost = 0;
+	int i, step, skipped;
+
+	for (i=0; i<nTiles; i++) {
+		tiles[i] = i;
+	}
+	RayRender_clear(rr);
+	RayCamera_init(&cam, view);
+	RayStats_clear(&total);
+
+	rr->step = 0;
+	for (step=coarsestStep(rr); step>=1; step/=2) {
+		if (rr->step > 0 && ((rr->cancel != NULL && *(rr->cancel))
+							|| (deadline > 0 && stamp() > deadline))) {
+			break;
+		}
+		skipped = renderTiles(rr, scene, &cam, src, tiles, nTiles, NULL, step, deadline,
+																		NULL);
+		samples += rr->samples;
+		lost += rr->lostTiles;
+		RayStats_add(&total, &(rr->stats));
+		if (skipped > 0) {
+			break;
+		}
+		rr->step = step;
+	}
+
+	rr->samples = samples;
+	rr->lostTiles = lost;
+	rr->stats = total;
+	rr->stats.wallMs = stamp() - start;
+	RayCamera_clear(&cam);
+	free(tiles);
+	return rr->step == 1;
+}
+
+
+/*
+ * Marks out of date every tile of the last tracked render whose rays
+ * crossed a box. Call it with an element's box before the element is
+ * changed and again after, so the tiles that saw it and the tiles that
+ * will see it are both traced by RayRender_update.
+ * @rr: the render settings
+ * @box: the part of the scene that changed
+ * @return: void
+ */
+void RayRender_touch(RayRender *rr, BBox *box) {
+	RayFootprint fp;
+	int i;
+
+	RayFootprint_clear(&fp);
+	if (!RayFootprint_box(&fp, &(rr->footSpace), box)) {
+		// no record of rays out there, so anything may have changed
+		for (i=0; i<rr->nTiles; i++) {
+			rr->dirty[i] = 1;
+		}
+		return;
+	}
+	for (i=0; i<rr->nTiles; i++) {
+		if (RayFootprint_overlap(&(rr->footprint[i]), &fp)) {
+			rr->dirty[i] = 1;
+		}
+	}
+}
+
+
+/*
+ * Marks out of date every tile of the last tracked render that an
+ * element may show in. Unbounded elements mark every tile.
+ * @rr: the render settings
+ * @e: the element, as it is now
+ * @return: void
+ */
+void RayRender_touchElement(RayRender *rr, RayElement *e) {
+	BBox box;
+	int i;
+
+	if (RayElement_bounds(e, &box)) {
+		RayRender_touch(rr, &box);
+		return;
+	}
+	for (i=0; i<rr->nTiles; i++) {
+		rr->dirty[i] = 1;
+	}
+}
+
+
+/*
+ * Brings an image from the last tracked render up to date after some
+ * elements were changed and touched, tracing only the tiles marked out
+ * of date and keeping the rest of src. The module must be rebuilt after
+ * the changes. A new view, tile size or image size, or no tracked render
+ * to start from, traces the whole image. Changes to the lights are not
+ * tracked and need RayRender_image.
+ * @rr: the render settings, from a render with rr->track set
+ * @scene: the scene, from RayScene_init
+ * @view: the view parameters
+ * @src: the image from the last render
+ * @return: the number of tiles traced
+ */
+int RayRender_update(RayRender *rr, RayScene *scene, View3D *view, Image *src) {
+	RayCamera cam;
+	int nTiles = tileCount(rr, view);
+	int *tiles;
+	int i, n = 0;
+
+	if (rr->nTiles == 0 || rr->nTiles != nTiles || rr->footTileSize != rr->tileSize
+											|| !sameView(view, &(rr->footView))) {
+		RayRender_image(rr, scene, view, src);
+		return nTiles;
+	}
+
+	tiles = malloc(sizeof(int) * nTiles);
+	for (i=0; i<nTiles; i++) {
+		if (rr->dirty[i]) {
+			tiles[n++] = i;
+		}
+	}
+	RayCamera_init(&cam, view);
+	renderTiles(rr, scene, &cam, src, tiles, n, &(rr->footSpace), 0, 0.0, NULL);
+	RayCamera_clear(&cam);
+	free(tiles);
+	return n;
+}
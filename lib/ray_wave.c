@@ -0,0 +1,354 @@
+/* Dan Nelson
+ * Graphics Package
+ * ray_wave.c
+ * Traces a batch of paths a wave at a time, with queues between the
+ * intersection, shading and shadow stages instead of recursion
+ */
+
+
+#include "cb_graphics.h"
+
+
+// ####################
+// ### Wave Helpers ###
+// ####################
+
+/*
+ * Adds light found along a path to its pixel
+ * @wv: the wave
+ * @r: the ray of the path that found it
+ * @c: the light, before the path's scaling
+ * @return: void
+ */
+static void gather(RayWave *wv, RayWaveRay *r, Color *c) {
+	Color *dest = &(wv->color[r->pixel]);
+	int i;
+
+	for (i=0; i<3; i++) {
+		dest->c[i] += r->through.c[i] * c->c[i];
+	}
+}
+
+
+/*
+ * Queues a reflected or refracted ray for the next wave, if
+ * Ray_pathWeight finds it worth tracing
+ * @wv: the wave
+ * @scene: the scene
+ * @from: the ray whose hit it leaves
+ * @ray: the new ray
+ * @kind: the kind of ray, for the counters
+ * @coeff: the color its light is scaled by at the hit
+ * @level: surfaces shaded along the path, counting the hit
+ * @return: void
+ */
+static void spawn(RayWave *wv, RayScene *scene, RayWaveRay *from, Ray *ray,
+										RayKind kind, Color *coeff, int level) {
+	RayWaveRay *r;
+	double w;
+	int i;
+
+	w = Ray_pathWeight(scene, ray, level, coeff, from->weight);
+	if (w <= 0) {
+		return;
+	}
+	Ray_stats()->rays[kind]++;
+
+	if (wv->nNext == wv->maxNext) {
+		wv->maxNext = wv->maxNext > 0 ? 2 * wv->maxNext : 256;
+		wv->next = realloc(wv->next, sizeof(RayWaveRay) * wv->maxNext);
+	}
+	r = &(wv->next[wv->nNext++]);
+	Ray_copy(&(r->ray), ray);
+	for (i=0; i<3; i++) {
+		r->through.c[i] = from->through.c[i] * coeff->c[i];
+	}
+	r->weight = w;
+	r->pixel = from->pixel;
+	r->level = level;
+}
+
+
+/*
+ * Makes room for n rays in the current wave
+ * @wv: the wave
+ * @n: number of rays
+ * @return: void
+ */
+static void reserve(RayWave *wv, int n) {
+	if (n > wv->maxRays) {
+		wv->maxRays = 2 * n;
+		wv->ray = realloc(wv->ray, sizeof(RayWaveRay) * wv->maxRays);
+		wv->hit = realloc(wv->hit, sizeof(Intersection) * wv->maxRays);
+		wv->t = realloc(wv->t, sizeof(double) * wv->maxRays);
+	}
+}
+
+
+// ######################
+// ### Wave Functions ###
+// ######################
+
+/*
+ * Initializes an empty wave
+ * @wv: the wave
+ * @return: void
+ */
+void RayWave_init(RayWave *wv) {
+	wv->ray = NULL;
+	wv->hit = NULL;
+	wv->t = NULL;
+	wv->nRays = 0;
+	wv->maxRays = 0;
+	wv->next = NULL;
+	wv->nNext = 0;
+	wv->maxNext = 0;
+	wv->shadow = NULL;
+	wv->nShadows = 0;
+	wv->maxShadows = 0;
+	wv->color = NULL;
+	wv->level = NULL;
+	wv->maxPixels = 0;
+	wv->sort = 0;
+}
+
+
+/*
+ * Frees a wave's queues
+ * @wv: the wave
+ * @return: void
+ */
+void RayWave_clear(RayWave *wv) {
+	int sort = wv->sort;
+
+	free(wv->ray);
+	free(wv->hit);
+	free(wv->t);
+	free(wv->next);
+	free(wv->shadow);
+	free(wv->color);
+	free(wv->level);
+	RayWave_init(wv);
+	wv->sort = sort;
+}
+
+
+/*
+ * Starts a batch of paths: the primary rays become the first wave and
+ * their pixels are set to black
+ * @wv: the wave
+ * @ray: the primary rays, by pixel
+ * @pixel: the pixels to trace, in order
+ * @n: number of pixels
+ * @return: void
+ */
+void RayWave_start(RayWave *wv, Ray *ray, int *pixel, int n) {
+	RayWaveRay *r;
+	int i, last = -1;
+
+	for (i=0; i<n; i++) {
+		last = pixel[i] > last ? pixel[i] : last;
+	}
+	if (last >= wv->maxPixels) {
+		wv->maxPixels = last + 1;
+		wv->color = realloc(wv->color, sizeof(Color) * wv->maxPixels);
+		wv->level = realloc(wv->level, sizeof(int) * wv->maxPixels);
+	}
+	reserve(wv, n);
+
+	for (i=0; i<n; i++) {
+		r = &(wv->ray[i]);
+		Ray_copy(&(r->ray), &(ray[pixel[i]]));
+		Color_set(&(r->through), 1.0, 1.0, 1.0);
+		r->weight = 1.0;
+		r->pixel = pixel[i];
+		r->level = 0;
+		Color_set(&(wv->color[pixel[i]]), 0.0, 0.0, 0.0);
+		wv->level[pixel[i]] = 0;
+	}
+	wv->nRays = n;
+	wv->nNext = 0;
+	wv->nShadows = 0;
+}
+
+
+/*
+ * Finds the nearest hit of every ray in the current wave
+ * @wv: the wave
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @return: void
+ */
+void RayWave_intersect(RayWave *wv, RayScene *scene, RayThread *th) {
+	RayStats *st = Ray_stats();
+	int i;
+
+	for (i=0; i<wv->nRays; i++) {
+		wv->t[i] = Ray_closestHit(&(wv->ray[i].ray), scene->module, &(wv->hit[i]));
+		st->hits += wv->t[i] >= 0;
+		if (th->footSpace != NULL) {
+			RayFootprint_ray(&(th->foot), th->footSpace, &(wv->ray[i].ray), wv->t[i]);
+		}
+	}
+}
+
+
+/*
+ * Lights the hits of the current wave the way Ray_send does. Area
+ * lights, and lights picked from the light tree, are lit on the spot,
+ * since each of their shadow rays depends on the ones before it. The
+ * shadow rays to point lights are queued for RayWave_shadow.
+ * @wv: the wave
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @vrp: the view reference point
+ * @return: void
+ */
+void RayWave_shade(RayWave *wv, RayScene *scene, RayThread *th, Point vrp) {
+	RayStats *st = Ray_stats();
+	int sampled = scene->lightTree != NULL && scene->lightSamples < scene->light->nLights;
+	RayWaveShadow *s;
+	RayWaveRay *r;
+	Intersection *hit;
+	Color c;
+	int i, j, level;
+
+	wv->nShadows = 0;
+	for (i=0; i<wv->nRays; i++) {
+		if (wv->t[i] < 0) {
+			continue;
+		}
+		r = &(wv->ray[i]);
+		hit = &(wv->hit[i]);
+		level = r->level + 1;
+
+		// the first hit of a pixel's paths at a level takes them one deeper
+		if (wv->level[r->pixel] < level) {
+			wv->level[r->pixel] = level;
+			st->paths += level == 1;
+			st->depthSum++;
+			st->maxDepth = level > st->maxDepth ? level : st->maxDepth;
+		}
+
+		if (sampled) {
+			c = Ray_send(scene, th, hit, vrp);
+			gather(wv, r, &c);
+		}
+		for (j=0; j<scene->light->nLights && !sampled; j++) {
+			Light *l = &(scene->light->light[j]);
+
+			if (l->type == LightArea || l->type == LightSphere) {
+				c = Ray_light(scene, th, hit, vrp, j);
+				gather(wv, r, &c);
+				continue;
+			}
+			if (wv->nShadows == wv->maxShadows) {
+				wv->maxShadows = wv->maxShadows > 0 ? 2 * wv->maxShadows : 256;
+				wv->shadow = realloc(wv->shadow, sizeof(RayWaveShadow) * wv->maxShadows);
+			}
+			s = &(wv->shadow[wv->nShadows++]);
+			s->dist = Ray_shadow(hit, l->position, &(s->ray));
+			s->from = i;
+			s->light = j;
+		}
+	}
+}
+
+
+/*
+ * Traces the shadow rays the current wave queued and adds the light
+ * from each one nothing blocks
+ * @wv: the wave
+ * @scene: the scene
+ * @th: the calling thread's tracing state
+ * @vrp: the view reference point
+ * @return: void
+ */
+void RayWave_shadow(RayWave *wv, RayScene *scene, RayThread *th, Point vrp) {
+	RayWaveShadow *s;
+	Color c;
+	int i;
+
+	for (i=0; i<wv->nShadows; i++) {
+		s = &(wv->shadow[i]);
+		if (th->footSpace != NULL) {
+			RayFootprint_ray(&(th->foot), th->footSpace, &(s->ray), s->dist);
+		}
+		if (!Ray_occluded(&(s->ray), scene->module, s->dist,
+								&(th->occluder[s->light % RAY_OCCLUDERS]))) {
+			c = Ray_diffuse(scene, &(wv->hit[s->from]), vrp, s->light);
+			gather(wv, &(wv->ray[s->from]), &c);
+		}
+	}
+	wv->nShadows = 0;
+}
+
+
+/*
+ * Replaces the current wave with the reflected and refracted rays off
+ * its hits. Run after the hits are lit, as in Ray_shade, since lighting
+ * a point tidies up its normal. With wv->sort set the new rays are
+ * grouped by the octant of their direction, keeping their order within
+ * each group, so the rays that follow one another head the same way
+ * through the scene.
+ * @wv: the wave
+ * @scene: the scene
+ * @depth: maximum depth of a path, counting its primary hit
+ * @return: the number of rays in the new wave, 0 when the batch is done
+ */
+int RayWave_spawn(RayWave *wv, RayScene *scene, int depth) {
+	RayWaveRay *r;
+	Intersection *hit;
+	Color coeff;
+	Ray next;
+	int count[9];
+	int i, k;
+	Real *d;
+
+	wv->nNext = 0;
+	for (i=0; i<wv->nRays; i++) {
+		r = &(wv->ray[i]);
+		hit = &(wv->hit[i]);
+		if (wv->t[i] < 0 || depth - r->level <= 1) {
+			continue;
+		}
+		if (RayElement_isReflective(hit->e) == 1) {
+			coeff = RayElement_getSpecularColor(hit->e);
+			Ray_reflect(&(r->ray), hit, &next);
+			spawn(wv, scene, r, &next, RayReflected, &coeff, r->level + 1);
+		}
+		if (RayElement_isRefractive(hit->e) == 1) {
+			RayKind kind;
+
+			// light that cannot get out is reflected back in, all of it
+			coeff = RayElement_getRefractionColor(hit->e);
+			kind = Ray_refract(&(r->ray), hit, &next) ? RayRefracted : RayReflected;
+			spawn(wv, scene, r, &next, kind, &coeff, r->level + 1);
+		}
+	}
+
+	reserve(wv, wv->nNext);
+	if (wv->sort) {
+		for (k=0; k<9; k++) {
+			count[k] = 0;
+		}
+		for (i=0; i<wv->nNext; i++) {
+			d = wv->next[i].ray.v.v;
+			count[((d[0] < 0) | (d[1] < 0) << 1 | (d[2] < 0) << 2) + 1]++;
+		}
+		for (k=0; k<8; k++) {
+			count[k+1] += count[k];
+		}
+		for (i=0; i<wv->nNext; i++) {
+			d = wv->next[i].ray.v.v;
+			k = (d[0] < 0) | (d[1] < 0) << 1 | (d[2] < 0) << 2;
+			wv->ray[count[k]++] = wv->next[i];
+		}
+	}
+	else {
+		memcpy(wv->ray, wv->next, sizeof(RayWaveRay) * wv->nNext);
+	}
+	wv->nRays = wv->nNext;
+	wv->nNext = 0;
+	return wv->nRays;
+}
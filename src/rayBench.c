@@ -0,0 +1,1044 @@
+/* Dan Nelson
+ * Graphics Package
+ * rayBench.c
+ * Times the ray tracer on scenes that stress it in different ways and
+ * prints one JSON line of results per scene
+ */
+
+
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "cb_graphics.h"
+
+
+// Most rays kept per list for the timed passes
+#define BENCH_MAX_RAYS (1 << 19)
+
+// Levels out of 255 a pixel may differ by before -c counts it
+#define BENCH_DIFF_LEVELS 8
+
+// Names of the structures, as given to -a, in RayAccel order
+static char *accelNames[] = {"bvh", "grid", "grid2"};
+
+// Names of the pixel orders, as given to -o, in RayOrder order
+static char *orderNames[] = {"scanline", "morton", "hilbert"};
+
+
+// A list of rays to replay. Once it is full it keeps every other ray,
+// then every fourth and so on, so it stays an even sample of the frame.
+typedef struct {
+	Ray *ray;
+	double *dist; 			// distance to the light, for shadow rays
+	int n;
+	int max;
+	long stride;
+	long seen; 				// rays offered to the list
+} RayList;
+
+// Benchmark settings
+typedef struct {
+	char *scene; 			// scene to run, NULL for all
+	char *plyFile; 			// mesh for the ply scene
+	int size; 				// scene size, 0 for each scene's default
+	int width, height;
+	int depth;
+	int frames;
+	int lightSamples; 		// lights sampled per shading point, 0 = all
+	double minWeight; 		// weight below which paths stop
+	int roulette; 			// 1 = paths below it go on at random
+	int progressive; 		// 1 = render the frames progressively, within rr.budgetMs
+	char *save; 			// last frame of a scene is written to save<scene>.ppm, NULL for none
+	char *compare; 			// last frame is compared with compare<scene>.ppm, NULL for none
+	double killMs; 			// > 0 = kill a checkpointed render this far in and resume it
+	int failed; 			// 1 once a resume check has failed
+	RayAccel accel; 		// structure the scenes are built with
+	RayRender rr;
+	RayCompile rc; 			// modules compiled for the scene being run
+} Bench;
+
+// Results of one timed pass
+typedef struct {
+	long rays; 				// rays of this kind in one frame
+	double raysPerSec;
+	double testsPerRay;
+} BenchPass;
+
+// Results of a resume check
+typedef struct {
+	int tiles; 				// tiles in the frame
+	int resumed; 			// tiles taken from the killed render's checkpoint
+	long differ; 			// pixels of the resumed frame unlike the reference
+	int stale; 				// tiles taken from a checkpoint of another scene
+} BenchResume;
+
+
+// ########################
+// ### Ray List Helpers ###
+// ########################
+
+/*
+ * Makes an empty ray list
+ * @list: the list
+ * @max: the most rays to keep
+ * @return: void
+ */
+static void rayListInit(RayList *list, int max) {
+	list->ray = malloc(sizeof(Ray) * max);
+	list->dist = malloc(sizeof(double) * max);
+	list->n = 0;
+	list->max = max;
+	list->stride = 1;
+	list->seen = 0;
+}
+
+
+/*
+ * Offers a ray to a list, which keeps it if it falls on the stride
+ * @list: the list
+ * @ray: the ray
+ * @dist: its length, or 0 for no limit
+ * @return: void
+ */
+static void rayListAdd(RayList *list, Ray *ray, double dist) {
+	int i;
+
+	if (list->seen++ % list->stride != 0) {
+		return;
+	}
+	if (list->n == list->max) {
+		// thin out to every other ray and take half as many from now on
+		for (i=0; i<list->n/2; i++) {
+			list->ray[i] = list->ray[2*i];
+			list->dist[i] = list->dist[2*i];
+		}
+		list->n /= 2;
+		list->stride *= 2;
+		if ((list->seen - 1) % list->stride != 0) {
+			return;
+		}
+	}
+	list->ray[list->n] = *ray;
+	list->dist[list->n] = dist;
+	list->n++;
+}
+
+
+/*
+ * Frees a ray list
+ * @list: the list
+ * @return: void
+ */
+static void rayListFree(RayList *list) {
+	free(list->ray);
+	free(list->dist);
+}
+
+
+// ##############
+// ### Timing ###
+// ##############
+
+/*
+ * Returns a monotonic time in milliseconds
+ */
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+/*
+ * Times nearest hit queries on every ray of a list
+ * @rmd: a built ray module
+ * @list: the rays
+ * @pass: set to the results
+ * @return: void
+ */
+static void timeClosest(RayModule *rmd, RayList *list, BenchPass *pass) {
+	Intersection hit;
+	long tests = Ray_tests();
+	double start = now();
+	double ms;
+	int i;
+
+	for (i=0; i<list->n; i++) {
+		Ray_closestHit(&(list->ray[i]), rmd, &hit);
+	}
+	ms = now() - start;
+
+	pass->rays = list->seen;
+	pass->raysPerSec = ms > 0 ? list->n / (ms / 1e3) : 0.0;
+	pass->testsPerRay = list->n > 0 ? (double)(Ray_tests() - tests) / list->n : 0.0;
+}
+
+
+/*
+ * Times shadow queries on every ray of a list
+ * @rmd: a built ray module
+ * @list: the rays, with their distances to the light
+ * @pass: set to the results
+ * @return: void
+ */
+static void timeShadow(RayModule *rmd, RayList *list, BenchPass *pass) {
+	long tests = Ray_tests();
+	double start = now();
+	double ms;
+	int i;
+
+	for (i=0; i<list->n; i++) {
+		Ray_anyHit(&(list->ray[i]), rmd, list->dist[i]);
+	}
+	ms = now() - start;
+
+	pass->rays = list->seen;
+	pass->raysPerSec = ms > 0 ? list->n / (ms / 1e3) : 0.0;
+	pass->testsPerRay = list->n > 0 ? (double)(Ray_tests() - tests) / list->n : 0.0;
+}
+
+
+// ##############
+// ### Images ###
+// ##############
+
+/*
+ * Finds the level out of 255 that Image_writePPM writes for a channel
+ * @v: the channel
+ * @return: the level
+ */
+static int frameLevel(float v) {
+	return (int)(255.0 * (v > 1 ? 1 : v));
+}
+
+
+/*
+ * Compares a frame with a PPM image, as Image_writePPM would write the
+ * frame
+ * @src: the frame
+ * @path: the image to compare with
+ * @over: set to the number of pixels with a channel more than
+ * BENCH_DIFF_LEVELS levels apart
+ * @maxDiff: set to the largest difference of any channel, in levels
+ * @return: 0 on success, -1 if the image cannot be read or is another size
+ */
+static int compareFrame(Image *src, char *path, long *over, int *maxDiff) {
+	FILE *fp = fopen(path, "rb");
+	Image *ref;
+	long i;
+	int k, d, worst;
+
+	if (fp == NULL) {
+		return -1;
+	}
+	fclose(fp);
+	ref = Image_readPPM(path);
+	if (ref->rows != src->rows || ref->cols != src->cols) {
+		Image_free(ref);
+		return -1;
+	}
+
+	*over = 0;
+	*maxDiff = 0;
+	for (i=0; i<src->rows*src->cols; i++) {
+		worst = 0;
+		for (k=0; k<3; k++) {
+			d = frameLevel(src->data[i].rgb[k]) - (int)(255.0 * ref->data[i].rgb[k] + 0.5);
+			d = d < 0 ? -d : d;
+			worst = d > worst ? d : worst;
+		}
+		*over += worst > BENCH_DIFF_LEVELS;
+		*maxDiff = worst > *maxDiff ? worst : *maxDiff;
+	}
+	Image_free(ref);
+	return 0;
+}
+
+
+// ##############
+// ### Scenes ###
+// ##############
+
+/*
+ * A size by size grid of spheres on a mirror floor, one light
+ * @bench: the settings
+ * @light: the lights
+ * @rmd: the module
+ * @view: the camera, screen size already set
+ * @size: spheres per side
+ * @return: void
+ */
+static void sceneSpheres(Bench *bench, Lighting *light, RayModule *rmd,
+							View3D *view, int size) {
+	Color white = {{1.0, 1.0, 1.0}};
+	Color red = {{0.7, 0.13, 0.13}};
+	Color grey = {{0.5, 0.5, 0.5}};
+	Color specular = {{0.8, 0.8, 0.8}};
+	Point c;
+	Sphere s;
+	Plane pl;
+	int i, j;
+
+	for (i=0; i<size; i++) {
+		for (j=0; j<size; j++) {
+			Point_set(&c, (i - size/2.0) * 40.0/size, 0.5, (j - size/2.0) * 40.0/size);
+			Sphere_set(&s, c, 12.0/size);
+			Sphere_setColor(&s, red, specular, grey, 0, (i+j) % 2);
+			RayModule_sphere(rmd, &s);
+		}
+	}
+	Plane_set(&pl, 0, 1, 0, 0);
+	Plane_setColor(&pl, grey, specular, 1);
+	RayModule_plane(rmd, &pl);
+
+	Point_set(&c, 10, 40, 30);
+	Lighting_add(light, LightPoint, &white, NULL, &c, 0, 0);
+
+	Point_set(&(view->vrp), 0, 15, 40);
+	Vector_set(&(view->vpn), 0, -0.35, -1);
+}
+
+
+/*
+ * Two facing mirrors with size spheres between them, so rays bounce
+ * until they run out of depth
+ * @bench: the settings
+ * @light: the lights
+ * @rmd: the module
+ * @view: the camera, screen size already set
+ * @size: number of spheres
+ * @return: void
+ */
+static void sceneCorridor(Bench *bench, Lighting *light, RayModule *rmd,
+							View3D *view, int size) {
+	Color white = {{1.0, 1.0, 1.0}};
+	Color blue = {{0.2, 0.3, 0.8}};
+	Color grey = {{0.5, 0.5, 0.5}};
+	Color specular = {{0.9, 0.9, 0.9}};
+	Point c;
+	Sphere s;
+	Plane pl;
+	int i;
+
+	// walls at x = -2 and x = 2 facing in, and a floor
+	Plane_set(&pl, 1, 0, 0, 2);
+	Plane_setColor(&pl, grey, specular, 1);
+	RayModule_plane(rmd, &pl);
+	Plane_set(&pl, -1, 0, 0, 2);
+	Plane_setColor(&pl, grey, specular, 1);
+	RayModule_plane(rmd, &pl);
+	Plane_set(&pl, 0, 1, 0, 1);
+	Plane_setColor(&pl, grey, specular, 0);
+	RayModule_plane(rmd, &pl);
+
+	for (i=0; i<size; i++) {
+		Point_set(&c, (i % 2) ? 0.8 : -0.8, 0.0, -3.0 * i);
+		Sphere_set(&s, c, 0.5);
+		Sphere_setColor(&s, blue, specular, grey, 0, 1);
+		RayModule_sphere(rmd, &s);
+	}
+
+	Point_set(&c, 0, 6, 4);
+	Lighting_add(light, LightPoint, &white, NULL, &c, 0, 0);
+
+	Point_set(&(view->vrp), 0.3, 0.5, 5);
+	Vector_set(&(view->vpn), 0.25, -0.05, -1);
+}
+
+
+/*
+ * A 10 by 10 grid of spheres lit by size lights in a ring
+ * @bench: the settings
+ * @light: the lights
+ * @rmd: the module
+ * @view: the camera, screen size already set
+ * @size: number of lights
+ * @return: void
+ */
+static void sceneLights(Bench *bench, Lighting *light, RayModule *rmd,
+							View3D *view, int size) {
+	Color green = {{0.1, 0.6, 0.2}};
+	Color grey = {{0.5, 0.5, 0.5}};
+	Color specular = {{0.8, 0.8, 0.8}};
+	Color dim;
+	Point c;
+	Sphere s;
+	Plane pl;
+	int i, j;
+
+	for (i=0; i<10; i++) {
+		for (j=0; j<10; j++) {
+			Point_set(&c, (i - 5) * 4.0, 1.0, (j - 5) * 4.0);
+			Sphere_set(&s, c, 1.2);
+			Sphere_setColor(&s, green, specular, grey, 0, 0);
+			RayModule_sphere(rmd, &s);
+		}
+	}
+	Plane_set(&pl, 0, 1, 0, 0);
+	Plane_setColor(&pl, grey, specular, 0);
+	RayModule_plane(rmd, &pl);
+
+	Color_set(&dim, 1.0/size, 1.0/size, 1.0/size);
+	for (i=0; i<size; i++) {
+		double a = 2.0 * M_PI * i / size;
+		Point_set(&c, 25.0 * cos(a), 20.0, 25.0 * sin(a));
+		Lighting_add(light, LightPoint, &dim, NULL, &c, 0, 0);
+	}
+
+	Point_set(&(view->vrp), 0, 25, 45);
+	Vector_set(&(view->vpn), 0, -0.6, -1);
+}
+
+
+/*
+ * A size by size grid of glass spheres over a mirror floor, each
+ * reflecting and refracting, so every hit splits the path in two
+ * @bench: the settings
+ * @light: the lights
+ * @rmd: the module
+ * @view: the camera, screen size already set
+ * @size: spheres per side
+ * @return: void
+ */
+static void sceneGlass(Bench *bench, Lighting *light, RayModule *rmd,
+							View3D *view, int size) {
+	Color white = {{1.0, 1.0, 1.0}};
+	Color tint = {{0.05, 0.1, 0.08}};
+	Color grey = {{0.5, 0.5, 0.5}};
+	Color specular = {{0.3, 0.3, 0.3}};
+	Color clear = {{0.85, 0.9, 0.88}};
+	Point c;
+	Sphere s;
+	Plane pl;
+	int i, j;
+
+	for (i=0; i<size; i++) {
+		for (j=0; j<size; j++) {
+			Point_set(&c, (i - size/2.0) * 20.0/size, 12.0/size,
+							(j - size/2.0) * 20.0/size);
+			Sphere_set(&s, c, 7.0/size);
+			Sphere_setColor(&s, tint, specular, clear, 1, 1);
+			Sphere_setRIndex(&s, 1.5);
+			RayModule_sphere(rmd, &s);
+		}
+	}
+	Plane_set(&pl, 0, 1, 0, 0);
+	Plane_setColor(&pl, grey, specular, 1);
+	RayModule_plane(rmd, &pl);
+
+	Point_set(&c, 10, 30, 20);
+	Lighting_add(light, LightPoint, &white, NULL, &c, 0, 0);
+
+	Point_set(&(view->vrp), 0, 8, 18);
+	Vector_set(&(view->vpn), 0, -0.45, -1);
+}
+
+
+/*
+ * Adds a box from (-0.5, 0, -0.5) to (0.5, 1, 0.5) to a Module as six
+ * quads with flat normals
+ * @md: the Module
+ * @return: void
+ */
+static void moduleBox(Module *md) {
+	// corner i has x, y and z from bits 0, 1 and 2
+	static int face[6][4] = {{0, 1, 3, 2}, {4, 5, 7, 6}, {0, 1, 5, 4},
+								{2, 3, 7, 6}, {0, 2, 6, 4}, {1, 3, 7, 5}};
+	static double dir[6][3] = {{0, 0, -1}, {0, 0, 1}, {0, -1, 0},
+								{0, 1, 0}, {-1, 0, 0}, {1, 0, 0}};
+	Point corner[8], v[4];
+	Vector n[4];
+	Polygon pg;
+	int i, k;
+
+	for (i=0; i<8; i++) {
+		Point_set(&(corner[i]), (i & 1) - 0.5, (i >> 1) & 1, (i >> 2) - 0.5);
+	}
+	Polygon_setNULL(&pg);
+	for (i=0; i<6; i++) {
+		for (k=0; k<4; k++) {
+			v[k] = corner[face[i][k]];
+			Vector_set(&(n[k]), dir[i][0], dir[i][1], dir[i][2]);
+		}
+		Polygon_set(&pg, 4, v);
+		Polygon_setNormals(&pg, 4, n);
+		Module_polygon(md, &pg);
+	}
+	Polygon_clear(&pg);
+}
+
+
+/*
+ * A size by size city of boxes on a floor, written as a Module
+ * hierarchy and compiled with RayCompile_module: one box module placed
+ * by scale and translate, with every third block a mirror
+ * @bench: the settings; bench->rc keeps the compiled modules
+ * @light: the lights
+ * @rmd: the module
+ * @view: the camera, screen size already set
+ * @size: blocks per side
+ * @return: void
+ */
+static void sceneBlocks(Bench *bench, Lighting *light, RayModule *rmd,
+							View3D *view, int size) {
+	Color white = {{1.0, 1.0, 1.0}};
+	Color sand = {{0.75, 0.65, 0.45}};
+	Color slate = {{0.35, 0.4, 0.5}};
+	Color grey = {{0.5, 0.5, 0.5}};
+	Module *box = Module_create();
+	Module *city = Module_create();
+	Matrix identity;
+	Plane pl;
+	Point c;
+	double h, step = 40.0 / size;
+	int i, j;
+
+	moduleBox(box);
+	for (i=0; i<size; i++) {
+		for (j=0; j<size; j++) {
+			h = 1.0 + 4.0 * (((i * 7 + j * 13) % 11) / 10.0);
+			Module_bodyColor(city, (i + j) % 2 ? &sand : &slate);
+			Module_surfaceColor(city, &grey);
+			Module_surfaceCoeff(city, (i * size + j) % 3 == 0 ? 1.0 : 0.0);
+			Module_identity(city);
+			Module_scale(city, 0.6 * step, h * step / 4.0, 0.6 * step);
+			Module_translate(city, (i - size/2.0) * step, 0, (j - size/2.0) * step);
+			Module_module(city, box);
+		}
+	}
+	Plane_set(&pl, 0, 1, 0, 0);
+	Plane_setColor(&pl, grey, grey, 0);
+	Module_plane(city, &pl);
+
+	Matrix_identity(&identity);
+	RayModule_instance(rmd, RayCompile_module(&(bench->rc), city, NULL, NULL), &identity);
+	Module_delete(city);
+	Module_delete(box);
+
+	Point_set(&c, 15, 40, 25);
+	Lighting_add(light, LightPoint, &white, NULL, &c, 0, 0);
+
+	Point_set(&(view->vrp), 0, 20, 40);
+	Vector_set(&(view->vpn), 0, -0.5, -1);
+}
+
+
+/*
+ * The mesh in bench->plyFile, loaded through Mesh_readPLY, standing on
+ * a mirror floor with the camera backed off to see all of it. Nothing
+ * is added if the file cannot be read.
+ * @bench: the settings
+ * @light: the lights
+ * @rmd: the module
+ * @view: the camera, screen size already set
+ * @size: not used
+ * @return: void
+ */
+static void scenePly(Bench *bench, Lighting *light, RayModule *rmd,
+							View3D *view, int size) {
+	Color white = {{1.0, 1.0, 1.0}};
+	Color red = {{0.7, 0.13, 0.13}};
+	Color grey = {{0.5, 0.5, 0.5}};
+	Color specular = {{0.3, 0.3, 0.3}};
+	double lo[3], hi[3], mid[3], r = 0.0;
+	Point c;
+	Plane pl;
+	Mesh m;
+	int i, k;
+
+	if (Mesh_readPLY(&m, bench->plyFile) < 0) {
+		return;
+	}
+	for (k=0; k<3; k++) {
+		lo[k] = m.nVertex > 0 ? m.vertex[0].val[k] : 0.0;
+		hi[k] = lo[k];
+	}
+	for (i=1; i<m.nVertex; i++) {
+		for (k=0; k<3; k++) {
+			lo[k] = m.vertex[i].val[k] < lo[k] ? m.vertex[i].val[k] : lo[k];
+			hi[k] = m.vertex[i].val[k] > hi[k] ? m.vertex[i].val[k] : hi[k];
+		}
+	}
+	for (k=0; k<3; k++) {
+		mid[k] = (lo[k] + hi[k]) / 2.0;
+		r = hi[k] - lo[k] > r ? hi[k] - lo[k] : r;
+	}
+	r = r > 0.0 ? r : 1.0;
+
+	Mesh_setColor(&m, red, specular, grey, 0, 0);
+	RayModule_mesh(rmd, &m);
+	Plane_set(&pl, 0, 1, 0, -lo[1]);
+	Plane_setColor(&pl, grey, specular, 1);
+	RayModule_plane(rmd, &pl);
+
+	Point_set(&c, mid[0] + r, mid[1] + 3.0 * r, mid[2] + 2.0 * r);
+	Lighting_add(light, LightPoint, &white, NULL, &c, 0, 0);
+
+	Point_set(&(view->vrp), mid[0], mid[1] + 0.5 * r, mid[2] + 1.5 * r);
+	Vector_set(&(view->vpn), 0, -0.5 * r, -1.5 * r);
+}
+
+
+// #################
+// ### Benchmark ###
+// #################
+
+/*
+ * Follows every ray of a frame once, untimed, and sorts them into
+ * primary, secondary and shadow lists for the timed passes. Rays are
+ * generated the way Ray_trace and Ray_send generate them.
+ * @scene: the scene
+ * @view: the camera
+ * @depth: maximum ray depth
+ * @primary, secondary, shadow: the lists to fill
+ * @return: void
+ */
+static void collectRays(RayScene *scene, View3D *view, int depth,
+						RayList *primary, RayList *secondary, RayList *shadow) {
+	int rows = view->screeny;
+	int cols = view->screenx;
+	int max = 2 * rows * cols; 	// a generation may reflect and refract
+	Ray *cur = malloc(sizeof(Ray) * max);
+	Ray *next = malloc(sizeof(Ray) * max);
+	Ray *tmp;
+	Vector u, v, dir;
+	Point eye;
+	Intersection hit;
+	double a, b, dist;
+	Ray s;
+	int nCur = 0, nNext, x, y, i, k, gen;
+
+	// the same camera as RayRender_image
+	Vector_cross(&(view->vup), &(view->vpn), &u);
+	Vector_cross(&(view->vpn), &u, &v);
+	Vector_normalize(&u);
+	Vector_normalize(&v);
+	Point_set(&eye, view->vrp.val[0] - view->d * view->vpn.v[0],
+					view->vrp.val[1] - view->d * view->vpn.v[1],
+					view->vrp.val[2] - view->d * view->vpn.v[2]);
+	for (y=0; y<rows; y++) {
+		for (x=0; x<cols; x++) {
+			a = view->du * ((2*(double)x+1)/(2*(double)cols) - 0.5);
+			b = view->dv * ((2*(double)y+1)/(2*(double)rows) - 0.5);
+			for (i=0; i<3; i++) {
+				dir.v[i] = view->d * view->vpn.v[i] + a * u.v[i] + b * v.v[i];
+			}
+			dir.v[3] = 0.0;
+			Ray_set(&(cur[nCur]), eye, dir);
+			rayListAdd(primary, &(cur[nCur]), 0.0);
+			nCur++;
+		}
+	}
+
+	// one generation of reflections and refractions at a time
+	for (gen=0; gen<depth && nCur > 0; gen++) {
+		nNext = 0;
+		for (i=0; i<nCur; i++) {
+			if (Ray_closestHit(&(cur[i]), scene->module, &hit) < 0) {
+				continue;
+			}
+			for (k=0; k<scene->light->nLights; k++) {
+				dist = Ray_shadow(&hit, scene->light->light[k].position, &s);
+				rayListAdd(shadow, &s, dist);
+			}
+			if (gen + 1 < depth && RayElement_isReflective(hit.e) && nNext < max) {
+				Ray_reflect(&(cur[i]), &hit, &(next[nNext]));
+				rayListAdd(secondary, &(next[nNext]), 0.0);
+				nNext++;
+			}
+			if (gen + 1 < depth && RayElement_isRefractive(hit.e) && nNext < max) {
+				Ray_refract(&(cur[i]), &hit, &(next[nNext]));
+				rayListAdd(secondary, &(next[nNext]), 0.0);
+				nNext++;
+			}
+		}
+		tmp = cur;
+		cur = next;
+		next = tmp;
+		nCur = nNext;
+	}
+
+	free(cur);
+	free(next);
+}
+
+
+/*
+ * Prints one pass as a JSON object
+ * @name: the kind of ray
+ * @pass: the results
+ * @return: void
+ */
+static void printPass(char *name, BenchPass *pass) {
+	printf("\"%s\": {\"rays\": %ld, \"rays_per_sec\": %.0f, \"intersections_per_ray\": %.2f}",
+						name, pass->rays, pass->raysPerSec, pass->testsPerRay);
+}
+
+
+/*
+ * Checks that a checkpointed render resumes to the same image. A child
+ * process renders the scene, saving after every tile, and is killed
+ * bench->killMs in. The render is then resumed from its checkpoint and
+ * compared, bit for bit, with one made without a checkpoint. Last, the
+ * first light is dimmed and the finished checkpoint must be refused.
+ * bench->rr's counters are left as they were.
+ * @bench: the settings
+ * @scene: the scene
+ * @view: the camera
+ * @name: the scene name, for the checkpoint file
+ * @res: set to the results
+ * @return: void
+ */
+static void checkResume(Bench *bench, RayScene *scene, View3D *view, char *name,
+															BenchResume *res) {
+	RayRender *rr = &(bench->rr);
+	RayStats stats = rr->stats;
+	long samples = rr->samples;
+	Image *ref = Image_create(view->screeny, view->screenx);
+	Image *src = Image_create(view->screeny, view->screenx);
+	Light *l = &(scene->light->light[0]);
+	float dim = l->color.c[0];
+	char path[1024];
+	long i;
+	pid_t pid;
+
+	snprintf(path, sizeof(path), "rayBench-%s.ck", name);
+	remove(path);
+	res->tiles = ((view->screenx + rr->tileSize - 1) / rr->tileSize)
+					* ((view->screeny + rr->tileSize - 1) / rr->tileSize);
+	RayRender_image(rr, scene, view, ref);
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		rr->checkpoint = path;
+		rr->checkpointMs = 0;
+		RayRender_image(rr, scene, view, src);
+		_exit(0);
+	}
+	if (pid > 0) {
+		usleep((useconds_t)(bench->killMs * 1000));
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+
+	rr->checkpoint = path;
+	RayRender_image(rr, scene, view, src);
+	res->resumed = rr->resumedTiles;
+	res->differ = 0;
+	for (i=0; i<src->rows*src->cols; i++) {
+		res->differ += memcmp(src->data[i].rgb, ref->data[i].rgb, sizeof(ref->data[i].rgb)) != 0;
+	}
+
+	// the checkpoint is whole now, but it is of another scene
+	l->color.c[0] = dim * 0.5;
+	RayRender_image(rr, scene, view, src);
+	res->stale = rr->resumedTiles;
+	l->color.c[0] = dim;
+
+	rr->checkpoint = NULL;
+	remove(path);
+	rr->stats = stats;
+	rr->samples = samples;
+	Image_free(ref);
+	Image_free(src);
+}
+
+
+/*
+ * Builds one scene, renders it bench->frames times with the render
+ * driver, then times each kind of ray on its own and prints the lot
+ * as one line of JSON. The per kind passes run on a single thread.
+ * @bench: the settings
+ * @name: the scene name
+ * @size: the scene size
+ * @build: the scene builder
+ * @return: void
+ */
+static void runScene(Bench *bench, char *name, int size,
+		void (*build)(Bench *, Lighting *, RayModule *, View3D *, int)) {
+	Lighting *light = Lighting_create();
+	RayModule *rmd = RayModule_create();
+	RayScene scene;
+	View3D view;
+	Image *src;
+	RayList primary, secondary, shadow;
+	BenchPass pPass, sPass, shPass;
+	BenchResume resume = {0, 0, 0, 0};
+	double start, ms, buildMs, best = -1.0, total = 0.0;
+	char path[1024];
+	long over = 0;
+	int compared = 0, maxDiff = 0;
+	int nObjects = 0, i;
+	RayElement *e;
+
+	view.screenx = bench->width;
+	view.screeny = bench->height;
+	view.d = 1.0;
+	view.du = 1.6;
+	view.dv = 1.6 * bench->height / bench->width;
+	view.f = 0.0;
+	view.b = 100.0;
+	Vector_set(&(view.vup), 0.0, 1.0, 0.0);
+	build(bench, light, rmd, &view, size);
+	for (e = rmd->head; e; e = e->next) {
+		nObjects++;
+	}
+	if (nObjects == 0) {
+		fprintf(stderr, "rayBench: scene %s is empty\n", name);
+		RayModule_delete(rmd);
+		RayCompile_clear(&(bench->rc));
+		Lighting_delete(light);
+		return;
+	}
+
+	start = now();
+	RayModule_setAccel(rmd, bench->accel);
+	RayScene_init(&scene, light, rmd);
+	RayScene_sampleLights(&scene, bench->lightSamples);
+	scene.minWeight = bench->minWeight;
+	scene.roulette = bench->roulette;
+	buildMs = now() - start;
+
+	// whole frames through the render driver
+	src = Image_create(view.screeny, view.screenx);
+	for (i=0; i<bench->frames; i++) {
+		start = now();
+		if (bench->progressive) {
+			RayRender_progressive(&(bench->rr), &scene, &view, src);
+		}
+		else {
+			RayRender_image(&(bench->rr), &scene, &view, src);
+		}
+		ms = now() - start;
+		total += ms;
+		best = best < 0 || ms < best ? ms : best;
+	}
+	if (bench->save != NULL) {
+		snprintf(path, sizeof(path), "%s%s.ppm", bench->save, name);
+		Image_writePPM(src, path);
+	}
+	if (bench->compare != NULL) {
+		snprintf(path, sizeof(path), "%s%s.ppm", bench->compare, name);
+		compared = compareFrame(src, path, &over, &maxDiff) == 0;
+		if (!compared) {
+			fprintf(stderr, "rayBench: cannot compare with %s\n", path);
+		}
+	}
+	Image_free(src);
+
+	// a render killed part way must resume to the same image
+	if (bench->killMs > 0 && light->nLights > 0) {
+		checkResume(bench, &scene, &view, name, &resume);
+		if (resume.differ > 0 || resume.stale > 0) {
+			bench->failed = 1;
+		}
+	}
+
+	// each kind of ray on its own
+	rayListInit(&primary, BENCH_MAX_RAYS);
+	rayListInit(&secondary, BENCH_MAX_RAYS);
+	rayListInit(&shadow, BENCH_MAX_RAYS);
+	collectRays(&scene, &view, bench->depth, &primary, &secondary, &shadow);
+	timeClosest(rmd, &primary, &pPass);
+	timeClosest(rmd, &secondary, &sPass);
+	timeShadow(rmd, &shadow, &shPass);
+
+	printf("{\"scene\": \"%s\", \"size\": %d, \"objects\": %d, \"lights\": %d, "
+				"\"width\": %d, \"height\": %d, \"depth\": %d, \"threads\": %d, "
+				"\"processes\": %d, \"packet\": %d, \"raster\": %d, \"wavefront\": %d, \"accel\": \"%s\", \"order\": \"%s\", "
+				"\"sort_secondary\": %d, \"light_samples\": %d, \"min_weight\": %g, "
+				"\"roulette\": %d, \"progressive\": %d, \"budget_ms\": %g, \"step\": %d, "
+				"\"precision\": \"%s\", "
+				"\"frames\": %d, "
+				"\"ms_build\": %.3f, \"ms_per_frame\": %.3f, \"ms_best_frame\": %.3f, ",
+				name, size, nObjects, light->nLights, view.screenx, view.screeny,
+				bench->depth, RayRender_threads(&(bench->rr)), bench->rr.processes,
+				bench->rr.packet, bench->rr.raster, bench->rr.wavefront,
+				accelNames[bench->accel], orderNames[bench->rr.order],
+				bench->rr.sortSecondary, bench->lightSamples, bench->minWeight,
+				bench->roulette, bench->progressive, bench->rr.budgetMs,
+				bench->progressive ? bench->rr.step : 1,
+				sizeof(Real) == sizeof(float) ? "float" : "double", bench->frames, buildMs,
+				bench->frames > 0 ? total / bench->frames : 0.0,
+				best);
+	printPass("primary", &pPass);
+	printf(", ");
+	printPass("secondary", &sPass);
+	printf(", ");
+	printPass("shadow", &shPass);
+	if (compared) {
+		printf(", \"compare\": {\"file\": \"%s\", \"levels\": %d, \"pixels_over\": %ld, "
+					"\"max_diff\": %d}", path, BENCH_DIFF_LEVELS, over, maxDiff);
+	}
+	if (bench->killMs > 0 && light->nLights > 0) {
+		printf(", \"resume\": {\"kill_ms\": %g, \"tiles\": %d, \"resumed\": %d, "
+					"\"pixels_differ\": %ld, \"stale_resumed\": %d}", bench->killMs,
+					resume.tiles, resume.resumed, resume.differ, resume.stale);
+	}
+	printf(", \"stats\": ");
+	RayStats_print(&(bench->rr.stats), stdout);
+	printf("}\n");
+	fflush(stdout);
+
+	rayListFree(&primary);
+	rayListFree(&secondary);
+	rayListFree(&shadow);
+	RayScene_clear(&scene);
+	RayModule_delete(rmd);
+	RayCompile_clear(&(bench->rc));
+	Lighting_delete(light);
+}
+
+
+int main(int argc, char *argv[]) {
+	Bench bench;
+	int i, k;
+
+	bench.scene = NULL;
+	bench.plyFile = NULL;
+	bench.size = 0;
+	bench.width = 640;
+	bench.height = 360;
+	bench.depth = 10;
+	bench.frames = 3;
+	bench.lightSamples = 0;
+	bench.minWeight = RAY_MIN_WEIGHT;
+	bench.roulette = 0;
+	bench.progressive = 0;
+	bench.save = NULL;
+	bench.compare = NULL;
+	bench.killMs = 0.0;
+	bench.failed = 0;
+	bench.accel = RayAccelBVH;
+	RayRender_init(&(bench.rr));
+	RayCompile_init(&(bench.rc));
+
+	// usage: rayBench [-s spheres|corridor|lights|glass|blocks|ply file] [-n size] [-w width]
+	//                 [-h height] [-d depth] [-f frames] [-t threads] [-p]
+	//                 [-r] [-q] [-P processes] [-a bvh|grid|grid2] [-o scanline|morton|hilbert]
+	//                 [-u sort secondary shading by octant]
+	//                 [-L lights sampled per point] [-W least path weight] [-R]
+	//                 [-b progressive time budget in ms, 0 = none]
+	//                 [-i prefix to save the last frame under]
+	//                 [-c prefix of saved frames to compare the last frame with]
+	//                 [-k ms to kill a checkpointed render after, then check its resume]
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-p") == 0) {
+			bench.rr.packet = 1;
+		}
+		else if (strcmp(argv[i], "-r") == 0) {
+			bench.rr.raster = 1;
+		}
+		else if (strcmp(argv[i], "-q") == 0) {
+			bench.rr.wavefront = 1;
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-b") == 0) {
+			bench.progressive = 1;
+			bench.rr.budgetMs = atof(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-i") == 0) {
+			bench.save = argv[++i];
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-c") == 0) {
+			bench.compare = argv[++i];
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-k") == 0) {
+			bench.killMs = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-u") == 0) {
+			bench.rr.sortSecondary = 1;
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-s") == 0) {
+			bench.scene = argv[++i];
+			if (strcmp(bench.scene, "ply") == 0) {
+				if (i+1 == argc) {
+					fprintf(stderr, "rayBench: -s ply needs a file\n");
+					return(1);
+				}
+				bench.plyFile = argv[++i];
+			}
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-n") == 0) {
+			bench.size = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-w") == 0) {
+			bench.width = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-h") == 0) {
+			bench.height = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-d") == 0) {
+			bench.depth = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-f") == 0) {
+			bench.frames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-R") == 0) {
+			bench.roulette = 1;
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-W") == 0) {
+			bench.minWeight = atof(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-L") == 0) {
+			bench.lightSamples = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-t") == 0) {
+			bench.rr.nThreads = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-P") == 0) {
+			bench.rr.processes = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-a") == 0) {
+			i++;
+			for (k=0; k<3 && strcmp(argv[i], accelNames[k]) != 0; k++);
+			if (k == 3) {
+				fprintf(stderr, "rayBench: unknown structure %s\n", argv[i]);
+				return(1);
+			}
+			bench.accel = (RayAccel)k;
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-o") == 0) {
+			i++;
+			for (k=0; k<3 && strcmp(argv[i], orderNames[k]) != 0; k++);
+			if (k == 3) {
+				fprintf(stderr, "rayBench: unknown order %s\n", argv[i]);
+				return(1);
+			}
+			bench.rr.order = (RayOrder)k;
+		}
+		else {
+			fprintf(stderr, "rayBench: unknown option %s\n", argv[i]);
+			return(1);
+		}
+	}
+	if (bench.width <= 0 || bench.height <= 0) {
+		fprintf(stderr, "rayBench: bad image size\n");
+		return(1);
+	}
+	bench.rr.depth = bench.depth;
+	bench.rc.accel = bench.accel;
+
+	if (bench.scene == NULL || strcmp(bench.scene, "spheres") == 0) {
+		runScene(&bench, "spheres", bench.size > 0 ? bench.size : 32, sceneSpheres);
+	}
+	if (bench.scene == NULL || strcmp(bench.scene, "corridor") == 0) {
+		runScene(&bench, "corridor", bench.size > 0 ? bench.size : 8, sceneCorridor);
+	}
+	if (bench.scene == NULL || strcmp(bench.scene, "lights") == 0) {
+		runScene(&bench, "lights", bench.size > 0 ? bench.size : 16, sceneLights);
+	}
+	if (bench.scene == NULL || strcmp(bench.scene, "glass") == 0) {
+		runScene(&bench, "glass", bench.size > 0 ? bench.size : 6, sceneGlass);
+	}
+	if (bench.scene == NULL || strcmp(bench.scene, "blocks") == 0) {
+		runScene(&bench, "blocks", bench.size > 0 ? bench.size : 16, sceneBlocks);
+	}
+	if (bench.plyFile != NULL) {
+		runScene(&bench, "ply", bench.size, scenePly);
+	}
+
+	return(bench.failed);
+}
@@ -20,7 +20,9 @@ int main(int argc, char *argv[]) {
 	Image *src;
 	int rows = 700;
 	int cols = 1200;
-	int x,y;
+	int stats = 0;
+	int progressive = 0;
+	int i;
 	
 	// Variables
 	Point lightPos;
@@ -30,14 +32,12 @@ int main(int argc, char *argv[]) {
 	Matrix VTM;
 	Matrix GTM;
 	View3D view;
-	Vector view_u;
-	Vector view_v;
-	Ray currRay;
-	Vector currV;
-	Point eye;
+	RayRender render;
+	RayScene scene;
+	Lighting *light;
+	RayModule *rmd;
 	
 	// Lots of colors
-	Color pointC;
 	Color black = {{0.0, 0.0, 0.0}};
 	Color white = {{1.0, 1.0, 1.0}};
 	Color red = {{0.7, 0.13, 0.13}};
@@ -61,10 +61,6 @@ int main(int argc, char *argv[]) {
 	Point_set(&(view.vrp), 10, 6, 10);
 	Vector_set(&(view.vpn), -10, -6, -10);
 	Vector_set(&(view.vup), 0.0, 1.0, 0.0);
-	Vector_cross(&(view.vup), &(view.vpn), &(view_u));
-	Vector_cross(&(view.vpn), &(view_u), &(view_v));
-	Vector_normalize(&(view_u));
-	Vector_normalize(&(view_v));
 
 	view.d = 1.0;
 	view.du = 6.0;
@@ -83,88 +79,120 @@ int main(int argc, char *argv[]) {
 	src = Image_create(rows, cols);
 	
 	// Add a single white light on the left pointing right
-	global_light = Lighting_create();
+	light = Lighting_create();
 	Point_set(&(lightPos), 8, 8, -1);
-	Lighting_add( global_light, LightPoint, &white, NULL, &(lightPos), 0, 0 );
+	Lighting_add( light, LightPoint, &white, NULL, &(lightPos), 0, 0 );
 	
 	// Create the module
-	global_rayModule = RayModule_create();
+	rmd = RayModule_create();
 	
 	// Float ball 1
 	Point_set(&sphere_c, 3.0, 1.5, -3.5);
 	Sphere_set(&(sphere), sphere_c, 0.75);
 	Sphere_setColor(&(sphere), orange, coeffRefract, coeffReflect, 1, 1);
 	Sphere_setRIndex(&(sphere), 1.5);
-	RayModule_sphere(global_rayModule, &(sphere));
+	RayModule_sphere(rmd, &(sphere));
 	
 	// Ball 4
 	Point_set(&sphere_c, -6, 0.75, 0);
 	Sphere_set(&(sphere), sphere_c, 1.6);
 	Sphere_setColor(&(sphere), darkTurquoise, coeffRefract, coeffReflect, 1, 1);
 	Sphere_setRIndex(&(sphere), 1.5);
-	RayModule_sphere(global_rayModule, &(sphere));
+	RayModule_sphere(rmd, &(sphere));
 	
 	// Ball 3
 	Point_set(&sphere_c, -1, 0, 0);
 	Sphere_set(&(sphere), sphere_c, 1.4);
 	Sphere_setColor(&(sphere), green, coeffRefract, coeffReflect, 1, 1);
 	Sphere_setRIndex(&(sphere), 1.5);
-	RayModule_sphere(global_rayModule, &(sphere));
+	RayModule_sphere(rmd, &(sphere));
 	
 	// Ball 2
 	Point_set(&sphere_c, 3, -0.75, 0);
 	Sphere_set(&(sphere), sphere_c, 1.2);
 	Sphere_setColor(&(sphere), red, coeffRefract, coeffReflect, 1, 1);
 	Sphere_setRIndex(&(sphere), 1.5);
-	RayModule_sphere(global_rayModule, &(sphere));
+	RayModule_sphere(rmd, &(sphere));
 	
 	// Ball 1
 	Point_set(&sphere_c, 6, -1.5, 0);
 	Sphere_set(&(sphere), sphere_c, 1.0);
 	Sphere_setColor(&(sphere), slateBlue, coeffRefract, coeffReflect, 1, 1);
 	Sphere_setRIndex(&(sphere), 1.5);
-	RayModule_sphere(global_rayModule, &(sphere));
+	RayModule_sphere(rmd, &(sphere));
 	
 	// The floor
 	Plane_set(&plane, 0, 1, 0, 1);
 	Plane_setColor(&(plane), khaki, coeffReflect, 1);
-	RayModule_plane(global_rayModule, &(plane));
-	
-	// Trace the rays	
-	for (y=0; y<rows; y++) {
-		for (x=0; x<cols; x++) {
-			// set the current vector
-			currV.v[0] = view.d * view.vpn.v[0] 
-					  + view.du * ((2*(double)x+1)/(2*(double)cols) - 0.5) * view_u.v[0] 
-					  + view.dv * ((2*(double)y+1)/(2*(double)rows) - 0.5) * view_v.v[0];
-			currV.v[1] = view.d * view.vpn.v[1] 
-					  + view.du * ((2*(double)x+1)/(2*(double)cols) - 0.5) * view_u.v[1] 
-					  + view.dv * ((2*(double)y+1)/(2*(double)rows) - 0.5) * view_v.v[1];
-			currV.v[2] = view.d * view.vpn.v[2] 
-					  + view.du * ((2*(double)x+1)/(2*(double)cols) - 0.5) * view_u.v[2] 
-					  + view.dv * ((2*(double)y+1)/(2*(double)rows) - 0.5) * view_v.v[2];
-					
-			// set our view
-			eye.val[0] = view.vrp.val[0] - view.d * view.vpn.v[0];
-			eye.val[1] = view.vrp.val[1] - view.d * view.vpn.v[1];
-			eye.val[2] = view.vrp.val[2] - view.d * view.vpn.v[2];
-			
-			// set the current ray
-			Ray_set(&currRay, eye, currV);
-			
-			// trace the ray
-			pointC = Ray_trace(&currRay, 10, eye, view.vrp);
-			
-			// Set the color
-			Image_setColor(src, rows-y, x, pointC);
+	RayModule_plane(rmd, &(plane));
+	
+	// Trace the rays
+	// usage: rayTest [threads] [-p] [-r] [-q] [-a] [-s] [-P processes] [-b budget ms]
+	//                [-c checkpoint file] [-C ms between checkpoints]
+	RayRender_init(&render);
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-p") == 0) {
+			render.packet = 1;
+		}
+		else if (strcmp(argv[i], "-r") == 0) {
+			render.raster = 1;
+		}
+		else if (strcmp(argv[i], "-q") == 0) {
+			render.wavefront = 1;
+		}
+		else if (strcmp(argv[i], "-a") == 0) {
+			render.aa = 2;
+		}
+		else if (strcmp(argv[i], "-s") == 0) {
+			stats = 1;
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-P") == 0) {
+			render.processes = atoi(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-c") == 0) {
+			render.checkpoint = argv[++i];
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-C") == 0) {
+			render.checkpointMs = atof(argv[++i]);
+		}
+		else if (i+1 < argc && strcmp(argv[i], "-b") == 0) {
+			progressive = 1;
+			render.budgetMs = atof(argv[++i]);
+		}
+		else {
+			render.nThreads = atoi(argv[i]);
+		}
+	}
+	RayScene_init(&scene, light, rmd);
+	if (progressive) {
+		RayRender_progressive(&render, &scene, &view, src);
+		printf("progressive, finest pass every %d pixels\n", render.step);
+	}
+	else {
+		RayRender_image(&render, &scene, &view, src);
+		if (render.checkpoint != NULL) {
+			printf("resumed %d tiles from %s\n", render.resumedTiles, render.checkpoint);
 		}
 	}
+	printf("%ld samples, %.2f per pixel\n", render.samples,
+									(double)render.samples / (rows * cols));
+	if (stats) {
+		RayStats_print(&(render.stats), stdout);
+		printf("\n");
+	}
 	
 	// Write the image
 	Image_writePPM( src, "raytest.ppm" );
 	
-	// Free the image
+	// the image is safe, so the checkpoint is no longer needed
+	if (render.checkpoint != NULL) {
+		remove(render.checkpoint);
+	}
+	
+	// Free the image and the scene
 	Image_free( src );
+	RayModule_delete(rmd);
+	Lighting_delete(light);
 	
 	return(0);
 }